@@ -0,0 +1,67 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#define AF_ALLOCATOR_IMPLEMENTATION
+#include "af_allocator.h"
+
+#ifndef AF_LIB_NO_HEAP
+static void *af_allocator_heap_alloc(void *context, size_t size) {
+    return malloc(size);
+}
+
+static void af_allocator_heap_free(void *context, void *ptr) {
+    free(ptr);
+}
+
+#define DEFAULT_ALLOCATOR   { af_allocator_heap_alloc, af_allocator_heap_free, NULL }
+#else
+// Without a heap there's nothing to allocate from until an allocator is supplied
+#define DEFAULT_ALLOCATOR   { NULL, NULL, NULL }
+#endif
+
+static const af_lib_allocator_t s_default_allocator = DEFAULT_ALLOCATOR;
+static af_lib_allocator_t s_allocator = DEFAULT_ALLOCATOR;
+
+void af_allocator_set(const af_lib_allocator_t *allocator) {
+    s_allocator = allocator != NULL ? *allocator : s_default_allocator;
+}
+
+void af_allocator_get(af_lib_allocator_t *allocator) {
+    *allocator = s_allocator;
+}
+
+void *af_allocator_malloc(size_t size) {
+    return af_allocator_alloc_with(&s_allocator, size);
+}
+
+void af_allocator_free(void *ptr) {
+    af_allocator_free_with(&s_allocator, ptr);
+}
+
+void *af_allocator_alloc_with(const af_lib_allocator_t *allocator, size_t size) {
+    if (NULL == allocator->alloc) {
+        return NULL;
+    }
+    return allocator->alloc(allocator->context, size);
+}
+
+void af_allocator_free_with(const af_lib_allocator_t *allocator, void *ptr) {
+    if (ptr != NULL && allocator->free != NULL) {
+        allocator->free(allocator->context, ptr);
+    }
+}
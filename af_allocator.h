@@ -0,0 +1,76 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Internal memory allocation for afLib and its transports.
+ *
+ * Everything an afLib instance allocates at runtime goes through af_allocator_alloc_with/af_allocator_free_with and
+ * the allocator the instance was created with. Allocations that don't belong to an instance, such as a transport's,
+ * go through af_allocator_malloc/af_allocator_free and the default allocator, which is the C heap unless
+ * af_allocator_set() changed it.
+ *
+ * Defining AF_LIB_NO_HEAP takes the C heap out of the picture: everything comes from static pools and, unless an
+ * allocator was passed in, af_allocator_malloc always fails. Include this file after the system headers and any
+ * remaining call to malloc/free in afLib will fail to link. To catch references anywhere else in the image, link with
+ * -Wl,--wrap=malloc -Wl,--wrap=free as nothing provides __wrap_malloc or __wrap_free.
+ */
+#ifndef AF_ALLOCATOR_H
+#define AF_ALLOCATOR_H
+
+#include <stddef.h>
+#include "af_lib.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/**
+ * af_allocator_set
+ *
+ * Change the default allocator. NULL goes back to the C heap. Instances already created keep the allocator they were
+ * created with, so only set it while nothing allocated from the old one is still around.
+ */
+void af_allocator_set(const af_lib_allocator_t *allocator);
+
+/**
+ * af_allocator_get
+ *
+ * Copy out the default allocator, for an instance to keep.
+ */
+void af_allocator_get(af_lib_allocator_t *allocator);
+
+void *af_allocator_malloc(size_t size);
+
+void af_allocator_free(void *ptr);
+
+void *af_allocator_alloc_with(const af_lib_allocator_t *allocator, size_t size);
+
+void af_allocator_free_with(const af_lib_allocator_t *allocator, void *ptr);
+
+#if defined(AF_LIB_NO_HEAP) && !defined(AF_ALLOCATOR_IMPLEMENTATION)
+// Deliberately never defined
+void *af_lib_no_heap_build_references_malloc(size_t size);
+void af_lib_no_heap_build_references_free(void *ptr);
+
+#define malloc(size)        af_lib_no_heap_build_references_malloc(size)
+#define free(ptr)           af_lib_no_heap_build_references_free(ptr)
+#endif
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* AF_ALLOCATOR_H */
@@ -20,11 +20,14 @@
 #include "af_command.h"
 #include "af_msg_types.h"
 #include "af_logger.h"
+#include "af_allocator.h"
 
 #define CMD_HDR_LEN  4    // 4 byte header on all commands
 #define CMD_VAL_LEN  2    // 2 byte value length for commands that have a value
 
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
 const char *CMD_NAMES[] = {"SET   ", "GET   ", "UPDATE"};
+#endif
 
 static uint8_t str_to_cmd(char *cmdStr) {
     char c = cmdStr[0];
@@ -51,8 +54,8 @@ static uint8_t get_val(char c) {
     else if (c >= 'a' && c <= 'f')
         return (uint8_t)(c - 'a' + 10);
 
-    af_logger_print_buffer("bad hex char: ");
-    af_logger_println_value(c);
+    AF_LOG_WARN(af_logger_print_buffer("bad hex char: ");
+                af_logger_println_value(c));
 
     return 0;
 }
@@ -68,46 +71,58 @@ static int str_to_value(char *valueStr, uint8_t *value) {
 }
 
 
-void af_command_initialize_from_buffer(af_command_t *af_command, uint16_t len, uint8_t *bytes, uint8_t protocol_version) {
-    int index = 0;
+bool af_command_initialize_from_buffer(af_command_t *af_command, uint16_t len, uint8_t *bytes, uint8_t protocol_version) {
+    uint16_t index = 0;
     memset(af_command, 0, sizeof(af_command_t));
 
+    if (len < CMD_HDR_LEN) {
+        return false;
+    }
+
     af_command->cmd = bytes[index++];
     af_command->request_id = bytes[index++];
     af_command->attr_id = bytes[index + 0] | bytes[index + 1] << 8;
     index += 2;
 
     if (MSG_TYPE_GET == af_command->cmd) {
-        return;
-    }
-    if (MSG_TYPE_UPDATE == af_command->cmd) {
-        af_command->state = bytes[index++];
-        af_command->reason = bytes[index++];
+        return true;
     }
-    if (MSG_TYPE_UPDATE_REJECTED == af_command->cmd) {
+    if (MSG_TYPE_UPDATE == af_command->cmd || MSG_TYPE_UPDATE_REJECTED == af_command->cmd ||
+        (protocol_version < 2 && MSG_TYPE_UPDATE_REJECTED_V1 == af_command->cmd)) {
+        if (len < index + 2) {
+            return false;
+        }
         af_command->state = bytes[index++];
         af_command->reason = bytes[index++];
-        return;
-    }
-    if (protocol_version < 2) {
-        if (MSG_TYPE_UPDATE_REJECTED_V1 == af_command->cmd) {
-            af_command->state = bytes[index++];
-            af_command->reason = bytes[index++];
-            return;
+        if (MSG_TYPE_UPDATE != af_command->cmd) {
+            return true;
         }
     }
 
+    if (len < index + CMD_VAL_LEN) {
+        return false;
+    }
     af_command->value_len = bytes[index + 0] | bytes[index + 1] << 8;
-    index += 2;
-    af_command->value = (uint8_t*)malloc(af_command->value_len);
-    memcpy(af_command->value, bytes + index, af_command->value_len);
+    index += CMD_VAL_LEN;
+    if (af_command->value_len > len - index) {
+        af_command->value_len = 0;
+        return false;
+    }
+    af_command->value = bytes + index;
+
+    return true;
 }
 
 void af_command_initialize_from_string(af_command_t *af_command, uint8_t request_id, const char *str) {
     char *cp;
     char *tok;
 
-    cp = strdup(str);
+    cp = (char*)af_allocator_malloc(strlen(str) + 1);
+    if (NULL == cp) {
+        memset(af_command, 0, sizeof(af_command_t));
+        return;
+    }
+    strcpy(cp, str);
     tok = strtok(cp, " ");
 
     memset(af_command, 0, sizeof(af_command_t));
@@ -122,11 +137,16 @@ void af_command_initialize_from_string(af_command_t *af_command, uint8_t request
     if (af_command->cmd != MSG_TYPE_GET) {
         tok = strtok(NULL, " ");
         af_command->value_len = strlen(tok) / 2;
-        af_command->value = (uint8_t*)malloc(af_command->value_len);
-        str_to_value(tok, af_command->value);
+        af_command->value = (uint8_t*)af_allocator_malloc(af_command->value_len);
+        if (af_command->value != NULL) {
+            af_command->owns_value = true;
+            str_to_value(tok, af_command->value);
+        } else {
+            af_command->value_len = 0;
+        }
     }
 
-    free(cp);
+    af_allocator_free(cp);
 }
 
 void af_command_initialize_with_attr_id(af_command_t *af_command, uint8_t request_id, uint8_t cmd, uint16_t attr_id) {
@@ -136,14 +156,17 @@ void af_command_initialize_with_attr_id(af_command_t *af_command, uint8_t reques
     af_command->attr_id = attr_id;
 }
 
+/*
+ * The value passed to af_command_initialize_with_value() and af_command_initialize_with_status() is not copied, it must
+ * stay valid until af_command_cleanup() is called.
+ */
 void af_command_initialize_with_value(af_command_t *af_command, uint8_t request_id, uint8_t cmd, uint16_t attr_id, uint16_t value_len, uint8_t *value) {
     memset(af_command, 0, sizeof(af_command_t));
     af_command->request_id = request_id;
     af_command->cmd = cmd;
     af_command->attr_id = attr_id;
     af_command->value_len = value_len;
-    af_command->value = (uint8_t*)malloc(af_command->value_len);
-    memcpy(af_command->value, value, af_command->value_len);
+    af_command->value = value;
 }
 
 void af_command_initialize_with_status(af_command_t *af_command, uint8_t request_id, uint8_t cmd, uint16_t attr_id, uint8_t state, uint8_t reason, uint16_t value_len, uint8_t *value, bool mcu_started) {
@@ -154,9 +177,8 @@ void af_command_initialize_with_status(af_command_t *af_command, uint8_t request
     af_command->state = state;
     af_command->reason = reason;
     af_command->value_len = value_len;
-    af_command->value = (uint8_t*)malloc(af_command->value_len);
+    af_command->value = value;
     af_command->mcu_started = mcu_started;
-    memcpy(af_command->value, value, af_command->value_len);
 }
 
 void af_command_initialize(af_command_t *af_command) {
@@ -164,8 +186,8 @@ void af_command_initialize(af_command_t *af_command) {
 }
 
 void af_command_cleanup(af_command_t *af_command) {
-    if (af_command->value != NULL) {
-        free(af_command->value);
+    if (af_command->owns_value && af_command->value != NULL) {
+        af_allocator_free(af_command->value);
     }
     memset(af_command, 0, sizeof(af_command_t));
 }
@@ -208,9 +230,21 @@ uint16_t af_command_get_size(af_command_t *af_command) {
     return len;
 }
 
-uint16_t af_command_get_bytes(af_command_t *af_command, uint8_t *bytes) {
-    uint16_t len = af_command_get_size(af_command);
+uint16_t af_command_get_header_size(af_command_t *af_command) {
+    uint16_t len = CMD_HDR_LEN;
+
+    if (af_command->cmd != MSG_TYPE_GET) {
+        len += CMD_VAL_LEN;
+    }
+
+    if (af_command->cmd == MSG_TYPE_UPDATE) {
+        len += 2; // status byte + reason byte
+    }
+
+    return len;
+}
 
+uint16_t af_command_get_header_bytes(af_command_t *af_command, uint8_t *bytes) {
     int index = 0;
 
     bytes[index++] = (af_command->cmd);
@@ -219,7 +253,7 @@ uint16_t af_command_get_bytes(af_command_t *af_command, uint8_t *bytes) {
     bytes[index++] = ((af_command->attr_id >> 8) & 0xff);
 
     if (MSG_TYPE_GET == af_command->cmd) {
-        return len;
+        return index;
     }
 
     if (MSG_TYPE_UPDATE == af_command->cmd) {
@@ -230,6 +264,17 @@ uint16_t af_command_get_bytes(af_command_t *af_command, uint8_t *bytes) {
     bytes[index++] = (af_command->value_len & 0xff);
     bytes[index++] = ((af_command->value_len >> 8) & 0xff);
 
+    return index;
+}
+
+uint16_t af_command_get_bytes(af_command_t *af_command, uint8_t *bytes) {
+    uint16_t len = af_command_get_size(af_command);
+    uint16_t index = af_command_get_header_bytes(af_command, bytes);
+
+    if (MSG_TYPE_GET == af_command->cmd) {
+        return len;
+    }
+
     memcpy(bytes + index, af_command->value, af_command->value_len);
 
     return len;
@@ -251,42 +296,51 @@ bool af_command_is_valid(af_command_t *af_command) {
     return (MSG_TYPE_SET == af_command->cmd) || (MSG_TYPE_GET == af_command->cmd) || (MSG_TYPE_UPDATE == af_command->cmd);
 }
 
-void af_command_dump(af_command_t *af_command) {
-    memset(af_command->print_buf, 0, MAX_PRINT_BUFFER);
-    snprintf(af_command->print_buf, MAX_PRINT_BUFFER, "cmd: %s attr: %d value: ", CMD_NAMES[af_command->cmd - MESSAGE_CHANNEL_BASE - 1], af_command->attr_id);
-    if (af_command->cmd != MSG_TYPE_GET) {
-        uint16_t size_so_far = strlen(af_command->print_buf);
-        int i = 0;
-        for (i = 0; i < af_command->value_len; i++) {
-            sprintf(af_command->print_buf + size_so_far + i, "%02x", af_command->value[i]);
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+static void dump_hex(const uint8_t *bytes, uint16_t len) {
+    uint16_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        if (bytes[i] < 0x10) {
+            af_logger_print_buffer("0");
         }
+        af_logger_print_formatted_value(bytes[i], AF_LOGGER_HEX);
     }
-
-    af_logger_println_buffer(af_command->print_buf);
 }
+#endif
 
-void af_command_dump_bytes(af_command_t *af_command) {
-    uint16_t len = af_command_get_size(af_command);
-    uint8_t *bytes = malloc(len);
-    uint16_t size_so_far;
-    int i = 0;
-
-    if (bytes == NULL) {
-    	af_logger_println_buffer("af_command_dump_bytes: malloc failed");
-    	return;
+void af_command_dump(af_command_t *af_command) {
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+    af_logger_print_buffer("cmd: ");
+    if (af_command_is_valid(af_command)) {
+        af_logger_print_buffer(CMD_NAMES[af_command->cmd - MESSAGE_CHANNEL_BASE - 1]);
+    } else {
+        af_logger_print_value(af_command->cmd);
     }
-
-    af_command_get_bytes(af_command, bytes);
-
-    memset(af_command->print_buf, 0, MAX_PRINT_BUFFER);
-    snprintf(af_command->print_buf, MAX_PRINT_BUFFER, "len: %d value: ", len);
-    size_so_far = strlen(af_command->print_buf);
-    for (i = 0; i < len; i++) {
-        sprintf(af_command->print_buf + size_so_far + i, "%02x", af_command->value[i]);
+    af_logger_print_buffer(" attr: ");
+    af_logger_print_value(af_command->attr_id);
+    af_logger_print_buffer(" value: ");
+    if (af_command->cmd != MSG_TYPE_GET) {
+        dump_hex(af_command->value, af_command->value_len);
     }
-    af_logger_println_buffer(af_command->print_buf);
+    af_logger_println_buffer("");
+#endif
+}
 
-    free(bytes);
+void af_command_dump_bytes(af_command_t *af_command) {
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+    uint8_t header[AF_COMMAND_MAX_HEADER_LEN];
+    uint16_t header_len = af_command_get_header_bytes(af_command, header);
+
+    af_logger_print_buffer("len: ");
+    af_logger_print_value(af_command_get_size(af_command));
+    af_logger_print_buffer(" value: ");
+    dump_hex(header, header_len);
+    if (af_command->cmd != MSG_TYPE_GET) {
+        dump_hex(af_command->value, af_command->value_len);
+    }
+    af_logger_println_buffer("");
+#endif
 }
 
 
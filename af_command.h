@@ -24,22 +24,27 @@
 extern "C" {
 #endif
 
-#define MAX_PRINT_BUFFER    256
+// Largest command header that can precede the value on the wire (cmd, request id, attr id, state, reason, value length)
+#define AF_COMMAND_MAX_HEADER_LEN   8
 
+// Only what goes on the wire plus two flags, the value itself lives elsewhere
 typedef struct {
-    uint16_t    len;
+    uint8_t     *value;
+    uint16_t    attr_id;
+    uint16_t    value_len;
     uint8_t     cmd;
     uint8_t     request_id;
-    uint16_t    attr_id;
     uint8_t     state;
     uint8_t     reason;
-    uint16_t    value_len;
-    uint8_t     *value;
-    char        print_buf[MAX_PRINT_BUFFER];
-    bool        mcu_started; // whether or not this command originated on the MCU or not
+    bool        mcu_started : 1; // whether or not this command originated on the MCU or not
+    bool        owns_value : 1;  // whether or not value was allocated by this command and must be freed on cleanup
 } af_command_t;
 
-void af_command_initialize_from_buffer(af_command_t *af_command, uint16_t len, uint8_t *bytes, uint8_t protocol_version);
+/**
+ * Parse a received command. The value is not copied, the command points into bytes so the buffer has to outlive it.
+ * Returns false if the command claims more bytes than len.
+ */
+bool af_command_initialize_from_buffer(af_command_t *af_command, uint16_t len, uint8_t *bytes, uint8_t protocol_version);
 void af_command_initialize_from_string(af_command_t *af_command, uint8_t request_id, const char *str);
 void af_command_initialize_with_attr_id(af_command_t *af_command, uint8_t request_id, uint8_t cmd, uint16_t attr_id);
 void af_command_initialize_with_value(af_command_t *af_command, uint8_t request_id, uint8_t cmd, uint16_t attr_id, uint16_t value_len, uint8_t *value);
@@ -63,6 +68,14 @@ uint16_t af_command_get_size(af_command_t *af_command);
 
 uint16_t af_command_get_bytes(af_command_t *af_command, uint8_t *bytes);
 
+/**
+ * The header is everything af_command_get_bytes() writes ahead of the value. Writing just the header lets a caller
+ * that already holds the value with AF_COMMAND_MAX_HEADER_LEN bytes of headroom serialize the command in place.
+ */
+uint16_t af_command_get_header_size(af_command_t *af_command);
+
+uint16_t af_command_get_header_bytes(af_command_t *af_command, uint8_t *bytes);
+
 uint8_t af_command_get_reason(af_command_t *af_command);
 
 uint8_t af_command_get_state(af_command_t *af_command);
@@ -71,6 +84,10 @@ bool af_command_get_mcu_started(af_command_t *af_command);
 
 bool af_command_is_valid(af_command_t *af_command);
 
+/**
+ * The dump functions stream straight to the logger a piece at a time, nothing is formatted into a buffer first.
+ * They log nothing unless AF_LOG_LEVEL is AF_LOG_LEVEL_DEBUG or higher.
+ */
 void af_command_dump(af_command_t *af_command);
 
 void af_command_dump_bytes(af_command_t *af_command);
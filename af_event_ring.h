@@ -0,0 +1,156 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Single-producer/single-consumer ring of one byte events.
+ *
+ * The producer (an ISR, or a logger call) only ever writes head and dropped, the consumer (af_lib_loop) only ever
+ * writes tail, so neither side has to disable interrupts. Indexes run freely and wrap at 256, which is why the size
+ * has to be a power of two no larger than 128.
+ *
+ * C11 and C++11 atomics are used where the toolchain has them. Otherwise the indexes are single bytes, which every
+ * supported MCU loads and stores atomically, and a compiler barrier keeps the event write ahead of the head update.
+ */
+#ifndef AF_EVENT_RING_H
+#define AF_EVENT_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__cplusplus)
+#if __cplusplus >= 201103L && defined(__has_include)
+#if __has_include(<atomic>)
+#define AF_EVENT_RING_CXX11_ATOMICS
+#endif
+#endif
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#define AF_EVENT_RING_C11_ATOMICS
+#endif
+
+#if defined(AF_EVENT_RING_CXX11_ATOMICS)
+#include <atomic>
+typedef std::atomic<uint8_t> af_event_ring_index_t;
+#define AF_EVENT_RING_LOAD(p, order)        (p)->load(std::memory_order_ ## order)
+#define AF_EVENT_RING_STORE(p, v, order)    (p)->store((v), std::memory_order_ ## order)
+#elif defined(AF_EVENT_RING_C11_ATOMICS)
+#include <stdatomic.h>
+typedef _Atomic uint8_t af_event_ring_index_t;
+#define AF_EVENT_RING_LOAD(p, order)        atomic_load_explicit((p), memory_order_ ## order)
+#define AF_EVENT_RING_STORE(p, v, order)    atomic_store_explicit((p), (v), memory_order_ ## order)
+#else
+typedef volatile uint8_t af_event_ring_index_t;
+#if defined(__GNUC__)
+#define AF_EVENT_RING_BARRIER()             __sync_synchronize()
+#else
+#define AF_EVENT_RING_BARRIER()
+#endif
+#define AF_EVENT_RING_LOAD(p, order)        af_event_ring_load(p)
+#define AF_EVENT_RING_STORE(p, v, order)    af_event_ring_store((p), (v))
+
+static inline uint8_t af_event_ring_load(af_event_ring_index_t *p) {
+    uint8_t v = *p;
+    AF_EVENT_RING_BARRIER();
+    return v;
+}
+
+static inline void af_event_ring_store(af_event_ring_index_t *p, uint8_t v) {
+    AF_EVENT_RING_BARRIER();
+    *p = v;
+}
+#endif
+
+#define AF_EVENT_RING_DECLARE(name, size)                                       \
+    typedef struct {                                                            \
+        af_event_ring_index_t head;     /* written by the producer only */      \
+        af_event_ring_index_t tail;     /* written by the consumer only */      \
+        af_event_ring_index_t dropped;  /* producer count of events that didn't fit */ \
+        uint8_t events[size];                                                   \
+    } name
+
+#if (defined(AF_EVENT_RING_CXX11_ATOMICS) || defined(AF_EVENT_RING_C11_ATOMICS))
+#define AF_EVENT_RING_INIT(r)                                                   \
+    do {                                                                        \
+        AF_EVENT_RING_STORE(&(r)->head, 0, relaxed);                            \
+        AF_EVENT_RING_STORE(&(r)->tail, 0, relaxed);                            \
+        AF_EVENT_RING_STORE(&(r)->dropped, 0, relaxed);                         \
+    } while (0)
+#else
+#define AF_EVENT_RING_INIT(r)                                                   \
+    do { (r)->head = 0; (r)->tail = 0; (r)->dropped = 0; } while (0)
+#endif
+
+/**
+ * AF_EVENT_RING_PUT
+ *
+ * Producer side. Evaluates to true if the event was queued, false if the ring was full and the event was counted in
+ * dropped instead.
+ */
+#define AF_EVENT_RING_PUT(r, event)                                             \
+    af_event_ring_put(&(r)->head, &(r)->tail, &(r)->dropped, (r)->events, sizeof((r)->events), (event))
+
+/**
+ * AF_EVENT_RING_GET
+ *
+ * Consumer side. Evaluates to true and fills in *event if there was one waiting.
+ */
+#define AF_EVENT_RING_GET(r, event)                                             \
+    af_event_ring_get(&(r)->head, &(r)->tail, (r)->events, sizeof((r)->events), (event))
+
+/**
+ * AF_EVENT_RING_SPACE
+ *
+ * Producer side. How many more events fit, for a producer that puts several that only make sense together.
+ */
+#define AF_EVENT_RING_SPACE(r)                                                  \
+    af_event_ring_space(&(r)->head, &(r)->tail, sizeof((r)->events))
+
+/**
+ * AF_EVENT_RING_DROPPED
+ *
+ * Consumer side. Running count of events the producer had no room for, wraps at 256.
+ */
+#define AF_EVENT_RING_DROPPED(r)        AF_EVENT_RING_LOAD(&(r)->dropped, acquire)
+
+static inline bool af_event_ring_put(af_event_ring_index_t *head, af_event_ring_index_t *tail, af_event_ring_index_t *dropped, uint8_t *events, uint8_t size, uint8_t event) {
+    uint8_t h = AF_EVENT_RING_LOAD(head, relaxed);
+
+    if ((uint8_t)(h - AF_EVENT_RING_LOAD(tail, acquire)) >= size) {
+        AF_EVENT_RING_STORE(dropped, (uint8_t)(AF_EVENT_RING_LOAD(dropped, relaxed) + 1), release);
+        return false;
+    }
+
+    events[h & (size - 1)] = event;
+    AF_EVENT_RING_STORE(head, (uint8_t)(h + 1), release);
+    return true;
+}
+
+static inline uint8_t af_event_ring_space(af_event_ring_index_t *head, af_event_ring_index_t *tail, uint8_t size) {
+    return size - (uint8_t)(AF_EVENT_RING_LOAD(head, relaxed) - AF_EVENT_RING_LOAD(tail, acquire));
+}
+
+static inline bool af_event_ring_get(af_event_ring_index_t *head, af_event_ring_index_t *tail, uint8_t *events, uint8_t size, uint8_t *event) {
+    uint8_t t = AF_EVENT_RING_LOAD(tail, relaxed);
+
+    if (t == AF_EVENT_RING_LOAD(head, acquire)) {
+        return false;
+    }
+
+    *event = events[t & (size - 1)];
+    AF_EVENT_RING_STORE(tail, (uint8_t)(t + 1), release);
+    return true;
+}
+
+#endif /* AF_EVENT_RING_H */
@@ -21,13 +21,15 @@
 #include "af_utils.h"
 #include "af_command.h"
 #include "af_module_states.h"
+#include "af_event_ring.h"
+#include "af_allocator.h"
+#include "af_trace.h"
 
 /**
- * Define this to debug your selected transport (ie SPI or UART).
- * This will cause a println each time an interrupt or ready byte is received from the ASR.
+ * Build with AF_LOG_LEVEL set to AF_LOG_LEVEL_TRACE (or DEBUG_TRANSPORT defined) to debug your selected transport
+ * (ie SPI or UART). This will cause a println each time an interrupt or ready byte is received from the ASR.
  * You will also get states printed whenever a SYNC transaction is performed by the afLib.
  */
-//#define DEBUG_TRANSPORT     1
 
 /**
  * These are required to be able to recognize the MCU trying to reboot the ASR by setting the command
@@ -37,6 +39,21 @@
 #define AFLIB_SYSTEM_COMMAND_ATTR_ID    (65012)
 #define AFLIB_SYSTEM_COMMAND_REBOOT     (1)
 
+/**
+ * The MCU UART Config attribute holds the ASR's UART settings as four bytes: the index of the baud rate in
+ * s_uart_baud_rates, then the data width, parity and stop bits. afLib only ever changes the baud rate.
+ */
+#define AFLIB_MCU_UART_CONFIG_ATTR_ID   (65000)
+#define AFLIB_MCU_UART_CONFIG_LEN       (4)
+
+/**
+ * The MCU SPI Config attribute holds the fastest SPI clock in Hz (4 bytes) and the longest frame (2 bytes) the ASR can
+ * take, followed by 4 reserved bytes. afLib writes back the clock and frame length it wants to use. This layout is
+ * unconfirmed, which is why AF_LIB_SPI_MAX_CLOCK_RATE defaults to 0.
+ */
+#define AFLIB_MCU_SPI_CONFIG_ATTR_ID    (65069)
+#define AFLIB_MCU_SPI_CONFIG_LEN        (10)
+
 /**
  * Some afLib features are only supported on newer firmware and newer ASR devices, so check
  * for older firmware so afLib can cope with different features
@@ -52,7 +69,10 @@
  */
 #define MIN_TIME_BETWEEN_UPDATES_MILLIS (0)
 
+// How long a get or set waits for its response before it stops holding up the in flight window, tests shorten it
+#ifndef MAX_COMMAND_RESULT_TIME_MILLIS
 #define MAX_COMMAND_RESULT_TIME_MILLIS          10000
+#endif
 
 #define ATTRIBUTE_ID_MCU_START                  0x0001   // 1
 #define ATTRIBUTE_ID_MCU_END                    0x03ff   // 1023
@@ -86,6 +106,12 @@
 
 #define AFLIB_MCU_PROCOCOL_VERSION          2
 
+// afLib's own capabilities, sent to the ASR in ATTRIBUTE_ID_DEVICE_MCU_AFLIB_CAPABILITIES with the same bit order as the ASR's
+#define AFLIB_CAPABILITY_BATCHED_FRAMES     0x80    // Can send several commands in one transfer, provisional like AF_ASR_CAPABILITY_BATCHED_FRAMES
+
+// Number of AF_ATTRIBUTE_ID_ASR_CAPABILITIES bytes we keep, capabilities beyond these are reported as not supported
+#define ASR_CAPABILITY_MAX_LENGTH           4
+
 #define MAX_SYNC_RETRIES    10
 static long last_sync = 0;
 static int sync_retries = 0;
@@ -93,25 +119,100 @@ static long last_complete = 0;
 static uint64_t s_asr_version = 0;
 static uint8_t s_asr_states = 0;
 
+// Room in front of every queued value for the frame length and the command header so the frame can be built in place
+#define AF_LIB_FRAME_HEADROOM               (2 + AF_COMMAND_MAX_HEADER_LEN)
+
+#if (AF_LIB_ISR_EVENT_RING_SIZE & (AF_LIB_ISR_EVENT_RING_SIZE - 1)) != 0 || AF_LIB_ISR_EVENT_RING_SIZE > 128
+#error "AF_LIB_ISR_EVENT_RING_SIZE must be a power of two no larger than 128"
+#endif
+
+#if AF_LIB_IN_FLIGHT_WINDOW < 1 || AF_LIB_IN_FLIGHT_WINDOW > 255
+#error "AF_LIB_IN_FLIGHT_WINDOW must be between 1 and 255"
+#endif
+
+#if AF_LIB_BATCH_BUFFER_SIZE > 0 && AF_LIB_MAX_BATCH < 2
+#error "AF_LIB_MAX_BATCH must be at least 2, set AF_LIB_BATCH_BUFFER_SIZE to 0 to turn batching off"
+#endif
+
+#if AF_LIB_CONTROL_QUEUE_SIZE < 1 || AF_LIB_SET_RESPONSE_QUEUE_SIZE < 1 || AF_LIB_INTERACTIVE_QUEUE_SIZE < 1
+#error "Every request lane needs at least one slot of its own"
+#endif
+
+// What's left of AF_LIB_REQUEST_QUEUE_SIZE once the lanes have their own slots, shared by all of them
+#define AF_LIB_SHARED_QUEUE_SIZE            (AF_LIB_REQUEST_QUEUE_SIZE - AF_LIB_CONTROL_QUEUE_SIZE - AF_LIB_SET_RESPONSE_QUEUE_SIZE - AF_LIB_INTERACTIVE_QUEUE_SIZE)
+
+#if AF_LIB_SHARED_QUEUE_SIZE < 1
+#error "AF_LIB_REQUEST_QUEUE_SIZE must be larger than the lanes' reserved slots added together"
+#endif
+
+#if (AF_LIB_TRACE_SIZE & (AF_LIB_TRACE_SIZE - 1)) != 0 || AF_LIB_TRACE_SIZE > 32768
+#error "AF_LIB_TRACE_SIZE must be a power of two no larger than 32768"
+#endif
+
+AF_EVENT_RING_DECLARE(isr_event_ring_t, AF_LIB_ISR_EVENT_RING_SIZE);
+
+static const uint32_t s_uart_baud_rates[] = { 4800, 9600, 38400, 115200 };
+#define UART_BAUD_RATE_COUNT                (sizeof(s_uart_baud_rates) / sizeof(s_uart_baud_rates[0]))
+
+typedef enum {
+    LINK_NEGOTIATION_NONE,      // Not negotiating
+    LINK_NEGOTIATION_GETTING,   // Waiting on the ASR's MCU UART or SPI Config
+    LINK_NEGOTIATION_SETTING    // Waiting on the ASR to accept new settings
+} link_negotiation_t;
+
+// In priority order, af_lib_loop always sends from the first lane that has something queued
+typedef enum {
+    REQUEST_LANE_CONTROL,       // afLib's own capability, protocol version and system command traffic
+    REQUEST_LANE_SET_RESPONSE,  // Replies to sets from the server
+    REQUEST_LANE_INTERACTIVE,   // Gets and non-MCU sets the application is waiting on
+    REQUEST_LANE_BULK,          // MCU attribute updates, its slots are shared with the other lanes
+    REQUEST_LANE_COUNT
+} request_lane_t;
+
 typedef struct {
     uint8_t     message_type;
     uint16_t    attr_id;
     uint8_t     request_id;
     uint16_t    value_len;
-    uint8_t     *value;
+    uint8_t     *value;     // Points into storage or overflow, always preceded by AF_LIB_FRAME_HEADROOM bytes
+    uint8_t     *overflow;  // Pool or heap buffer for values larger than AF_LIB_REQUEST_INLINE_VALUE_SIZE, NULL otherwise
     uint8_t     status;
     uint8_t     reason;
+    uint8_t     pool;       // The request_lane_t whose slots this request came from
+#if AF_LIB_STATS
+    uint32_t    queued_at;  // af_utils_micros() when it was queued
+#endif
+    uint8_t     storage[AF_LIB_FRAME_HEADROOM + AF_LIB_REQUEST_INLINE_VALUE_SIZE];
 } request_t;
 
+typedef struct {
+    uint16_t attr_id;   // 0 while the counter is unused
+    uint16_t count;
+} coalesce_counter_t;
+
+// A get or set that's been sent and is waiting for the ASR to respond
+typedef struct {
+    uint16_t attr_id;   // 0 while the slot is free
+    uint8_t request_id;
+    long send_time;
+#if AF_LIB_STATS
+    uint32_t send_micros;
+#endif
+} in_flight_t;
+
 struct af_lib_t {
     af_transport_t *the_transport;
+    af_lib_allocator_t allocator;   // Everything this instance allocates, itself included, comes from here
 
-    volatile int interrupts_pending;
+    isr_event_ring_t isr_events;    // Filled by af_lib_post_isr_event in interrupt context, drained by the loop
+    uint8_t isr_events_dropped;     // The ring's dropped count as of the last drain
+    int interrupts_pending;         // Only touched by the loop, ISRs go through isr_events
     int state;
     uint16_t bytes_to_send;
     uint16_t bytes_to_recv;
     uint8_t request_id;
-    uint16_t outstanding_set_get_attr_id;
+    in_flight_t in_flight[AF_LIB_IN_FLIGHT_WINDOW];
+    uint8_t in_flight_count;
 
     // Application Callbacks.
     attr_set_handler_t attr_set_handler;
@@ -119,13 +220,14 @@ struct af_lib_t {
 
     af_lib_event_callback_t event_handler;
 
-    af_command_t *write_cmd;
-    uint16_t write_buffer_len;
+    af_command_t *write_cmd;    // Points at write_command while a command is being sent, NULL otherwise
+    af_command_t write_command;
     uint8_t *write_buffer;
 
-    af_command_t *read_cmd;
+    af_command_t *read_cmd;     // Points at read_command while a received command is being handled, NULL otherwise
+    af_command_t read_command;
     uint16_t read_buffer_len;
-    uint8_t *read_buffer;
+    uint8_t *read_buffer;       // Frame that read_cmd is a view into, either rx_buffer or an allocated buffer for oversized frames
 
     uint16_t write_cmd_offset;
     uint16_t read_cmd_offset;
@@ -133,25 +235,192 @@ struct af_lib_t {
     af_status_command_t tx_status;
     af_status_command_t rx_status;
 
-    request_t request;
+    request_t *write_request;   // The dequeued request that write_cmd refers to, released when the command completes
+
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+    request_t *batch_requests[AF_LIB_MAX_BATCH - 1];    // Updates sent in the same transfer as write_request
+    uint8_t batch_count;
+    uint16_t batch_len;                                 // Bytes of batch_buffer to send, 0 when write_cmd goes out on its own
+    uint8_t batch_buffer[AF_LIB_BATCH_BUFFER_SIZE];
+#endif
 
-    uint8_t *asr_capability;
+    uint8_t *asr_capability;    // Points at asr_capability_buffer once the ASR has told us its capabilities, NULL until then
     uint8_t asr_capability_length;
+    uint8_t asr_capability_buffer[ASR_CAPABILITY_MAX_LENGTH];
 
     bool asr_rebooting;
     long attr_set_request_time;
 
-    long last_command_send_time;
 
     uint16_t asr_protocol_version;
+
+    bool coalesce;
+    coalesce_counter_t coalesced[AF_LIB_COALESCE_COUNTERS];
+
+    uint8_t link_negotiation;   // link_negotiation_t
+    uint8_t uart_config[AFLIB_MCU_UART_CONFIG_LEN];     // The ASR's MCU UART Config as last reported
+    uint8_t uart_rate;          // Index of the baud rate the transport is running at
+    uint8_t uart_base_rate;     // Index of the baud rate the transport was created with
+    uint8_t uart_rate_limit;    // Highest baud rate index we'll ask for, lowered when a rate turns out to be unreliable
+    uint32_t spi_clock_rate;    // SPI settings the transport is running with
+    uint16_t spi_frame_length;
+    uint32_t spi_base_clock_rate;   // SPI settings the transport was created with
+    uint16_t spi_base_frame_length;
+    uint32_t spi_clock_rate_limit;  // Fastest clock we'll use, lowered when a clock turns out to be unreliable
+
+#if AF_LIB_STATS
+    af_lib_stats_t stats;
+    uint32_t transfer_start;    // af_utils_micros() when the state machine last left idle
+#endif
+
+#if AF_LIB_TRACE_SIZE > 0
+    af_trace_record_t trace[AF_LIB_TRACE_SIZE];
+    uint32_t trace_count;       // Records ever written, the next one goes in trace[trace_count % AF_LIB_TRACE_SIZE]
+#endif
+
+#if AF_LIB_RECEIVE_BUFFER_SIZE > 0
+    uint8_t rx_buffer[AF_LIB_RECEIVE_BUFFER_SIZE];
+#endif
 };
 
-AF_QUEUE_DECLARE(s_request_queue, sizeof(request_t), AF_LIB_REQUEST_QUEUE_SIZE);
+// Each lane is a queue with its own slots, which together with the shared ones add up to AF_LIB_REQUEST_QUEUE_SIZE.
+// One extra shared slot holds the request that is currently being sent.
+AF_QUEUE_DECLARE(s_control_queue, sizeof(request_t), AF_LIB_CONTROL_QUEUE_SIZE);
+AF_QUEUE_DECLARE(s_set_response_queue, sizeof(request_t), AF_LIB_SET_RESPONSE_QUEUE_SIZE);
+AF_QUEUE_DECLARE(s_interactive_queue, sizeof(request_t), AF_LIB_INTERACTIVE_QUEUE_SIZE);
+AF_QUEUE_DECLARE(s_request_queue, sizeof(request_t), AF_LIB_SHARED_QUEUE_SIZE + 1);
+
+static queue_t volatile * const s_lanes[REQUEST_LANE_COUNT] = {
+    &s_control_queue,
+    &s_set_response_queue,
+    &s_interactive_queue,
+    &s_request_queue,
+};
+AF_QUEUE_DECLARE(s_value_pool, AF_LIB_FRAME_HEADROOM + AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE, AF_LIB_REQUEST_OVERFLOW_POOL_SIZE);
+
+// There's one afLib instance at a time as it shares the lanes, the value pool and the sync state above
+static af_lib_t *s_instance = NULL;
+
+#ifdef AF_LIB_NO_HEAP
+// Without a heap the instance itself is static
+static af_lib_t s_instance_storage;
+#endif
+
+/****************************************************************************
+ *                                Statistics                                *
+ ****************************************************************************/
+
+#if AF_LIB_STATS
+#define STATS_ADD(af_lib, counter, amount)  ((af_lib)->stats.counter += (amount))
+
+/**
+ * stats_msg_index
+ *
+ * Where a message type is counted in messages_tx and messages_rx.
+ */
+static uint8_t stats_msg_index(uint8_t message_type) {
+    switch (message_type) {
+        case MSG_TYPE_SET:
+            return AF_LIB_STATS_MSG_SET;
+        case MSG_TYPE_GET:
+            return AF_LIB_STATS_MSG_GET;
+        case MSG_TYPE_UPDATE:
+            return AF_LIB_STATS_MSG_UPDATE;
+        case MSG_TYPE_UPDATE_REJECTED:
+            return AF_LIB_STATS_MSG_UPDATE_REJECTED;
+        case MSG_TYPE_SET_DEFAULT:
+            return AF_LIB_STATS_MSG_SET_DEFAULT;
+        default:
+            return AF_LIB_STATS_MSG_OTHER;
+    }
+}
+
+/**
+ * stats_record_latency
+ *
+ * Count the time since start, in microseconds, in its histogram bucket.
+ */
+static void stats_record_latency(af_lib_histogram_t *histogram, uint32_t start) {
+    uint32_t elapsed = (af_utils_micros() - start) >> 7;
+    uint8_t bucket = 0;
+
+    while (elapsed > 0 && bucket < AF_LIB_STATS_BUCKETS - 1) {
+        elapsed >>= 1;
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+}
+
+/**
+ * stats_request_sent
+ *
+ * A queued request has gone out to the ASR.
+ */
+static void stats_request_sent(af_lib_t *af_lib, request_t *request) {
+    af_lib->stats.messages_tx[stats_msg_index(request->message_type)]++;
+    stats_record_latency(&af_lib->stats.queue_latency, request->queued_at);
+}
+#else
+#define STATS_ADD(af_lib, counter, amount)
+#endif
+
+/****************************************************************************
+ *                                 Tracing                                  *
+ ****************************************************************************/
+
+#if AF_LIB_TRACE_SIZE > 0
+/**
+ * trace_record
+ *
+ * Note an af_trace_event_t in the trace ring, overwriting the oldest record once it's full. Kept to a few stores so
+ * it can stay in while timing is being looked at.
+ */
+static void trace_record(af_lib_t *af_lib, uint8_t event, uint16_t attr_id, uint16_t len) {
+    af_trace_record_t *record = &af_lib->trace[af_lib->trace_count++ & (AF_LIB_TRACE_SIZE - 1)];
+
+    record->time = af_utils_micros();
+    record->attr_id = attr_id;
+    record->len = len;
+    record->state = af_lib->state;
+    record->event = event;
+}
+
+/**
+ * trace_state_change
+ *
+ * Note the state machine's state if it isn't the one it was in before.
+ */
+static void trace_state_change(af_lib_t *af_lib, int from) {
+    if (af_lib->state != from) {
+        trace_record(af_lib, AF_TRACE_EVENT_STATE, af_lib->write_cmd != NULL ? af_command_get_attr_id(af_lib->write_cmd) : 0,
+                     af_lib->bytes_to_send + af_lib->bytes_to_recv);
+    }
+}
+
+/**
+ * trace_serialize
+ *
+ * Lay a record out the way af_trace.h describes.
+ */
+static void trace_serialize(const af_trace_record_t *record, uint8_t *bytes) {
+    af_utils_write_little_endian_32(record->time, bytes);
+    af_utils_write_little_endian_16(record->attr_id, &bytes[4]);
+    af_utils_write_little_endian_16(record->len, &bytes[6]);
+    bytes[8] = record->state;
+    bytes[9] = record->event;
+}
+#define TRACE(af_lib, event, attr_id, len)  trace_record((af_lib), (event), (attr_id), (len))
+#define TRACE_STATE_CHANGE(af_lib, from)    trace_state_change((af_lib), (from))
+#else
+#define TRACE(af_lib, event, attr_id, len)
+#define TRACE_STATE_CHANGE(af_lib, from)    ((void)(from))
+#endif
 
 /****************************************************************************
  *                              Queue Methods                               *
  ****************************************************************************/
 
+// The queues are only ever used from the loop, interrupt handlers post to the ISR event ring, so there's nothing to lock out
 static uint8_t af_queue_preemption_disable(void) {
     return 0;
 }
@@ -168,41 +437,203 @@ static void af_queue_preemption_enable(uint8_t is_nested) {
  */
 static void queue_init(af_lib_t *af_lib) {
     af_queue_init_system(af_queue_preemption_disable, af_queue_preemption_enable);
-    AF_QUEUE_INIT(s_request_queue, sizeof(request_t), AF_LIB_REQUEST_QUEUE_SIZE);
+    AF_QUEUE_INIT(s_control_queue, sizeof(request_t), AF_LIB_CONTROL_QUEUE_SIZE);
+    AF_QUEUE_INIT(s_set_response_queue, sizeof(request_t), AF_LIB_SET_RESPONSE_QUEUE_SIZE);
+    AF_QUEUE_INIT(s_interactive_queue, sizeof(request_t), AF_LIB_INTERACTIVE_QUEUE_SIZE);
+    AF_QUEUE_INIT(s_request_queue, sizeof(request_t), AF_LIB_SHARED_QUEUE_SIZE + 1);
+    AF_QUEUE_INIT(s_value_pool, AF_LIB_FRAME_HEADROOM + AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE, AF_LIB_REQUEST_OVERFLOW_POOL_SIZE);
 }
 
 /**
- * queue_put
+ * request_value_alloc
  *
- * Add an item to the end of the queue. Return an error if we're out of space in the queue.
+ * Pick the storage for a request value: inline in the queue slot if it fits, otherwise a pool buffer, otherwise the heap.
+ * Returns a pointer to where the value goes, which always has AF_LIB_FRAME_HEADROOM bytes in front of it.
  */
-static af_lib_error_t queue_put(af_lib_t *af_lib, uint8_t message_type, uint8_t request_id, uint16_t attribute_id, uint16_t value_len, const uint8_t *value, const uint8_t status, const uint8_t reason) {
-    queue_t volatile *p_q = &s_request_queue;
+static uint8_t *request_value_alloc(af_lib_t *af_lib, request_t *p_event, uint16_t value_len) {
+    p_event->overflow = NULL;
+
+    if (value_len <= AF_LIB_REQUEST_INLINE_VALUE_SIZE) {
+        return p_event->storage + AF_LIB_FRAME_HEADROOM;
+    }
+
+    if (value_len <= AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE) {
+        p_event->overflow = (uint8_t *)AF_QUEUE_ELEM_ALLOC_FROM_INTERRUPT(&s_value_pool);
+    }
+
+    if (p_event->overflow == NULL) {
+        p_event->overflow = (uint8_t *)af_allocator_alloc_with(&af_lib->allocator, AF_LIB_FRAME_HEADROOM + value_len);
+        if (p_event->overflow == NULL) {
+            return NULL;
+        }
+    }
 
-    // We need to make sure we leave at least one spot in our queue to handle the response from a server set
-    if (af_lib->state != STATE_WAITING_FOR_SET_RESPONSE && AF_QUEUE_GET_NUM_AVAILABLE(p_q) <= 1) {
-        return AF_ERROR_QUEUE_OVERFLOW; // We're basically "full" now
+    return p_event->overflow + AF_LIB_FRAME_HEADROOM;
+}
+
+static bool request_value_is_pooled(request_t *p_event) {
+    return p_event->overflow >= (uint8_t *)s_value_pool_mem && p_event->overflow < (uint8_t *)s_value_pool_mem + sizeof(s_value_pool_mem);
+}
+
+/**
+ * request_value_capacity
+ *
+ * The largest value that fits in the storage a request already has.
+ */
+static uint16_t request_value_capacity(request_t *p_event) {
+    if (NULL == p_event->overflow) {
+        return AF_LIB_REQUEST_INLINE_VALUE_SIZE;
+    }
+    if (request_value_is_pooled(p_event)) {
+        return AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE;
+    }
+    // Heap buffers aren't any bigger than the value they were allocated for
+    return p_event->value_len;
+}
+
+/**
+ * queue_release
+ *
+ * Return a request obtained from queue_get, along with any overflow storage for its value, to the free list.
+ */
+static void queue_release(af_lib_t *af_lib, request_t *p_event) {
+    if (p_event->overflow != NULL) {
+        if (request_value_is_pooled(p_event)) {
+            AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(&s_value_pool, p_event->overflow);
+        } else {
+            af_allocator_free_with(&af_lib->allocator, p_event->overflow);
+        }
+        p_event->overflow = NULL;
     }
+    p_event->value = NULL;
 
-    request_t *p_event = (request_t *)AF_QUEUE_ELEM_ALLOC_FROM_INTERRUPT(p_q);
+    AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(s_lanes[p_event->pool], p_event);
+}
+
+/**
+ * request_alloc
+ *
+ * Take a slot for a request in the given lane, falling back on the shared slots once the lane's own are used up.
+ */
+static request_t *request_alloc(request_lane_t lane) {
+    request_t *p_event = (request_t *)AF_QUEUE_ELEM_ALLOC_FROM_INTERRUPT(s_lanes[lane]);
+
+    if (NULL == p_event && lane != REQUEST_LANE_BULK) {
+        lane = REQUEST_LANE_BULK;
+        p_event = (request_t *)AF_QUEUE_ELEM_ALLOC_FROM_INTERRUPT(s_lanes[lane]);
+    }
+    if (p_event != NULL) {
+        p_event->pool = lane;
+    }
+
+    return p_event;
+}
+
+/**
+ * request_lane_for
+ *
+ * Pick the lane for a request made through the public get/set calls.
+ */
+static request_lane_t request_lane_for(uint8_t message_type, uint16_t attribute_id) {
+    if (AFLIB_SYSTEM_COMMAND_ATTR_ID == attribute_id || AFLIB_MCU_UART_CONFIG_ATTR_ID == attribute_id || AFLIB_MCU_SPI_CONFIG_ATTR_ID == attribute_id ||
+        (attribute_id >= ATTRIBUTE_ID_DEVICE_MCU_START && attribute_id <= ATTRIBUTE_ID_DEVICE_MCU_END)) {
+        return REQUEST_LANE_CONTROL;
+    }
+    if (MSG_TYPE_UPDATE == message_type) {
+        return REQUEST_LANE_BULK;
+    }
+    return REQUEST_LANE_INTERACTIVE;
+}
+
+typedef struct {
+    uint8_t message_type;
+    uint16_t attr_id;
+} request_match_t;
+
+static bool request_matches(void *p_data, void *p_context) {
+    request_t *p_event = (request_t *)p_data;
+    request_match_t *match = (request_match_t *)p_context;
+
+    return p_event->message_type == match->message_type && p_event->attr_id == match->attr_id;
+}
+
+static void count_coalesced(af_lib_t *af_lib, uint16_t attribute_id) {
+    int i;
+
+    for (i = 0; i < AF_LIB_COALESCE_COUNTERS; i++) {
+        if (0 == af_lib->coalesced[i].attr_id) {
+            af_lib->coalesced[i].attr_id = attribute_id;
+        }
+        if (af_lib->coalesced[i].attr_id == attribute_id) {
+            if (af_lib->coalesced[i].count < UINT16_MAX) {
+                af_lib->coalesced[i].count++;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * queue_coalesce
+ *
+ * Replace the value of a request for the same attribute that's still waiting in the lane, keeping its place in line.
+ * Returns false if there's no such request or the new value doesn't fit in its storage, in which case the caller
+ * queues a new request as usual.
+ */
+static bool queue_coalesce(af_lib_t *af_lib, request_lane_t lane, uint8_t message_type, uint8_t request_id, uint16_t attribute_id, uint16_t value_len, const uint8_t *value, const uint8_t status, const uint8_t reason) {
+    request_match_t match = { message_type, attribute_id };
+    request_t *p_event = (request_t *)AF_QUEUE_FIND_FROM_INTERRUPT(s_lanes[lane], request_matches, &match);
+
+    if (NULL == p_event || value_len > request_value_capacity(p_event)) {
+        return false;
+    }
+
+    memcpy(p_event->value, value, value_len);
+    p_event->value_len = value_len;
+    p_event->request_id = request_id;
+    p_event->status = status;
+    p_event->reason = reason;
+    count_coalesced(af_lib, attribute_id);
+
+    return true;
+}
+
+/**
+ * queue_put_in_lane
+ *
+ * Add an item to the end of the given lane. Return an error if we're out of space for it.
+ */
+static af_lib_error_t queue_put_in_lane(af_lib_t *af_lib, request_lane_t lane, uint8_t message_type, uint8_t request_id, uint16_t attribute_id, uint16_t value_len, const uint8_t *value, const uint8_t status, const uint8_t reason) {
+    if (af_lib->coalesce && (REQUEST_LANE_INTERACTIVE == lane || REQUEST_LANE_BULK == lane) &&
+        (MSG_TYPE_UPDATE == message_type || MSG_TYPE_SET == message_type) && !IS_ATTRIBUTE_TUNNELED_DEVICE_MCU(attribute_id) &&
+        queue_coalesce(af_lib, lane, message_type, request_id, attribute_id, value_len, value, status, reason)) {
+        return AF_SUCCESS;
+    }
+
+    request_t *p_event = request_alloc(lane);
 
     if (p_event != NULL) {
         uint16_t orig_attribute_id = attribute_id;
         if (IS_ATTRIBUTE_TUNNELED_DEVICE_MCU(orig_attribute_id)) {
             // For tunneled attributes we only support UPDATE messages so if the message type was a get we have to return an error since that's not allowed
             if (MSG_TYPE_GET == message_type) {
-                AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(&s_request_queue, p_event);
+                AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(s_lanes[p_event->pool], p_event);
                 return AF_ERROR_INVALID_PARAM;
             }
             message_type = MSG_TYPE_UPDATE;
             attribute_id = ATTRIBUTE_ID_MCU_TO_DEVICE_CHANNEL;
             value_len += sizeof(attribute_id);
         }
+        p_event->value = request_value_alloc(af_lib, p_event, value_len);
+        if (p_event->value == NULL) {
+            AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(s_lanes[p_event->pool], p_event);
+            STATS_ADD(af_lib, queue_overflows, 1);
+            return AF_ERROR_QUEUE_OVERFLOW;
+        }
         p_event->message_type = message_type;
         p_event->attr_id = attribute_id;
         p_event->request_id = request_id;
         p_event->value_len = value_len;
-        p_event->value = (uint8_t*)malloc(value_len);
         if (IS_ATTRIBUTE_TUNNELED_DEVICE_MCU(orig_attribute_id)) {
             af_utils_write_little_endian_16(orig_attribute_id, p_event->value);
             memcpy(p_event->value + sizeof(attribute_id), value, value_len - sizeof(attribute_id));
@@ -211,85 +642,458 @@ static af_lib_error_t queue_put(af_lib_t *af_lib, uint8_t message_type, uint8_t
         }
         p_event->status = status;
         p_event->reason = reason;
+#if AF_LIB_STATS
+        p_event->queued_at = af_utils_micros();
+#endif
 
-        AF_QUEUE_PUT_FROM_INTERRUPT(p_q, p_event);
+        AF_QUEUE_PUT_FROM_INTERRUPT(s_lanes[lane], p_event);
+        TRACE(af_lib, AF_TRACE_EVENT_QUEUED, attribute_id, value_len);
         return AF_SUCCESS;
     }
 
+    STATS_ADD(af_lib, queue_overflows, 1);
     return AF_ERROR_QUEUE_OVERFLOW;
 }
 
+/**
+ * queue_put
+ *
+ * Add an item to the end of the lane that suits it. Return an error if we're out of space in the queue.
+ */
+static af_lib_error_t queue_put(af_lib_t *af_lib, uint8_t message_type, uint8_t request_id, uint16_t attribute_id, uint16_t value_len, const uint8_t *value, const uint8_t status, const uint8_t reason) {
+    return queue_put_in_lane(af_lib, request_lane_for(message_type, attribute_id), message_type, request_id, attribute_id, value_len, value, status, reason);
+}
+
 /**
  * queue_get
  *
- * Pull and return the oldest item from the queue. Return an error if the queue is empty.
+ * Pull the oldest item from the highest priority lane that has one. Return an error if every lane is empty.
+ * The request stays allocated, with its value in place, until it's handed back with queue_release.
  */
-static int queue_get(af_lib_t *af_lib, uint8_t *message_type, uint8_t *request_id, uint16_t *attribute_id, uint16_t *value_len, uint8_t **value, uint8_t *status, uint8_t *reason) {
+static int queue_get(af_lib_t *af_lib, request_t **request) {
+    int lane;
+
     // If the ASR is rebooting then we can't be picking things off our queue as we have to wait for the ASR to come back
     if (af_lib->asr_rebooting) {
         return AF_ERROR_ASR_REBOOTING;
     }
 
-    if (AF_QUEUE_PEEK_FROM_INTERRUPT(&s_request_queue)) {
-        request_t *p_event = (request_t *)AF_QUEUE_GET_FROM_INTERRUPT(&s_request_queue);
-        *message_type = p_event->message_type;
-        *attribute_id = p_event->attr_id;
-        *request_id = p_event->request_id;
-        *value_len = p_event->value_len;
-        *value = (uint8_t*)malloc(*value_len);
-        memcpy(*value, p_event->value, *value_len);
-        free(p_event->value);
-        p_event->value = NULL;
-        *status = p_event->status;
-        *reason = p_event->reason;
-
-        AF_QUEUE_ELEM_FREE_FROM_INTERRUPT(&s_request_queue, p_event);
-        return AF_SUCCESS;
+    for (lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+        if (AF_QUEUE_PEEK_FROM_INTERRUPT(s_lanes[lane])) {
+            *request = (request_t *)AF_QUEUE_GET_FROM_INTERRUPT(s_lanes[lane]);
+            return AF_SUCCESS;
+        }
+    }
+
+    return AF_ERROR_QUEUE_UNDERFLOW;
+}
+
+/**
+ * queue_peek
+ *
+ * The request queue_get would return next, left in its lane. NULL if every lane is empty.
+ */
+static request_t *queue_peek(af_lib_t *af_lib) {
+    int lane;
+    request_t *request;
+
+    for (lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+        request = (request_t *)AF_QUEUE_PEEK_FROM_INTERRUPT(s_lanes[lane]);
+        if (request != NULL) {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+static void dump_queue_element(void* elem) {
+    uint16_t i = 0;
+    request_t *p_event = (request_t*)elem;
+    af_logger_print_buffer("q_elem: attr id: ");
+    af_logger_print_value(p_event->attr_id);
+    af_logger_print_buffer(" msg type: ");
+    af_logger_print_value(p_event->message_type);
+    af_logger_print_buffer(" value len: ");
+    af_logger_print_value(p_event->value_len);
+    af_logger_print_buffer(" val: ");
+    for (i = 0; i < p_event->value_len; i++) {
+        af_logger_print_formatted_value(p_event->value[i], AF_LOGGER_HEX);
+    }
+    af_logger_println_buffer("");
+}
+#endif
+
+/**
+ * af_lib_update_ints_pending
+ *
+ * Update the interrupt count as interrupts are received and handled. Only called from the loop, interrupt handlers
+ * post to isr_events instead.
+ */
+static void af_lib_update_ints_pending(af_lib_t *af_lib, int amount) {
+    af_lib->interrupts_pending += amount;
+}
+
+/**
+ * af_lib_retry_state
+ *
+ * The transport is still waiting on the ASR. Stay in the current state and have the next pass through the loop run it
+ * again instead of waiting for another interrupt.
+ */
+static void af_lib_retry_state(af_lib_t *af_lib) {
+    af_lib_update_ints_pending(af_lib, 1);
+}
+
+/**
+ * af_lib_drain_isr_events
+ *
+ * Turn everything posted from interrupt context since the last call into work for the state machine.
+ */
+static void af_lib_drain_isr_events(af_lib_t *af_lib) {
+    uint8_t event;
+    uint8_t dropped = AF_EVENT_RING_DROPPED(&af_lib->isr_events);
+    int interrupts = af_lib->interrupts_pending;
+
+    // ASR interrupts are the only events posted, so any that didn't fit in the ring still need handling as one each
+    af_lib_update_ints_pending(af_lib, (uint8_t)(dropped - af_lib->isr_events_dropped));
+    af_lib->isr_events_dropped = dropped;
+
+    while (AF_EVENT_RING_GET(&af_lib->isr_events, &event)) {
+        if (AF_LIB_ISR_EVENT_ASR_INTERRUPT == event) {
+            af_lib_update_ints_pending(af_lib, 1);
+        }
+    }
+    if (af_lib->interrupts_pending != interrupts) {
+        TRACE(af_lib, AF_TRACE_EVENT_INTERRUPT, 0, af_lib->interrupts_pending - interrupts);
+    }
+}
+
+/**
+ * af_lib_send_command
+ *
+ * This increments the interrupt count to kick off the state machine in the next call to loop().
+ */
+static void af_lib_send_command(af_lib_t *af_lib) {
+    if (0 == af_lib->interrupts_pending && STATE_IDLE == af_lib->state) {
+        af_lib_update_ints_pending(af_lib, 1);
+    }
+}
+
+/**
+ * in_flight_add
+ *
+ * Remember a request that expects a response. The caller makes sure there's room in the window.
+ */
+static void in_flight_add(af_lib_t *af_lib, request_t *request) {
+    int i;
+
+    for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW; i++) {
+        if (0 == af_lib->in_flight[i].attr_id) {
+            af_lib->in_flight[i].attr_id = request->attr_id;
+            af_lib->in_flight[i].request_id = request->request_id;
+            af_lib->in_flight[i].send_time = af_utils_millis();
+#if AF_LIB_STATS
+            af_lib->in_flight[i].send_micros = af_utils_micros();
+#endif
+            af_lib->in_flight_count++;
+            return;
+        }
+    }
+}
+
+static void in_flight_remove(af_lib_t *af_lib, int i) {
+    af_lib->in_flight[i].attr_id = 0;
+    af_lib->in_flight_count--;
+}
+
+/**
+ * in_flight_complete
+ *
+ * Match a response from the ASR to the request it answers. ASRs that don't echo the request id still get matched by
+ * attribute, oldest first.
+ */
+static void in_flight_complete(af_lib_t *af_lib, uint8_t request_id, uint16_t attr_id) {
+    int match = -1;
+    int i;
+
+    for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW; i++) {
+        if (attr_id != af_lib->in_flight[i].attr_id) {
+            continue;
+        }
+        if (request_id == af_lib->in_flight[i].request_id) {
+            match = i;
+            break;
+        }
+        if (match < 0 || af_lib->in_flight[i].send_time - af_lib->in_flight[match].send_time < 0) {
+            match = i;
+        }
+    }
+
+    if (match >= 0) {
+        TRACE(af_lib, AF_TRACE_EVENT_RESPONSE, attr_id, af_lib->in_flight[match].request_id);
+#if AF_LIB_STATS
+        stats_record_latency(&af_lib->stats.response_latency, af_lib->in_flight[match].send_micros);
+#endif
+        in_flight_remove(af_lib, match);
+    }
+}
+
+/**
+ * in_flight_expire
+ *
+ * Give up on requests the ASR hasn't responded to in MAX_COMMAND_RESULT_TIME_MILLIS so they don't hold up the window.
+ */
+static void in_flight_expire(af_lib_t *af_lib) {
+    int i;
+
+    for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW; i++) {
+        if (af_lib->in_flight[i].attr_id != 0 && af_utils_millis() - af_lib->in_flight[i].send_time > MAX_COMMAND_RESULT_TIME_MILLIS) {
+            AF_LOG_WARN(af_logger_print_buffer("af_lib(): last attr command ");
+                        af_logger_print_value(af_lib->in_flight[i].attr_id);
+                        af_logger_println_buffer(" took too long to complete, moving on..."));
+            in_flight_remove(af_lib, i);
+        }
+    }
+}
+
+/**
+ * af_lib_is_ready
+ *
+ * True if the state machine is free and fewer than max_in_flight requests are waiting on a response.
+ */
+static bool af_lib_is_ready(af_lib_t *af_lib, uint8_t max_in_flight) {
+    if (last_complete != 0 && (af_utils_millis() - last_complete) < MIN_TIME_BETWEEN_UPDATES_MILLIS) {
+        return false;
+    }
+    // See if we've waited long enough for the commands in flight to complete
+    in_flight_expire(af_lib);
+
+    last_complete = 0;
+    af_lib_drain_isr_events(af_lib);
+    return 0 == af_lib->interrupts_pending && STATE_IDLE == af_lib->state && af_lib->in_flight_count < max_in_flight;
+}
+
+static int af_lib_set_attribute_complete(af_lib_t *af_lib, uint8_t request_id, const uint16_t attr_id, const uint16_t value_len, const uint8_t *value, uint8_t status, uint8_t reason) {
+    return queue_put_in_lane(af_lib, REQUEST_LANE_SET_RESPONSE, MSG_TYPE_UPDATE, request_id, attr_id, value_len, value, status, reason);
+}
+
+/****************************************************************************
+ *                            Link Negotiation                              *
+ ****************************************************************************/
+
+/**
+ * af_lib_start_link_negotiation
+ *
+ * The ASR has just booted and its end of the link is back at the profile's settings, same as our transport. Ask it
+ * for the config of whichever link we're on so we can pick something faster.
+ */
+static void af_lib_start_link_negotiation(af_lib_t *af_lib) {
+    uint32_t baud_rate;
+    uint32_t max_baud_rate;
+    uint32_t max_clock_rate;
+    uint16_t max_frame_length;
+    uint16_t attr_id = 0;
+    uint8_t i;
+
+    af_lib->link_negotiation = LINK_NEGOTIATION_NONE;
+
+    if (AF_LIB_UART_MAX_BAUD_RATE > 0 && af_transport_get_baud_rate(af_lib->the_transport, &baud_rate, &max_baud_rate) == AF_SUCCESS) {
+        for (i = 0; i < UART_BAUD_RATE_COUNT; i++) {
+            if (s_uart_baud_rates[i] == baud_rate) {
+                af_lib->uart_rate = af_lib->uart_base_rate = i;
+                attr_id = AFLIB_MCU_UART_CONFIG_ATTR_ID;
+            }
+        }
+    } else if (AF_LIB_SPI_MAX_CLOCK_RATE > 0 &&
+               af_transport_get_spi_config(af_lib->the_transport, &af_lib->spi_clock_rate, &af_lib->spi_frame_length, &max_clock_rate, &max_frame_length) == AF_SUCCESS) {
+        af_lib->spi_base_clock_rate = af_lib->spi_clock_rate;
+        af_lib->spi_base_frame_length = af_lib->spi_frame_length;
+        attr_id = AFLIB_MCU_SPI_CONFIG_ATTR_ID;
+    }
+
+    if (attr_id != 0 && af_lib_get_attribute(af_lib, attr_id) == AF_SUCCESS) {
+        af_lib->link_negotiation = LINK_NEGOTIATION_GETTING;
+    }
+}
+
+/**
+ * af_lib_request_link_config
+ *
+ * Ask the ASR to switch its end of the link to config. We follow once it says it has.
+ */
+static void af_lib_request_link_config(af_lib_t *af_lib, uint16_t attr_id, uint16_t config_len, const uint8_t *config) {
+    af_lib->link_negotiation = LINK_NEGOTIATION_SETTING;
+    if (af_lib_set_attribute_bytes(af_lib, attr_id, config_len, config, AF_LIB_SET_REASON_LOCAL_CHANGE) != AF_SUCCESS) {
+        af_lib->link_negotiation = LINK_NEGOTIATION_NONE;
+    }
+}
+
+static void af_lib_request_uart_rate(af_lib_t *af_lib, uint8_t rate) {
+    uint8_t config[AFLIB_MCU_UART_CONFIG_LEN];
+
+    memcpy(config, af_lib->uart_config, sizeof(config));
+    config[0] = rate;
+    af_lib_request_link_config(af_lib, AFLIB_MCU_UART_CONFIG_ATTR_ID, sizeof(config), config);
+}
+
+/**
+ * af_lib_on_link_config
+ *
+ * The ASR sent the MCU UART or SPI Config, either answering our get or accepting our set. Returns true if it was part
+ * of the negotiation, in which case the application doesn't hear about it.
+ */
+static bool af_lib_on_link_config(af_lib_t *af_lib, uint16_t attr_id, uint8_t state, uint16_t value_len, const uint8_t *value) {
+    uint32_t baud_rate;
+    uint32_t max_baud_rate;
+    uint32_t clock_rate;
+    uint32_t max_clock_rate;
+    uint16_t frame_length;
+    uint16_t max_frame_length;
+    uint8_t config[AFLIB_MCU_SPI_CONFIG_LEN];
+    uint8_t rate;
+    link_negotiation_t negotiation = (link_negotiation_t)af_lib->link_negotiation;
+
+    if (LINK_NEGOTIATION_NONE == negotiation) {
+        return false;
+    }
+    af_lib->link_negotiation = LINK_NEGOTIATION_NONE;
+    if (state != UPDATE_STATE_UPDATED) {
+        return true;
+    }
+
+    if (AFLIB_MCU_UART_CONFIG_ATTR_ID == attr_id) {
+        if (value_len < AFLIB_MCU_UART_CONFIG_LEN || value[0] >= UART_BAUD_RATE_COUNT) {
+            return true;
+        }
+        memcpy(af_lib->uart_config, value, AFLIB_MCU_UART_CONFIG_LEN);
+
+        if (LINK_NEGOTIATION_SETTING == negotiation) {
+            // The ASR has switched, so follow it
+            if (af_transport_set_baud_rate(af_lib->the_transport, s_uart_baud_rates[value[0]]) == AF_SUCCESS) {
+                af_lib->uart_rate = value[0];
+                AF_LOG_INFO(af_logger_print_buffer("UART now at ");
+                            af_logger_println_value(s_uart_baud_rates[value[0]]));
+            }
+            return true;
+        }
+
+        if (af_transport_get_baud_rate(af_lib->the_transport, &baud_rate, &max_baud_rate) != AF_SUCCESS) {
+            return true;
+        }
+        if (max_baud_rate > AF_LIB_UART_MAX_BAUD_RATE) {
+            max_baud_rate = AF_LIB_UART_MAX_BAUD_RATE;
+        }
+
+        // Highest rate both sides can do that hasn't already let us down
+        for (rate = af_lib->uart_rate_limit; rate > af_lib->uart_rate; rate--) {
+            if (s_uart_baud_rates[rate] <= max_baud_rate) {
+                af_lib_request_uart_rate(af_lib, rate);
+                break;
+            }
+        }
+        return true;
     }
 
-    return AF_ERROR_QUEUE_UNDERFLOW;
-}
+    if (value_len < AFLIB_MCU_SPI_CONFIG_LEN) {
+        return true;
+    }
+    clock_rate = af_utils_read_little_endian_32(value);
+    frame_length = af_utils_read_little_endian_16(value + 4);
+
+    if (LINK_NEGOTIATION_SETTING == negotiation) {
+        if (af_transport_set_spi_config(af_lib->the_transport, clock_rate, frame_length) == AF_SUCCESS) {
+            af_lib->spi_clock_rate = clock_rate;
+            af_lib->spi_frame_length = frame_length;
+            AF_LOG_INFO(af_logger_print_buffer("SPI now at ");
+                        af_logger_print_value(clock_rate);
+                        af_logger_print_buffer("Hz, frame ");
+                        af_logger_println_value(frame_length));
+        }
+        return true;
+    }
 
-static void dump_queue_element(void* elem) {
-    uint16_t i = 0;
-    request_t *p_event = (request_t*)elem;
-    af_logger_print_buffer("q_elem: attr id: ");
-    af_logger_print_value(p_event->attr_id);
-    af_logger_print_buffer(" msg type: ");
-    af_logger_print_value(p_event->message_type);
-    af_logger_print_buffer(" value len: ");
-    af_logger_print_value(p_event->value_len);
-    af_logger_print_buffer(" val: ");
-    for (i = 0; i < p_event->value_len; i++) {
-        af_logger_print_formatted_value(p_event->value[i], AF_LOGGER_HEX);
+    // The ASR reports the fastest clock and longest frame it can take
+    if (af_transport_get_spi_config(af_lib->the_transport, &af_lib->spi_clock_rate, &af_lib->spi_frame_length, &max_clock_rate, &max_frame_length) != AF_SUCCESS) {
+        return true;
     }
-    af_logger_println_buffer("");
+    if (clock_rate > max_clock_rate) {
+        clock_rate = max_clock_rate;
+    }
+    if (clock_rate > AF_LIB_SPI_MAX_CLOCK_RATE) {
+        clock_rate = AF_LIB_SPI_MAX_CLOCK_RATE;
+    }
+    if (clock_rate > af_lib->spi_clock_rate_limit) {
+        clock_rate = af_lib->spi_clock_rate_limit;
+    }
+    if (frame_length > max_frame_length) {
+        frame_length = max_frame_length;
+    }
+    // Only ever speed up, what we have now already works
+    if (clock_rate < af_lib->spi_clock_rate) {
+        clock_rate = af_lib->spi_clock_rate;
+    }
+    if (frame_length < af_lib->spi_frame_length) {
+        frame_length = af_lib->spi_frame_length;
+    }
+    if (clock_rate != af_lib->spi_clock_rate || frame_length != af_lib->spi_frame_length) {
+        memcpy(config, value, sizeof(config));
+        af_utils_write_little_endian_32(clock_rate, config);
+        af_utils_write_little_endian_16(frame_length, config + 4);
+        af_lib_request_link_config(af_lib, AFLIB_MCU_SPI_CONFIG_ATTR_ID, sizeof(config), config);
+    }
+    return true;
 }
 
 /**
- * af_lib_update_ints_pending
+ * af_lib_reset_link
  *
- * Interrupt-sAF_E method for updating the interrupt count. This is called to increment and decrement the interrupt count
- * as interrupts are received and handled.
+ * Go back to the settings the transport was created with, which is what the ASR uses when it comes up.
  */
-static void af_lib_update_ints_pending(af_lib_t *af_lib, int amount) {
-    af_lib->interrupts_pending += amount;
+static void af_lib_reset_link(af_lib_t *af_lib) {
+    af_lib->link_negotiation = LINK_NEGOTIATION_NONE;
+    if (af_lib->uart_rate != af_lib->uart_base_rate &&
+        af_transport_set_baud_rate(af_lib->the_transport, s_uart_baud_rates[af_lib->uart_base_rate]) == AF_SUCCESS) {
+        af_lib->uart_rate = af_lib->uart_base_rate;
+    }
+    if ((af_lib->spi_clock_rate != af_lib->spi_base_clock_rate || af_lib->spi_frame_length != af_lib->spi_base_frame_length) &&
+        af_transport_set_spi_config(af_lib->the_transport, af_lib->spi_base_clock_rate, af_lib->spi_base_frame_length) == AF_SUCCESS) {
+        af_lib->spi_clock_rate = af_lib->spi_base_clock_rate;
+        af_lib->spi_frame_length = af_lib->spi_base_frame_length;
+    }
 }
 
 /**
- * af_lib_send_command
+ * af_lib_on_link_errors
  *
- * This increments the interrupt count to kick off the state machine in the next call to loop().
+ * Syncs have been failing. If we've sped the link up, slow it back down a step, or if it has stopped working
+ * altogether go back to what the ASR starts with after a reboot. Either way don't try the failing speed again.
+ *
+ * A UART has to agree its baud rate with the ASR, but the SPI clock is ours to drive so it just drops to half.
  */
-static void af_lib_send_command(af_lib_t *af_lib) {
-    if (0 == af_lib->interrupts_pending && STATE_IDLE == af_lib->state) {
-        af_lib_update_ints_pending(af_lib, 1);
+static void af_lib_on_link_errors(af_lib_t *af_lib, bool broken) {
+    if (af_lib->uart_rate > af_lib->uart_base_rate) {
+        af_lib->uart_rate_limit = af_lib->uart_rate - 1;
+        if (!broken && LINK_NEGOTIATION_NONE == af_lib->link_negotiation) {
+            AF_LOG_WARN(af_logger_println_buffer("UART errors, slowing down"));
+            af_lib_request_uart_rate(af_lib, af_lib->uart_rate - 1);
+        }
     }
-    af_lib->last_command_send_time = af_utils_millis();
-}
 
-static int af_lib_set_attribute_complete(af_lib_t *af_lib, uint8_t request_id, const uint16_t attr_id, const uint16_t value_len, const uint8_t *value, uint8_t status, uint8_t reason) {
-    return queue_put(af_lib, MSG_TYPE_UPDATE, request_id, attr_id, value_len, value, status, reason);
+    if (af_lib->spi_clock_rate > af_lib->spi_base_clock_rate) {
+        af_lib->spi_clock_rate_limit = af_lib->spi_clock_rate / 2;
+        if (af_lib->spi_clock_rate_limit < af_lib->spi_base_clock_rate) {
+            af_lib->spi_clock_rate_limit = af_lib->spi_base_clock_rate;
+        }
+        if (!broken && af_transport_set_spi_config(af_lib->the_transport, af_lib->spi_clock_rate_limit, af_lib->spi_frame_length) == AF_SUCCESS) {
+            AF_LOG_WARN(af_logger_println_buffer("SPI errors, slowing down"));
+            af_lib->spi_clock_rate = af_lib->spi_clock_rate_limit;
+        }
+    }
+
+    if (broken) {
+        af_lib_reset_link(af_lib);
+    }
 }
 
 /**
@@ -298,24 +1102,24 @@ static int af_lib_set_attribute_complete(af_lib_t *af_lib, uint8_t request_id, c
  * The private version of getAttribute. This version actually calls af_lib_send_command() to kick off the state machine and
  * execute the operation.
  */
-static int af_lib_do_get_attribute(af_lib_t *af_lib, uint8_t request_id, uint16_t attr_id) {
+static int af_lib_do_get_attribute(af_lib_t *af_lib, request_t *request) {
     if (af_lib->interrupts_pending > 0 || af_lib->write_cmd != NULL) {
         return AF_ERROR_BUSY;
     }
 
-    af_lib->write_cmd = (af_command_t*)malloc(sizeof(af_command_t));
-    af_command_initialize_with_attr_id(af_lib->write_cmd, request_id, MSG_TYPE_GET, attr_id);
+    af_lib->write_cmd = &af_lib->write_command;
+    af_command_initialize_with_attr_id(af_lib->write_cmd, request->request_id, MSG_TYPE_GET, request->attr_id);
     if (!af_command_is_valid(af_lib->write_cmd)) {
-        af_logger_print_buffer("af_lib_do_get_attribute invalid command:");
-        af_command_dump_bytes(af_lib->write_cmd);
-        af_command_dump(af_lib->write_cmd);
+        AF_LOG_ERROR(af_logger_print_buffer("af_lib_do_get_attribute invalid command:");
+                     af_command_dump_bytes(af_lib->write_cmd);
+                     af_command_dump(af_lib->write_cmd));
         af_command_cleanup(af_lib->write_cmd);
-        free(af_lib->write_cmd);
         af_lib->write_cmd = NULL;
         return AF_ERROR_INVALID_COMMAND;
     }
 
-    af_lib->outstanding_set_get_attr_id = attr_id;
+    af_lib->write_request = request;
+    in_flight_add(af_lib, request);
 
     // Start the transmission.
     af_lib_send_command(af_lib);
@@ -329,31 +1133,31 @@ static int af_lib_do_get_attribute(af_lib_t *af_lib, uint8_t request_id, uint16_
  * The private version of setAttribute. This version actually calls af_lib_send_command() to kick off the state machine and
  * execute the operation.
  */
-static int af_lib_do_set_attribute(af_lib_t *af_lib, uint8_t request_id, uint16_t attr_id, uint16_t value_len, uint8_t *value) {
+static int af_lib_do_set_attribute(af_lib_t *af_lib, request_t *request) {
     if (af_lib->interrupts_pending > 0 || af_lib->write_cmd != NULL) {
         return AF_ERROR_BUSY;
     }
 
-    af_lib->write_cmd = (af_command_t*)malloc(sizeof(af_command_t));
-    af_command_initialize_with_value(af_lib->write_cmd, request_id, MSG_TYPE_SET, attr_id, value_len, value);
+    af_lib->write_cmd = &af_lib->write_command;
+    af_command_initialize_with_value(af_lib->write_cmd, request->request_id, MSG_TYPE_SET, request->attr_id, request->value_len, request->value);
     if (!af_command_is_valid(af_lib->write_cmd)) {
-        af_logger_print_buffer("af_lib_do_set_attribute invalid command:");
-        af_command_dump_bytes(af_lib->write_cmd);
-        af_command_dump(af_lib->write_cmd);
+        AF_LOG_ERROR(af_logger_print_buffer("af_lib_do_set_attribute invalid command:");
+                     af_command_dump_bytes(af_lib->write_cmd);
+                     af_command_dump(af_lib->write_cmd));
         af_command_cleanup(af_lib->write_cmd);
-        free(af_lib->write_cmd);
         af_lib->write_cmd = NULL;
         return AF_ERROR_INVALID_COMMAND;
     }
 
     /**
     * Recognize when the MCU is trying to reboot the ASR. When this is the case, the ASR will reboot before
-    * the SPI transaction completes and the _outstandingSetGetAttrId will be left set. Instead, just don't
-    * set it for this case.
+    * the SPI transaction completes and the request would be left in flight. Instead, just don't track it
+    * for this case.
     */
-    if (attr_id != AFLIB_SYSTEM_COMMAND_ATTR_ID || *value != AFLIB_SYSTEM_COMMAND_REBOOT) {
-        af_lib->outstanding_set_get_attr_id = attr_id;
+    if (request->attr_id != AFLIB_SYSTEM_COMMAND_ATTR_ID || *request->value != AFLIB_SYSTEM_COMMAND_REBOOT) {
+        in_flight_add(af_lib, request);
     }
+    af_lib->write_request = request;
 
     // Start the transmission.
     af_lib_send_command(af_lib);
@@ -361,29 +1165,99 @@ static int af_lib_do_set_attribute(af_lib_t *af_lib, uint8_t request_id, uint16_
     return AF_SUCCESS;
 }
 
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+/**
+ * af_lib_batch_command
+ *
+ * Set up command to describe one of the updates batched behind write_cmd.
+ */
+static void af_lib_batch_command(af_command_t *command, request_t *request) {
+    af_command_initialize_with_status(command, request->request_id, MSG_TYPE_UPDATE, request->attr_id, request->status, request->reason, request->value_len, request->value, true);
+}
+
+/**
+ * af_lib_write_frame
+ *
+ * Serialize command, preceded by its length, into buffer. Returns the number of bytes written.
+ */
+static uint16_t af_lib_write_frame(af_command_t *command, uint8_t *buffer) {
+    uint16_t size = af_command_get_size(command);
+
+    af_utils_write_little_endian_16(size, buffer);
+    af_command_get_bytes(command, &buffer[2]);
+
+    return size + 2;
+}
+
+/**
+ * af_lib_gather_batch
+ *
+ * If the ASR takes batched frames, pull the updates queued right behind write_cmd off the queue so they go out in the
+ * same transfer. Only updates are batched, the ASR doesn't answer them so there's nothing to match up afterwards.
+ */
+static void af_lib_gather_batch(af_lib_t *af_lib) {
+    af_command_t command;
+    request_t *request;
+    uint16_t len = af_command_get_size(af_lib->write_cmd) + 2;
+    uint8_t i;
+
+    af_lib->batch_count = 0;
+    af_lib->batch_len = 0;
+
+    if (len > sizeof(af_lib->batch_buffer) || af_lib_asr_has_capability(af_lib, AF_ASR_CAPABILITY_BATCHED_FRAMES) != AF_SUCCESS) {
+        return;
+    }
+
+    while (af_lib->batch_count < AF_LIB_MAX_BATCH - 1) {
+        request = queue_peek(af_lib);
+        // The frame headroom is exactly the length and header of an update
+        if (NULL == request || request->message_type != MSG_TYPE_UPDATE || len + AF_LIB_FRAME_HEADROOM + request->value_len > sizeof(af_lib->batch_buffer)) {
+            break;
+        }
+        queue_get(af_lib, &request);
+        af_lib->batch_requests[af_lib->batch_count++] = request;
+        len += AF_LIB_FRAME_HEADROOM + request->value_len;
+    }
+
+    if (0 == af_lib->batch_count) {
+        return;
+    }
+
+    af_lib->batch_len = af_lib_write_frame(af_lib->write_cmd, af_lib->batch_buffer);
+    for (i = 0; i < af_lib->batch_count; i++) {
+        af_lib_batch_command(&command, af_lib->batch_requests[i]);
+        af_lib->batch_len += af_lib_write_frame(&command, &af_lib->batch_buffer[af_lib->batch_len]);
+    }
+}
+#endif
+
 /**
  * af_lib_do_update_attribute
  *
  * setAttribute calls on MCU attributes turn into updateAttribute calls. See documentation on the SPI protocol for
  * more information. This method calls af_lib_send_command() to kick off the state machine and execute the operation.
  */
-static int af_lib_do_update_attribute(af_lib_t *af_lib, uint8_t request_id, uint16_t attr_id, uint16_t value_len, uint8_t *value, uint8_t status, uint8_t reason) {
+static int af_lib_do_update_attribute(af_lib_t *af_lib, request_t *request) {
     if (af_lib->interrupts_pending > 0 || af_lib->write_cmd != NULL) {
         return AF_ERROR_BUSY;
     }
 
-    af_lib->write_cmd = (af_command_t*)malloc(sizeof(af_command_t));
-    af_command_initialize_with_status(af_lib->write_cmd, request_id, MSG_TYPE_UPDATE, attr_id, status, reason, value_len, value, true);
+    af_lib->write_cmd = &af_lib->write_command;
+    af_command_initialize_with_status(af_lib->write_cmd, request->request_id, MSG_TYPE_UPDATE, request->attr_id, request->status, request->reason, request->value_len, request->value, true);
     if (!af_command_is_valid(af_lib->write_cmd)) {
-        af_logger_print_buffer("af_lib_do_update_attribute invalid command:");
-        af_command_dump_bytes(af_lib->write_cmd);
-        af_command_dump(af_lib->write_cmd);
+        AF_LOG_ERROR(af_logger_print_buffer("af_lib_do_update_attribute invalid command:");
+                     af_command_dump_bytes(af_lib->write_cmd);
+                     af_command_dump(af_lib->write_cmd));
         af_command_cleanup(af_lib->write_cmd);
-        free(af_lib->write_cmd);
         af_lib->write_cmd = NULL;
         return AF_ERROR_INVALID_COMMAND;
     }
 
+    af_lib->write_request = request;
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+    af_lib_gather_batch(af_lib);
+#endif
+
     // Start the transmission.
     af_lib_send_command(af_lib);
 
@@ -399,23 +1273,22 @@ static int af_lib_do_update_attribute(af_lib_t *af_lib, uint8_t request_id, uint
 #ifdef ATTRIBUTE_CLI
 static int af_lib_parse_command(af_lib_t *af_lib, const char *cmd) {
     if (af_lib->interrupts_pending > 0 || af_lib->write_cmd != NULL) {
-        af_logger_print_buffer("Busy: ");
-        af_logger_print_value(af_lib->interrupts_pending);
-        af_logger_print_buffer(", ");
-        af_logger_println_value(af_lib->write_cmd != NULL);
+        AF_LOG_DEBUG(af_logger_print_buffer("Busy: ");
+                     af_logger_print_value(af_lib->interrupts_pending);
+                     af_logger_print_buffer(", ");
+                     af_logger_println_value(af_lib->write_cmd != NULL));
         return AF_ERROR_BUSY;
     }
 
     int req_id = af_lib->request_id++;
-    af_lib->write_cmd = (af_command_t*)malloc(sizeof(af_command_t));
+    af_lib->write_cmd = &af_lib->write_command;
     af_command_create_from_string(af_lib->write_cmd, req_id, cmd);
     if (!af_command_is_valid(af_lib->write_cmd)) {
-        af_logger_print_buffer("BAD: ");
-        af_logger_println_value(cmd);
-        af_command_dump_bytes(af_lib->write_cmd);
-        af_command_dump(af_lib->write_cmd);
+        AF_LOG_DEBUG(af_logger_print_buffer("BAD: ");
+                     af_logger_println_buffer(cmd);
+                     af_command_dump_bytes(af_lib->write_cmd);
+                     af_command_dump(af_lib->write_cmd));
         af_command_cleanup(af_lib->write_cmd);
-        free(af_lib->write_cmd);
         af_lib->write_cmd = NULL;
         return AF_ERROR_INVALID_COMMAND;
     }
@@ -433,7 +1306,7 @@ static int af_lib_parse_command(af_lib_t *af_lib, const char *cmd) {
  * Print the current state of the afLib state machine.
  */
 static void print_state(int state) {
-#if (defined(DEBUG_TRANSPORT) && DEBUG_TRANSPORT > 0)
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_TRACE
     switch (state) {
         case STATE_IDLE:
             af_logger_println_buffer("STATE_IDLE");
@@ -482,9 +1355,17 @@ static void af_lib_on_state_idle(af_lib_t *af_lib) {
     if (af_lib->write_cmd != NULL) {
         // Include 2 bytes for length
         af_lib->bytes_to_send = af_command_get_size(af_lib->write_cmd) + 2;
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+        if (af_lib->batch_len > 0) {
+            af_lib->bytes_to_send = af_lib->batch_len;
+        }
+#endif
     } else {
         af_lib->bytes_to_send = 0;
     }
+#if AF_LIB_STATS
+    af_lib->transfer_start = af_utils_micros();
+#endif
     af_lib->state = STATE_STATUS_SYNC;
     print_state(af_lib->state);
 }
@@ -503,6 +1384,11 @@ static void af_lib_on_state_sync(af_lib_t *af_lib) {
     af_status_command_set_bytes_to_recv(&af_lib->tx_status, 0);
 
     result = af_transport_exchange_status(af_lib->the_transport, &af_lib->tx_status, &af_lib->rx_status);
+    if (AF_ERROR_BUSY == result) {
+        af_lib_retry_state(af_lib);
+        return;
+    }
+    STATS_ADD(af_lib, syncs, 1);
 
     if (AF_SUCCESS == result && af_status_command_is_valid(&af_lib->rx_status) && in_sync(&af_lib->tx_status, &af_lib->rx_status)) {
         sync_retries = 0;   // Flag that sync completed.
@@ -515,12 +1401,20 @@ static void af_lib_on_state_sync(af_lib_t *af_lib) {
         af_lib->state = STATE_STATUS_SYNC;
         last_sync = af_utils_millis();
         sync_retries++;
-#if (defined(DEBUG_TRANSPORT) && DEBUG_TRANSPORT > 0)
-        af_logger_println_buffer("tx_status");
-        af_status_command_dump(&af_lib->tx_status);
-        af_logger_println_buffer("rx_status");
-        af_status_command_dump(&af_lib->rx_status);
-#endif
+        STATS_ADD(af_lib, sync_retries, 1);
+        TRACE(af_lib, AF_TRACE_EVENT_SYNC_RETRY, 0, sync_retries);
+        if (AF_SUCCESS == result && !af_status_command_is_valid(&af_lib->rx_status)) {
+            STATS_ADD(af_lib, checksum_failures, 1);
+        } else if (AF_SUCCESS == result) {
+            STATS_ADD(af_lib, collisions, 1);
+        }
+        if (AF_LIB_LINK_ERROR_THRESHOLD == sync_retries) {
+            af_lib_on_link_errors(af_lib, false);
+        }
+        AF_LOG_TRACE(af_logger_println_buffer("tx_status");
+                     af_status_command_dump(&af_lib->tx_status);
+                     af_logger_println_buffer("rx_status");
+                     af_status_command_dump(&af_lib->rx_status));
     }
     print_state(af_lib->state);
 }
@@ -546,12 +1440,39 @@ static void af_lib_on_state_ack(af_lib_t *af_lib) {
         return;
     }
     if (af_lib->bytes_to_send > 0) {
-        af_lib->write_buffer_len = af_command_get_size(af_lib->write_cmd);
-        af_lib->write_buffer = (uint8_t*)malloc(af_lib->bytes_to_send);
-        memcpy(af_lib->write_buffer, &af_lib->write_buffer_len, 2);
-        af_command_get_bytes(af_lib->write_cmd, &af_lib->write_buffer[2]);
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+        if (af_lib->batch_len > 0) {
+            // Already serialized by af_lib_gather_batch
+            af_lib->write_buffer = af_lib->batch_buffer;
+        } else
+#endif
+        {
+            // The value is already sitting in the request slot, so build the frame in the headroom right in front of it
+            af_lib->write_buffer = af_lib->write_request->value - af_command_get_header_size(af_lib->write_cmd) - 2;
+            af_utils_write_little_endian_16(af_command_get_size(af_lib->write_cmd), af_lib->write_buffer);
+            af_command_get_header_bytes(af_lib->write_cmd, &af_lib->write_buffer[2]);
+        }
         af_lib->state = STATE_SEND_BYTES;
     } else if (af_lib->bytes_to_recv > 0) {
+        // Receive into our own buffer when the frame fits, otherwise allocate one just for this frame
+        af_lib->read_buffer = NULL;
+#if AF_LIB_RECEIVE_BUFFER_SIZE > 0
+        if (af_lib->bytes_to_recv <= sizeof(af_lib->rx_buffer)) {
+            af_lib->read_buffer = af_lib->rx_buffer;
+        }
+#endif
+        if (NULL == af_lib->read_buffer) {
+            af_lib->read_buffer = (uint8_t *)af_allocator_alloc_with(&af_lib->allocator, af_lib->bytes_to_recv);
+        }
+        if (NULL == af_lib->read_buffer) {
+            AF_LOG_ERROR(af_logger_print_buffer("No room to receive ");
+                         af_logger_print_value(af_lib->bytes_to_recv);
+                         af_logger_println_buffer(" bytes from ASR"));
+            af_lib->state = STATE_IDLE;
+            print_state(af_lib->state);
+            return;
+        }
+        af_lib->read_buffer_len = af_lib->bytes_to_recv;
         af_lib->state = STATE_RECV_BYTES;
     } else {
         af_lib->state = STATE_CMD_COMPLETE;
@@ -566,39 +1487,79 @@ static void af_lib_on_state_ack(af_lib_t *af_lib) {
  */
 static void af_lib_on_state_send_bytes(af_lib_t *af_lib) {
     //af_logger_print_buffer("send bytes: "); af_logger_println_value(af_lib->bytes_to_send);
-    af_transport_send_bytes_offset(af_lib->the_transport, af_lib->write_buffer, &af_lib->bytes_to_send, &af_lib->write_cmd_offset);
+    int result = af_transport_send_bytes_offset(af_lib->the_transport, af_lib->write_buffer, &af_lib->bytes_to_send, &af_lib->write_cmd_offset);
+    if (AF_ERROR_BUSY == result) {
+        af_lib_retry_state(af_lib);
+        return;
+    }
 
     if (0 == af_lib->bytes_to_send) {
-        af_lib->write_buffer_len = 0;
-        free(af_lib->write_buffer);
+        STATS_ADD(af_lib, bytes_tx, af_lib->write_cmd_offset);
         af_lib->write_buffer = NULL;
         af_lib->state = STATE_CMD_COMPLETE;
         print_state(af_lib->state);
     }
 }
 
+/**
+ * af_lib_release_read_buffer
+ *
+ * Let go of the received frame, freeing it only if it didn't fit in rx_buffer.
+ */
+static void af_lib_release_read_buffer(af_lib_t *af_lib) {
+#if AF_LIB_RECEIVE_BUFFER_SIZE > 0
+    if (af_lib->read_buffer != af_lib->rx_buffer) {
+        af_allocator_free_with(&af_lib->allocator, af_lib->read_buffer);
+    }
+#else
+    af_allocator_free_with(&af_lib->allocator, af_lib->read_buffer);
+#endif
+    af_lib->read_buffer = NULL;
+    af_lib->read_buffer_len = 0;
+}
+
+/**
+ * af_lib_release_read_cmd
+ *
+ * Done with the received command, so let go of it and the frame it refers to.
+ */
+static void af_lib_release_read_cmd(af_lib_t *af_lib) {
+    if (af_lib->read_cmd != NULL) {
+        af_command_cleanup(af_lib->read_cmd);
+        af_lib->read_cmd = NULL;
+    }
+    af_lib->read_cmd_offset = 0;
+    af_lib_release_read_buffer(af_lib);
+}
+
 /**
  * af_lib_on_state_recv_bytes
  *
  * Receive the required number of bytes from the ASR-1 and then advance to command complete.
+ * The received command is parsed in place and read_cmd refers into the frame until af_lib_release_read_cmd is called.
  */
 static void af_lib_on_state_recv_bytes(af_lib_t *af_lib) {
     int result = af_transport_recv_bytes_offset(af_lib->the_transport, &af_lib->read_buffer, &af_lib->read_buffer_len, &af_lib->bytes_to_recv, &af_lib->read_cmd_offset);
+    if (AF_ERROR_BUSY == result) {
+        af_lib_retry_state(af_lib);
+        return;
+    }
     if (result != AF_SUCCESS) {
         af_lib->state = STATE_IDLE;
         print_state(af_lib->state);
-        free(af_lib->read_buffer);
-        af_lib->read_buffer = NULL;
+        af_lib->read_cmd_offset = 0;
+        af_lib_release_read_buffer(af_lib);
         return;
     }
     if (0 == af_lib->bytes_to_recv) {
+        STATS_ADD(af_lib, bytes_rx, af_lib->read_buffer_len);
         af_lib->state = STATE_CMD_COMPLETE;
         print_state(af_lib->state);
-        af_lib->read_cmd = (af_command_t*)malloc(sizeof(af_command_t));
-        af_command_initialize_from_buffer(af_lib->read_cmd, af_lib->read_buffer_len, &af_lib->read_buffer[2], af_lib->asr_protocol_version);
-        //_readCmd->dumpBytes();
-        free(af_lib->read_buffer);
-        af_lib->read_buffer = NULL;
+        af_lib->read_cmd = &af_lib->read_command;
+        if (af_lib->read_buffer_len < 2 || !af_command_initialize_from_buffer(af_lib->read_cmd, af_lib->read_buffer_len - 2, &af_lib->read_buffer[2], af_lib->asr_protocol_version)) {
+            AF_LOG_ERROR(af_logger_println_buffer("Dropping truncated command from ASR"));
+            af_lib_release_read_cmd(af_lib);
+        }
     }
 }
 
@@ -661,7 +1622,7 @@ static void af_lib_handle_attr_notify(af_lib_t *af_lib, af_command_t *command) {
                     error = AF_SUCCESS;
                 }
             } else {
-                af_logger_println_buffer("Unexpected msg from ASR supporting MCU protocol v2!!!");
+                AF_LOG_ERROR(af_logger_println_buffer("Unexpected msg from ASR supporting MCU protocol v2!!!"));
             }
         } else {
             event = AF_LIB_EVENT_ASR_NOTIFICATION;
@@ -683,21 +1644,55 @@ static void af_lib_asr_initialization_complete(af_lib_t *af_lib) {
     uint8_t desired_state = 1 << (asr_state_extensions ? AF_MODULE_STATE_INITIALIZED : AF_MODULE_STATE_LINKED);
 
     if (s_asr_states & desired_state) {
-        af_logger_println_buffer("ASR finished rebooting");
+        AF_LOG_INFO(af_logger_println_buffer("ASR finished rebooting"));
         af_lib->asr_rebooting = false;
 
         // When we start up we need to tell the ASR our capabilities
         uint8_t our_capability = 0;
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+        our_capability |= AFLIB_CAPABILITY_BATCHED_FRAMES;
+#endif
         af_lib_set_attribute_bytes(af_lib, ATTRIBUTE_ID_DEVICE_MCU_AFLIB_CAPABILITIES, sizeof(our_capability), &our_capability, AF_LIB_SET_REASON_LOCAL_CHANGE);
 
         // When we start up we need to get the ASR capabilities and cache them internally
         af_lib_get_attribute(af_lib, AF_ATTRIBUTE_ID_ASR_CAPABILITIES);
 
+        // Then see if the link can go any faster
+        af_lib_start_link_negotiation(af_lib);
+
         // Clear the variables after we've gotten what we wanted
         s_asr_version = s_asr_states = 0;
     }
 }
 
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+/**
+ * af_lib_release_batch
+ *
+ * The batched updates are out. Fake the same callback for each of them that af_lib_on_state_cmd_complete fakes for
+ * write_cmd and free their requests.
+ */
+static void af_lib_release_batch(af_lib_t *af_lib) {
+    af_command_t command;
+    uint8_t i;
+
+    for (i = 0; i < af_lib->batch_count; i++) {
+        TRACE(af_lib, AF_TRACE_EVENT_SENT, af_lib->batch_requests[i]->attr_id, af_lib->batch_requests[i]->value_len);
+#if AF_LIB_STATS
+        stats_request_sent(af_lib, af_lib->batch_requests[i]);
+#endif
+        if (IS_ATTRIBUTE_MCU(af_lib->batch_requests[i]->attr_id)) {
+            af_lib_batch_command(&command, af_lib->batch_requests[i]);
+            af_lib_handle_attr_notify(af_lib, &command);
+            af_command_cleanup(&command);
+        }
+        queue_release(af_lib, af_lib->batch_requests[i]);
+    }
+    af_lib->batch_count = 0;
+    af_lib->batch_len = 0;
+}
+#endif
+
 /**
  * af_lib_on_state_cmd_complete
  *
@@ -713,10 +1708,15 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
     af_lib->state = STATE_IDLE;
     print_state(af_lib->state);
     if (af_lib->read_cmd != NULL) {
-        uint8_t *val = (uint8_t*)malloc(af_command_get_value_len(af_lib->read_cmd));
-        af_command_get_value(af_lib->read_cmd, val);
+        // Handlers are given a pointer straight into the received frame, valid only for the duration of the callback
+        const uint8_t *val = af_command_get_value_pointer(af_lib->read_cmd);
 
         command = af_command_get_command(af_lib->read_cmd);
+        TRACE(af_lib, AF_TRACE_EVENT_RECEIVED, af_command_get_attr_id(af_lib->read_cmd), af_command_get_value_len(af_lib->read_cmd));
+#if AF_LIB_STATS
+        af_lib->stats.messages_rx[stats_msg_index(command)]++;
+        stats_record_latency(&af_lib->stats.callback_latency, af_lib->transfer_start);
+#endif
 
         switch (command) {
             case MSG_TYPE_SET:
@@ -735,8 +1735,8 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                     af_lib->state = STATE_WAITING_FOR_SET_RESPONSE;
                     result = af_lib_set_attribute_complete(af_lib, af_command_get_req_id(af_lib->read_cmd), af_command_get_attr_id(af_lib->read_cmd), af_command_get_value_len(af_lib->read_cmd), val, state, reason);
                     if (result != AF_SUCCESS) {
-                        af_logger_print_buffer("Can't reply to SET in on_state_cmd_complete! This is FATAL! rc=");
-                        af_logger_println_value(result);
+                        AF_LOG_ERROR(af_logger_print_buffer("Can't reply to SET in on_state_cmd_complete! This is FATAL! rc=");
+                                     af_logger_println_value(result));
                     }
                     af_lib->state = STATE_IDLE;
                 }
@@ -749,15 +1749,18 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                     uint16_t attr_id = af_command_get_attr_id(af_lib->read_cmd);
                     if (AF_ATTRIBUTE_ID_ASR_CAPABILITIES == attr_id && NULL == af_lib->asr_capability) {
                         af_lib->asr_capability_length = af_command_get_value_len(af_lib->read_cmd);
-                        af_lib->asr_capability = (uint8_t*)malloc(af_lib->asr_capability_length);
+                        if (af_lib->asr_capability_length > sizeof(af_lib->asr_capability_buffer)) {
+                            af_lib->asr_capability_length = sizeof(af_lib->asr_capability_buffer);
+                        }
+                        af_lib->asr_capability = af_lib->asr_capability_buffer;
                         memcpy(af_lib->asr_capability, val, af_lib->asr_capability_length);
                     }
                     if (ATTRIBUTE_ID_DEVICE_MCU_DEVICE_PROTOCOL_VERSION == attr_id) {
                         af_lib->asr_protocol_version = af_utils_read_little_endian_16(val);
                         // Now we need to send up our protocol version
                         uint16_t our_protocol_version = AFLIB_MCU_PROCOCOL_VERSION;
-                        af_logger_print_buffer("ASR protocol version: ");
-                        af_logger_println_value(af_lib->asr_protocol_version);
+                        AF_LOG_INFO(af_logger_print_buffer("ASR protocol version: ");
+                                    af_logger_println_value(af_lib->asr_protocol_version));
                         af_lib->asr_rebooting = false; // This will actually let the message out, we'll revert back to the the "true" value once we get the update message from the ASR
                         af_lib_set_attribute_16(af_lib, ATTRIBUTE_ID_DEVICE_MCU_AFLIB_PROTOCOL_VERSION, our_protocol_version, AF_LIB_SET_REASON_LOCAL_CHANGE);
                     }
@@ -765,9 +1768,7 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                         af_lib->asr_rebooting = true; // Now we're back to our normal selves and have to wait for the ASR state
                     }
 
-                    if (attr_id == af_lib->outstanding_set_get_attr_id) {
-                        af_lib->outstanding_set_get_attr_id = 0;
-                    }
+                    in_flight_complete(af_lib, af_command_get_req_id(af_lib->read_cmd), attr_id);
 
                     if (AFLIB_SYSTEM_APPLICATION_VERSION == attr_id) {
                         s_asr_version = af_utils_read_little_endian_64(af_command_get_value_pointer(af_lib->read_cmd));
@@ -787,6 +1788,9 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                     }
 
                     bool hide_from_mcu = false;
+                    if (AFLIB_MCU_UART_CONFIG_ATTR_ID == attr_id || AFLIB_MCU_SPI_CONFIG_ATTR_ID == attr_id) {
+                        hide_from_mcu = af_lib_on_link_config(af_lib, attr_id, af_command_get_state(af_lib->read_cmd), af_command_get_value_len(af_lib->read_cmd), val);
+                    }
                     switch (attr_id) {
                         // If this is the internal ATTRIBUTE_ID_DEVICE_MCU_AFLIB_CAPABILITIES or the protocol versions then don't tell the MCU since this is used for internal book keeping between afLib and the ASR
                         case ATTRIBUTE_ID_DEVICE_MCU_AFLIB_CAPABILITIES:
@@ -795,7 +1799,6 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                             hide_from_mcu = true;
                             break;
                         default:
-                            hide_from_mcu = false;
                             break;
                     }
 
@@ -812,6 +1815,11 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                 break;
 
             case MSG_TYPE_UPDATE_REJECTED:
+                in_flight_complete(af_lib, af_command_get_req_id(af_lib->read_cmd), af_command_get_attr_id(af_lib->read_cmd));
+                if ((AFLIB_MCU_UART_CONFIG_ATTR_ID == af_command_get_attr_id(af_lib->read_cmd) || AFLIB_MCU_SPI_CONFIG_ATTR_ID == af_command_get_attr_id(af_lib->read_cmd)) &&
+                    af_lib_on_link_config(af_lib, af_command_get_attr_id(af_lib->read_cmd), af_command_get_state(af_lib->read_cmd), 0, NULL)) {
+                    break;
+                }
                 if (af_lib->event_handler != NULL) {
                     af_lib->event_handler(AF_LIB_EVENT_MCU_SET_REQ_REJECTION, af_lib_convert_state_to_error(af_command_get_state(af_lib->read_cmd)), af_command_get_attr_id(af_lib->read_cmd), af_command_get_value_len(af_lib->read_cmd), val);
                 }
@@ -839,28 +1847,26 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
                         break;
                     }
                 }
-                af_logger_print_buffer("Unhandled msg type: ");
-                af_logger_println_value(command);
+                AF_LOG_WARN(af_logger_print_buffer("Unhandled msg type: ");
+                            af_logger_println_value(command));
                 break;
         }
-        free(val);
+        // While we wait for the set response the command (and the frame it points into) has to stay around
         if (af_lib->state != STATE_WAITING_FOR_SET_RESPONSE) {
-            if (af_lib->read_cmd != NULL) {
-                af_command_cleanup(af_lib->read_cmd);
-                free(af_lib->read_cmd);
-                af_lib->read_cmd_offset = 0;
-                af_lib->read_cmd = NULL;
-            }
+            af_lib_release_read_cmd(af_lib);
         }
     }
 
     if (af_lib->write_cmd != NULL) {
+        TRACE(af_lib, AF_TRACE_EVENT_SENT, af_command_get_attr_id(af_lib->write_cmd), af_command_get_value_len(af_lib->write_cmd));
         // If we just wrote the command attribute with the value of reboot then put our foot down and don't allow any other attributes to be get/set until we get the ASR state update from the ASR indicating that it has rebooted
         if (af_command_get_command(af_lib->write_cmd) == MSG_TYPE_SET && af_command_get_attr_id(af_lib->write_cmd) == AFLIB_SYSTEM_COMMAND_ATTR_ID) {
             const uint8_t* data = af_command_get_value_pointer(af_lib->write_cmd);
             if (data != NULL && AFLIB_SYSTEM_COMMAND_REBOOT == *data) {
-                af_logger_println_buffer("ASR rebooting...");
+                AF_LOG_INFO(af_logger_println_buffer("ASR rebooting..."));
                 af_lib->asr_rebooting = true;
+                // It comes back up with the link settings it started with
+                af_lib_reset_link(af_lib);
             }
         }
 
@@ -870,9 +1876,19 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
             last_complete = af_utils_millis();
         }
         af_command_cleanup(af_lib->write_cmd);
-        free(af_lib->write_cmd);
         af_lib->write_cmd = NULL;
         af_lib->write_cmd_offset = 0;
+
+        if (af_lib->write_request != NULL) {
+#if AF_LIB_STATS
+            stats_request_sent(af_lib, af_lib->write_request);
+#endif
+            queue_release(af_lib, af_lib->write_request);
+            af_lib->write_request = NULL;
+        }
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+        af_lib_release_batch(af_lib);
+#endif
     }
 }
 
@@ -883,11 +1899,12 @@ static void af_lib_on_state_cmd_complete(af_lib_t *af_lib) {
  */
 static void af_lib_on_state_waiting_for_set_response(af_lib_t *af_lib) {
     if (af_utils_millis() - af_lib->attr_set_request_time > AF_LIB_SET_RESPONSE_TIMEOUT_SECONDS*1000) {
-        af_logger_print_buffer("Response timeout for attribute ");
-        af_logger_print_value(af_command_get_attr_id(af_lib->read_cmd));
-        af_logger_print_buffer(", timeout ");
-        af_logger_print_value(AF_LIB_SET_RESPONSE_TIMEOUT_SECONDS);
-        af_logger_println_buffer(" seconds");
+        AF_LOG_WARN(af_logger_print_buffer("Response timeout for attribute ");
+                    af_logger_print_value(af_command_get_attr_id(af_lib->read_cmd));
+                    af_logger_print_buffer(", timeout ");
+                    af_logger_print_value(AF_LIB_SET_RESPONSE_TIMEOUT_SECONDS);
+                    af_logger_println_buffer(" seconds"));
+        STATS_ADD(af_lib, set_response_timeouts, 1);
 
         // We've detected a possible error in the MCU code and to keep us from doing nothing forever we'll respond on the MCU's behalf and also tell them that this situation occurred
         af_lib->event_handler(AF_LIB_EVENT_MCU_SET_REQUEST_RESPONSE_TIMEOUT, AF_ERROR_TIMEOUT, af_command_get_attr_id(af_lib->read_cmd), af_command_get_value_len(af_lib->read_cmd), af_command_get_value_pointer(af_lib->read_cmd));
@@ -910,14 +1927,15 @@ static void af_lib_on_state_waiting_for_set_response(af_lib_t *af_lib) {
  *      2. When an attribute operation is pulled out of the queue and executed.
  */
 static void af_lib_run_state_machine(af_lib_t *af_lib) {
+    int from = af_lib->state;
+
     if (af_lib->interrupts_pending > 0) {
-#if (defined(DEBUG_TRANSPORT) && DEBUG_TRANSPORT > 0)
-        af_logger_print_buffer("interrupts_pending: "); af_logger_print_value(af_lib->interrupts_pending); af_logger_print_buffer(" state: "); af_logger_println_value(af_lib->state);
-#endif
+        AF_LOG_TRACE(af_logger_print_buffer("interrupts_pending: "); af_logger_print_value(af_lib->interrupts_pending); af_logger_print_buffer(" state: "); af_logger_println_value(af_lib->state));
 
         switch (af_lib->state) {
             case STATE_IDLE:
                 af_lib_on_state_idle(af_lib);
+                TRACE_STATE_CHANGE(af_lib, from);
                 return;
 
             case STATE_STATUS_SYNC:
@@ -948,18 +1966,21 @@ static void af_lib_run_state_machine(af_lib_t *af_lib) {
         af_lib_update_ints_pending(af_lib, -1);
     } else {
         if (sync_retries > 0 && sync_retries < MAX_SYNC_RETRIES && af_utils_millis() - last_sync > 1000) {
-            af_logger_println_buffer("Sync Retry");
+            AF_LOG_WARN(af_logger_println_buffer("Sync Retry"));
             af_lib_update_ints_pending(af_lib, 1);
         } else if (sync_retries >= MAX_SYNC_RETRIES) {
-            af_logger_println_buffer("No response from ASR - does profile have MCU enabled?");
+            AF_LOG_ERROR(af_logger_println_buffer("No response from ASR - does profile have MCU enabled?"));
             sync_retries = 0;
+            af_lib_on_link_errors(af_lib, true);
             af_lib->state = STATE_IDLE;
+            STATS_ADD(af_lib, communication_breakdowns, 1);
             if (af_lib->event_handler != NULL) {
                 af_lib->event_handler(AF_LIB_EVENT_COMMUNICATION_BREAKDOWN, AF_ERROR_UNKNOWN, 0, 0, NULL);
 
             }
         }
     }
+    TRACE_STATE_CHANGE(af_lib, from);
 }
 
 static uint8_t af_lib_set_reason_converter(af_lib_t *af_lib, af_lib_set_reason_t reason) {
@@ -977,35 +1998,109 @@ static uint8_t af_lib_set_reason_converter(af_lib_t *af_lib, af_lib_set_reason_t
  *                              Public Methods                              *
  ****************************************************************************/
 
-af_lib_t* af_lib_create(attr_set_handler_t attr_set, attr_notify_handler_t attr_notify, af_transport_t *the_transport) {
-    af_lib_t *af_lib = (af_lib_t*)malloc(sizeof(af_lib_t));
+/**
+ * af_lib_alloc_instance
+ *
+ * Allocate and initialize everything an af_lib_t needs except the application callbacks. Without an allocator the
+ * instance takes a copy of the default one, so changing the default later doesn't affect it.
+ */
+static af_lib_t *af_lib_alloc_instance(af_transport_t *the_transport, const af_lib_allocator_t *allocator) {
+    af_lib_allocator_t instance_allocator;
+    af_lib_t *af_lib;
+
+    if (allocator != NULL) {
+        instance_allocator = *allocator;
+    } else {
+        af_allocator_get(&instance_allocator);
+    }
+
+    if (s_instance != NULL) {
+        AF_LOG_ERROR(af_logger_println_buffer("af_lib_create: an afLib instance already exists"));
+        return NULL;
+    }
+
+#ifdef AF_LIB_NO_HEAP
+    af_lib = &s_instance_storage;
+#else
+    af_lib = (af_lib_t*)af_allocator_alloc_with(&instance_allocator, sizeof(af_lib_t));
+#endif
+    if (NULL == af_lib) {
+        return NULL;
+    }
     memset(af_lib, 0, sizeof(af_lib_t));
+    af_lib->allocator = instance_allocator;
+    s_instance = af_lib;
+
+    // Nothing carries over from an instance that was destroyed
+    last_sync = 0;
+    sync_retries = 0;
+    last_complete = 0;
+    s_asr_version = 0;
+    s_asr_states = 0;
 
     queue_init(af_lib);
     af_lib->the_transport = the_transport;
-    af_lib->request.value = NULL;
+    af_lib->write_request = NULL;
 
+    AF_EVENT_RING_INIT(&af_lib->isr_events);
+    af_lib->isr_events_dropped = 0;
     af_lib->interrupts_pending = 0;
     af_lib->state = STATE_IDLE;
 
     af_status_command_initialize(&af_lib->tx_status);
     af_status_command_initialize(&af_lib->rx_status);
 
-    af_lib->attr_set_handler = attr_set;
-    af_lib->attr_notify_handler = attr_notify;
     af_lib->asr_capability = NULL;
     af_lib->asr_capability_length = 0;
     af_lib->asr_rebooting = true;
     af_lib->asr_protocol_version = 1; // Till we know otherwise...
 
+    af_lib->link_negotiation = LINK_NEGOTIATION_NONE;
+    af_lib->uart_rate_limit = UART_BAUD_RATE_COUNT - 1;
+    af_lib->spi_clock_rate_limit = UINT32_MAX;
+
+    return af_lib;
+}
+
+af_lib_t* af_lib_create(attr_set_handler_t attr_set, attr_notify_handler_t attr_notify, af_transport_t *the_transport) {
+    af_lib_t *af_lib = af_lib_alloc_instance(the_transport, NULL);
+    if (NULL == af_lib) {
+        return NULL;
+    }
+
+    af_lib->attr_set_handler = attr_set;
+    af_lib->attr_notify_handler = attr_notify;
+
     return af_lib;
 }
 
 void af_lib_destroy(af_lib_t* af_lib) {
+    request_t *request;
+    int lane;
+
     af_status_command_cleanup(&af_lib->tx_status);
     af_status_command_cleanup(&af_lib->rx_status);
-    free(af_lib->asr_capability);
-    free(af_lib);
+    if (af_lib->write_request != NULL) {
+        queue_release(af_lib, af_lib->write_request);
+    }
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+    while (af_lib->batch_count > 0) {
+        queue_release(af_lib, af_lib->batch_requests[--af_lib->batch_count]);
+    }
+#endif
+    af_lib_release_read_cmd(af_lib);
+    // Anything still queued goes too, its value may have come from this instance's allocator
+    for (lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+        while ((request = (request_t *)AF_QUEUE_GET_FROM_INTERRUPT(s_lanes[lane])) != NULL) {
+            queue_release(af_lib, request);
+        }
+    }
+    s_instance = NULL;
+#ifndef AF_LIB_NO_HEAP
+    // The allocator lives in the instance being freed
+    af_lib_allocator_t allocator = af_lib->allocator;
+    af_allocator_free_with(&allocator, af_lib);
+#endif
 }
 
 /**
@@ -1013,38 +2108,82 @@ void af_lib_destroy(af_lib_t* af_lib) {
  *
  * This is how the afLib gets time to run its state machine. This method should be called periodically.
  * This function pulls pending attribute operations from the queue. It takes approximately 4 calls to loop() to
- * complete one attribute operation.
+ * complete one attribute operation, af_lib_loop_for() does it in one.
  */
 void af_lib_loop(af_lib_t *af_lib) {
+    request_t *request;
+    int interrupts;
+
     // For UART, we need to look for a magic character on the line as our interrupt.
     // We call this method to handle that. For other interfaces, the interrupt pin is used and this method does nothing.
+    af_lib_drain_isr_events(af_lib);
+    interrupts = af_lib->interrupts_pending;
     af_transport_check_for_interrupt(af_lib->the_transport, &af_lib->interrupts_pending, af_lib_is_idle(af_lib));
+    if (af_lib->interrupts_pending > interrupts) {
+        TRACE(af_lib, AF_TRACE_EVENT_INTERRUPT, 0, af_lib->interrupts_pending - interrupts);
+    }
+
+    // Keep sending while there's room in the in flight window
+    if (af_lib_is_ready(af_lib, AF_LIB_IN_FLIGHT_WINDOW) && (queue_get(af_lib, &request) == AF_SUCCESS)) {
+        int result = AF_ERROR_INVALID_COMMAND;
 
-    if (af_lib_is_idle(af_lib) && (queue_get(af_lib, &af_lib->request.message_type, &af_lib->request.request_id, &af_lib->request.attr_id, &af_lib->request.value_len,
-                              &af_lib->request.value, &af_lib->request.status, &af_lib->request.reason) == AF_SUCCESS)) {
-        switch (af_lib->request.message_type) {
+        switch (request->message_type) {
             case MSG_TYPE_GET:
-                af_lib_do_get_attribute(af_lib, af_lib->request.request_id, af_lib->request.attr_id);
+                result = af_lib_do_get_attribute(af_lib, request);
                 break;
 
             case MSG_TYPE_SET:
-                af_lib_do_set_attribute(af_lib, af_lib->request.request_id, af_lib->request.attr_id, af_lib->request.value_len, af_lib->request.value);
+                result = af_lib_do_set_attribute(af_lib, request);
                 break;
 
             case MSG_TYPE_UPDATE:
-                af_lib_do_update_attribute(af_lib, af_lib->request.request_id, af_lib->request.attr_id, af_lib->request.value_len, af_lib->request.value, af_lib->request.status, af_lib->request.reason);
+                result = af_lib_do_update_attribute(af_lib, request);
                 break;
 
             default:
-                af_logger_println_buffer("loop: INVALID request type!");
+                AF_LOG_ERROR(af_logger_println_buffer("loop: INVALID request type!"));
         }
-    }
 
-    if (af_lib->request.value != NULL) {
-        free(af_lib->request.value);
-        af_lib->request.value = NULL;
+        // On success the request is released once its command completes
+        if (result != AF_SUCCESS) {
+            queue_release(af_lib, request);
+        }
     }
+
     af_lib_run_state_machine(af_lib);
+
+#ifdef AF_LOGGER_HAS_POLL
+    // Anything logged along the way goes out as the log's port has room for it
+    af_logger_poll();
+#endif
+}
+
+/**
+ * af_lib_has_work
+ *
+ * True if another pass through af_lib_loop would get something done right now rather than wait on the ASR.
+ */
+static bool af_lib_has_work(af_lib_t *af_lib) {
+    af_lib_drain_isr_events(af_lib);
+    if (af_lib->interrupts_pending > 0 || af_transport_has_work(af_lib->the_transport)) {
+        return true;
+    }
+    if (af_lib->asr_rebooting || !af_lib_is_ready(af_lib, AF_LIB_IN_FLIGHT_WINDOW)) {
+        return false;
+    }
+    return queue_peek(af_lib) != NULL;
+}
+
+uint32_t af_lib_loop_for(af_lib_t *af_lib, uint32_t budget_us) {
+    uint32_t start = af_utils_micros();
+    uint32_t used;
+
+    do {
+        af_lib_loop(af_lib);
+        used = af_utils_micros() - start;
+    } while (used < budget_us && af_lib_has_work(af_lib));
+
+    return used;
 }
 
 /**
@@ -1113,19 +2252,7 @@ af_lib_error_t af_lib_set_attribute_bytes(af_lib_t *af_lib, const uint16_t attr_
  * Provide a way to know if we're idle. Returns true if there are no attribute operations in progress.
  */
 bool af_lib_is_idle(af_lib_t *af_lib) {
-    if (last_complete != 0 && (af_utils_millis() - last_complete) < MIN_TIME_BETWEEN_UPDATES_MILLIS) {
-        return false;
-    }
-    // See if we've waited long enough for the last command to complete
-    if (af_lib->outstanding_set_get_attr_id != 0 && af_utils_millis() - af_lib->last_command_send_time > MAX_COMMAND_RESULT_TIME_MILLIS) {
-        af_logger_print_buffer("af_lib(): last attr command ");
-        af_logger_print_value(af_lib->outstanding_set_get_attr_id);
-        af_logger_println_buffer(" took too long to complete, moving on...");
-        af_lib->outstanding_set_get_attr_id = 0;
-    }
-
-    last_complete = 0;
-    return 0 == af_lib->interrupts_pending && STATE_IDLE == af_lib->state && 0 == af_lib->outstanding_set_get_attr_id;
+    return af_lib_is_ready(af_lib, 1);
 }
 
 void af_lib_sync(af_lib_t *af_lib) {
@@ -1134,11 +2261,13 @@ void af_lib_sync(af_lib_t *af_lib) {
     }
 }
 
+// Nothing here logs, the logger's buffer is only ever written and emptied from the loop
 void af_lib_mcu_isr(af_lib_t *af_lib) {
-#if (defined(DEBUG_TRANSPORT) && DEBUG_TRANSPORT > 0)
-    af_logger_println_buffer("mcuISR");
-#endif
-    af_lib_update_ints_pending(af_lib, 1);
+    af_lib_post_isr_event(af_lib, AF_LIB_ISR_EVENT_ASR_INTERRUPT);
+}
+
+void af_lib_post_isr_event(af_lib_t *af_lib, af_lib_isr_event_t event) {
+    AF_EVENT_RING_PUT(&af_lib->isr_events, (uint8_t)event);
 }
 
 af_lib_error_t af_lib_asr_has_capability(af_lib_t *af_lib, uint32_t af_asr_capability) {
@@ -1154,7 +2283,7 @@ af_lib_error_t af_lib_asr_has_capability(af_lib_t *af_lib, uint32_t af_asr_capab
         return AF_ERROR_BUSY;
     }
 
-    if (byte_index > af_lib->asr_capability_length) {
+    if (byte_index >= af_lib->asr_capability_length) {
         return AF_ERROR_NOT_SUPPORTED;
     }
 
@@ -1163,24 +2292,16 @@ af_lib_error_t af_lib_asr_has_capability(af_lib_t *af_lib, uint32_t af_asr_capab
 }
 
 af_lib_t *af_lib_create_with_unified_callback(af_lib_event_callback_t event_cb, af_transport_t *transport) {
-    af_lib_t *af_lib = (af_lib_t*)malloc(sizeof(af_lib_t));
-    memset(af_lib, 0, sizeof(af_lib_t));
-
-    queue_init(af_lib);
-    af_lib->the_transport = transport;
-    af_lib->request.value = NULL;
-
-    af_lib->interrupts_pending = 0;
-    af_lib->state = STATE_IDLE;
+    return af_lib_create_with_allocator(event_cb, transport, NULL);
+}
 
-    af_status_command_initialize(&af_lib->tx_status);
-    af_status_command_initialize(&af_lib->rx_status);
+af_lib_t *af_lib_create_with_allocator(af_lib_event_callback_t event_cb, af_transport_t *transport, const af_lib_allocator_t *allocator) {
+    af_lib_t *af_lib = af_lib_alloc_instance(transport, allocator);
+    if (NULL == af_lib) {
+        return NULL;
+    }
 
     af_lib->event_handler = event_cb;
-    af_lib->asr_capability = NULL;
-    af_lib->asr_capability_length = 0;
-    af_lib->asr_rebooting = true;
-    af_lib->asr_protocol_version = 1; // Till we know otherwise...
 
     return af_lib;
 }
@@ -1203,24 +2324,93 @@ af_lib_error_t af_lib_send_set_response(af_lib_t *af_lib, const uint16_t attribu
     }
     result = af_lib_set_attribute_complete(af_lib, af_command_get_req_id(af_lib->read_cmd), af_command_get_attr_id(af_lib->read_cmd), value_len, value, state, reason);
     if (result != AF_SUCCESS) {
-        af_logger_print_buffer("Can't reply to SET in send_set_response! This is FATAL! rc=");
-        af_logger_println_value(result);
+        AF_LOG_ERROR(af_logger_print_buffer("Can't reply to SET in send_set_response! This is FATAL! rc=");
+                     af_logger_println_value(result));
         return result;
     }
 
-    af_command_cleanup(af_lib->read_cmd);
-    free(af_lib->read_cmd);
-    af_lib->read_cmd_offset = 0;
-    af_lib->read_cmd = NULL;
+    af_lib_release_read_cmd(af_lib);
 
     af_lib->state = STATE_IDLE;
 
     return result;
 }
 
+void af_lib_set_coalescing(af_lib_t *af_lib, bool enable) {
+    af_lib->coalesce = enable;
+}
+
+uint16_t af_lib_get_coalesced_count(af_lib_t *af_lib, const uint16_t attribute_id) {
+    int i;
+
+    for (i = 0; i < AF_LIB_COALESCE_COUNTERS; i++) {
+        if (af_lib->coalesced[i].attr_id == attribute_id) {
+            return af_lib->coalesced[i].count;
+        }
+    }
+
+    return 0;
+}
+
+af_lib_error_t af_lib_get_stats(af_lib_t *af_lib, af_lib_stats_t *stats) {
+#if AF_LIB_STATS
+    memcpy(stats, &af_lib->stats, sizeof(af_lib_stats_t));
+    return AF_SUCCESS;
+#else
+    return AF_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+size_t af_lib_get_trace(af_lib_t *af_lib, uint8_t *bytes, size_t len) {
+#if AF_LIB_TRACE_SIZE > 0
+    uint32_t count = af_lib->trace_count < AF_LIB_TRACE_SIZE ? af_lib->trace_count : AF_LIB_TRACE_SIZE;
+    uint32_t i;
+
+    if (count > len / AF_TRACE_RECORD_SIZE) {
+        count = len / AF_TRACE_RECORD_SIZE;
+    }
+    for (i = 0; i < count; i++) {
+        trace_serialize(&af_lib->trace[(af_lib->trace_count - count + i) & (AF_LIB_TRACE_SIZE - 1)], &bytes[i * AF_TRACE_RECORD_SIZE]);
+    }
+    return count * AF_TRACE_RECORD_SIZE;
+#else
+    return 0;
+#endif
+}
+
+void af_lib_dump_trace(af_lib_t *af_lib) {
+#if AF_LIB_TRACE_SIZE > 0
+    static const char hex[] = "0123456789ABCDEF";
+    char line[sizeof(AF_TRACE_LOG_PREFIX) + 2 * AF_TRACE_RECORD_SIZE];
+    uint8_t bytes[AF_TRACE_RECORD_SIZE];
+    uint32_t count = af_lib->trace_count < AF_LIB_TRACE_SIZE ? af_lib->trace_count : AF_LIB_TRACE_SIZE;
+    uint32_t i;
+    char *out;
+    uint8_t j;
+
+    // One record a line, copied out first as they'd otherwise change under us while the line is logged
+    memcpy(line, AF_TRACE_LOG_PREFIX, sizeof(AF_TRACE_LOG_PREFIX) - 1);
+    for (i = af_lib->trace_count - count; i != af_lib->trace_count; i++) {
+        trace_serialize(&af_lib->trace[i & (AF_LIB_TRACE_SIZE - 1)], bytes);
+        out = &line[sizeof(AF_TRACE_LOG_PREFIX) - 1];
+        for (j = 0; j < AF_TRACE_RECORD_SIZE; j++) {
+            *out++ = hex[bytes[j] >> 4];
+            *out++ = hex[bytes[j] & 0x0F];
+        }
+        *out = 0;
+        af_logger_println_buffer(line);
+    }
+#endif
+}
+
 void af_lib_dump_queue() {
-    queue_t *p_q = (queue_t *)&s_request_queue;
-    af_queue_dump(p_q, dump_queue_element);
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+    int lane;
+
+    for (lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+        af_queue_dump((queue_t *)s_lanes[lane], dump_queue_element);
+    }
+#endif
 }
 
 
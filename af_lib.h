@@ -24,6 +24,7 @@
 #ifndef AF_LIB_H
 #define AF_LIB_H
 
+#include <stddef.h>
 #include "af_transport.h"
 
 #ifdef  __cplusplus
@@ -57,6 +58,150 @@ typedef enum {
 #define AF_LIB_REQUEST_QUEUE_SIZE                  10
 #endif
 
+/* Requests are queued in priority lanes that are always drained highest priority first: afLib's own control
+ * traffic, then replies to server sets, then gets and non-MCU sets, then MCU attribute updates. Each of the first
+ * three lanes has these slots to itself and borrows from the shared ones when they run out, so a flood of updates can
+ * never hold up a set response. The reserved slots are taken out of AF_LIB_REQUEST_QUEUE_SIZE, which must leave at
+ * least one shared slot.
+ */
+#ifndef AF_LIB_CONTROL_QUEUE_SIZE
+#define AF_LIB_CONTROL_QUEUE_SIZE                  2
+#endif
+
+#ifndef AF_LIB_SET_RESPONSE_QUEUE_SIZE
+#define AF_LIB_SET_RESPONSE_QUEUE_SIZE             1
+#endif
+
+#ifndef AF_LIB_INTERACTIVE_QUEUE_SIZE
+#define AF_LIB_INTERACTIVE_QUEUE_SIZE              1
+#endif
+
+/* Values up to this size are stored directly in the request queue slot. The default covers every
+ * af_lib_set_attribute_* call except str and bytes.
+ */
+#ifndef AF_LIB_REQUEST_INLINE_VALUE_SIZE
+#define AF_LIB_REQUEST_INLINE_VALUE_SIZE           8
+#endif
+
+/* Longer values are taken from a small pool of fixed size buffers shared by all queued requests.
+ * Values that don't fit in a pool buffer, or arrive when the pool is empty, are allocated from the heap.
+ * AF_LIB_REQUEST_OVERFLOW_POOL_SIZE must be at least 1.
+ */
+#ifndef AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE
+#define AF_LIB_REQUEST_OVERFLOW_VALUE_SIZE         64
+#endif
+
+#ifndef AF_LIB_REQUEST_OVERFLOW_POOL_SIZE
+#define AF_LIB_REQUEST_OVERFLOW_POOL_SIZE          2
+#endif
+
+/* The largest attribute value the ASR will send us */
+#ifndef AF_LIB_MAX_ATTRIBUTE_SIZE
+#define AF_LIB_MAX_ATTRIBUTE_SIZE                  255
+#endif
+
+/* Each afLib instance receives into a buffer of this size and hands event callbacks a pointer into it.
+ * Frames that don't fit are allocated from the heap. Set to 0 to allocate every received frame from the heap instead.
+ * The default fits the largest attribute plus the frame length and command header, except on AVR where it only fits
+ * values up to 22 bytes so a 2KB part doesn't have to keep 265 bytes aside. Raise it there if large values arrive
+ * often or the build has no heap.
+ */
+#ifndef AF_LIB_RECEIVE_BUFFER_SIZE
+#ifdef __AVR__
+#define AF_LIB_RECEIVE_BUFFER_SIZE                 32
+#else
+#define AF_LIB_RECEIVE_BUFFER_SIZE                 (AF_LIB_MAX_ATTRIBUTE_SIZE + 10)
+#endif
+#endif
+
+/* Number of gets and non-MCU sets that can be waiting on their response from the ASR at once. Responses are matched
+ * back to their request by request id. With the default of 1 each one waits for the previous one's round trip.
+ */
+#ifndef AF_LIB_IN_FLIGHT_WINDOW
+#define AF_LIB_IN_FLIGHT_WINDOW                    1
+#endif
+
+/* When the ASR supports it, consecutive MCU attribute updates are packed into one transfer of up to this many bytes
+ * so they share a single sync handshake. Each update takes its value length plus 10 bytes. Leave at 0 to always send
+ * one update per transfer. No ASR firmware defines the batched frames capability bits yet, only the simulator in
+ * extras/asr_sim, so only turn this on against an ASR known to take batched transfers.
+ */
+#ifndef AF_LIB_BATCH_BUFFER_SIZE
+#define AF_LIB_BATCH_BUFFER_SIZE                   0
+#endif
+
+/* Most updates packed into one batched transfer */
+#ifndef AF_LIB_MAX_BATCH
+#define AF_LIB_MAX_BATCH                           8
+#endif
+
+/* Number of attributes af_lib_get_coalesced_count() keeps a count for */
+#ifndef AF_LIB_COALESCE_COUNTERS
+#define AF_LIB_COALESCE_COUNTERS                   4
+#endif
+
+/* Set this to have afLib move a UART link, once the ASR has booted, to the highest baud rate both sides support up to
+ * this one, by writing the MCU UART Config attribute (65000). Leave at 0 to stay at the rate the transport was created
+ * with. Only turn it on with ASR firmware that applies a write of 65000 straight away and goes back to the profile's
+ * rate when it reboots, without keeping the new rate. Even then, an MCU that resets on its own comes back at the
+ * creation rate while the ASR stays at the negotiated one, so the application has to reset the ASR along with the MCU.
+ */
+#ifndef AF_LIB_UART_MAX_BAUD_RATE
+#define AF_LIB_UART_MAX_BAUD_RATE                  0
+#endif
+
+/* Set this to have afLib raise the SPI clock, up to this one, and the frame length by writing the MCU SPI Config
+ * attribute (65069) once the ASR has booted, then reclock the bus to match. Leave at 0 to keep the settings the
+ * transport was created with. The attribute's layout, a 4 byte clock, a 2 byte frame length and 4 reserved bytes, is
+ * not confirmed against ASR firmware yet, and a wrong guess would leave the two ends of the bus out of step, so only
+ * turn this on against an ASR known to use that layout.
+ */
+#ifndef AF_LIB_SPI_MAX_CLOCK_RATE
+#define AF_LIB_SPI_MAX_CLOCK_RATE                  0
+#endif
+
+/* Failed syncs in a row, bad checksums included, after which afLib slows a negotiated link down a step. If the link
+ * stops working altogether afLib goes back to the settings the transport was created with, which is what the ASR
+ * starts with after a reboot.
+ */
+#ifndef AF_LIB_LINK_ERROR_THRESHOLD
+#define AF_LIB_LINK_ERROR_THRESHOLD                3
+#endif
+
+/* Number of events interrupt handlers can post before af_lib_loop() picks them up, a power of two no larger than 128.
+ * Events that don't fit are still counted so the state machine is kicked for them.
+ */
+#ifndef AF_LIB_ISR_EVENT_RING_SIZE
+#define AF_LIB_ISR_EVENT_RING_SIZE                 8
+#endif
+
+/* Set to 1 to keep the counters and latency histograms behind af_lib_get_stats(). With the default number of buckets
+ * they take about 280 bytes of RAM per instance, plus 4 bytes in every request queue slot and in-flight slot, so
+ * they're left out unless asked for.
+ */
+#ifndef AF_LIB_STATS
+#define AF_LIB_STATS                               0
+#endif
+
+/* Buckets in each latency histogram. Bucket n counts latencies from 64 << n up to 128 << n microseconds, except that
+ * bucket 0 also takes everything shorter and the last bucket everything longer.
+ */
+#ifndef AF_LIB_STATS_BUCKETS
+#define AF_LIB_STATS_BUCKETS                       16
+#endif
+
+/* Records kept of what the state machine did and when, for af_lib_get_trace(). A power of two no larger than 32768,
+ * each one 12 bytes of RAM. Leave at 0 to build without tracing.
+ */
+#ifndef AF_LIB_TRACE_SIZE
+#define AF_LIB_TRACE_SIZE                          0
+#endif
+
+/* Define AF_LIB_NO_HEAP to build afLib without malloc()/free(). The instance is then static, and frames too large for
+ * the receive buffer or the overflow pool are dropped unless an allocator is supplied with
+ * af_lib_create_with_allocator().
+ */
+
 /*
  * Modify this time to be large enough to handle the maximum time that should be given to a MCU set request from the server.
  * After this time has elapsed a AF_LIB_EVENT_MCU_SET_REQUEST_RESPONSE_TIMEOUT event will be triggered.
@@ -73,13 +218,13 @@ typedef struct af_lib_t af_lib_t;
 /**
  * af_lib_create
  *
- * Create an instance of the afLib object.
+ * Create an instance of the afLib object. There can only be one at a time, destroy it before creating another.
  *
  * @param   attr_set         Callback for notification of attribute set requests from the server
  * @param   attr_notify      Callback for notification of unsolicited attribute update request completion
  * @param   the_transport    An instance of an af_transport_t object to be used for communications with the ASR
  *
- * @return  af_lib_t *        Instance of af_lib_t
+ * @return  af_lib_t *        Instance of af_lib_t, NULL if there's one already
  */
 af_lib_t* af_lib_create(attr_set_handler_t attr_set, attr_notify_handler_t attr_notify, af_transport_t *the_transport);
 
@@ -99,6 +244,21 @@ void af_lib_destroy(af_lib_t* af_lib);
  */
 void af_lib_loop(af_lib_t *af_lib);
 
+/**
+ * af_lib_loop_for
+ *
+ * Like af_lib_loop() but keeps running the state machine, and starting queued requests, until either the time budget
+ * is used up or afLib has to wait on the ASR. One call can take a request from the queue all the way through to
+ * completion instead of it taking several calls to af_lib_loop(). The budget is checked between steps so a step that
+ * has already started is allowed to finish.
+ *
+ * @param af_lib    - an instance of af_lib_t
+ * @param budget_us - the most time, in microseconds, to spend before returning
+ *
+ * @return how many microseconds were actually spent
+ */
+uint32_t af_lib_loop_for(af_lib_t *af_lib, uint32_t budget_us);
+
 /**
  * af_lib_get_attribute
  *
@@ -162,6 +322,24 @@ void af_lib_sync(af_lib_t *af_lib);
  */
 void af_lib_mcu_isr(af_lib_t *af_lib);
 
+/* UART transports spot the ASR's interrupt character from the loop in check_for_interrupt, so only the interrupt line
+ * of an SPI ASR is posted from interrupt context.
+ */
+typedef enum {
+    AF_LIB_ISR_EVENT_ASR_INTERRUPT = 1,     // The ASR asserted its interrupt line
+} af_lib_isr_event_t;
+
+/**
+ * af_lib_post_isr_event
+ *
+ * Hand an event from interrupt context to afLib, it's acted on by the next call to af_lib_loop(). This never blocks
+ * and never disables interrupts. Only one interrupt handler at a time may post to a given afLib instance.
+ *
+ * @param af_lib    - an instance of af_lib_t
+ * @param event     - what happened
+ */
+void af_lib_post_isr_event(af_lib_t *af_lib, af_lib_isr_event_t event);
+
 /**
  * ASR exposes its capabilities via the AF_ATTRIBUTE_ID_ASR_CAPABILITIES attribute - which is internally cached by afLib.
  */
@@ -170,6 +348,11 @@ void af_lib_mcu_isr(af_lib_t *af_lib);
 /* ASR supports MCU OTA functionality */
 #define AF_ASR_CAPABILITY_MCU_OTA                       0
 
+/* ASR accepts several commands, each preceded by its length, in a single transfer. Provisional, the ASR side doesn't
+ * define this bit yet, see AF_LIB_BATCH_BUFFER_SIZE.
+ */
+#define AF_ASR_CAPABILITY_BATCHED_FRAMES                1
+
 /**
  * af_lib_asr_has_capability
  *
@@ -202,6 +385,7 @@ typedef enum {
     AF_LIB_EVENT_COMMUNICATION_BREAKDOWN,  // The communication between the MCU and the ASR seems to have stopped, take the appropriate action (ie. rebooting the ASR)
 } af_lib_event_type_t;
 
+/* The value pointer passed to callbacks is only valid until the callback returns, copy it if you need it later */
 typedef void (*af_lib_event_callback_t)(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value);
 
 /**
@@ -210,10 +394,32 @@ typedef void (*af_lib_event_callback_t)(const af_lib_event_type_t event_type, co
  * @param   event_cb    Callback for event notifications
  * @param   transport   An instance of an af_transport_t object to be used for communications with ASR
  *
- * @return  af_lib_t *        Instance of af_lib_t
+ * @return  af_lib_t *        Instance of af_lib_t, NULL if there's one already
  */
 af_lib_t *af_lib_create_with_unified_callback(af_lib_event_callback_t event_cb, af_transport_t *transport);
 
+/* Where afLib gets memory it can't take from its static pools. free() is called with pointers returned by alloc(). */
+typedef struct {
+    void *(*alloc)(void *context, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+} af_lib_allocator_t;
+
+/**
+ * af_lib_create_with_allocator
+ *
+ * Same as af_lib_create_with_unified_callback() but the instance allocates through the given allocator instead of
+ * malloc()/free(). The allocator is copied and used for the instance itself and everything it allocates. Its context
+ * must stay valid until the instance has been destroyed.
+ *
+ * @param   event_cb    Callback for event notifications
+ * @param   transport   An instance of an af_transport_t object to be used for communications with ASR
+ * @param   allocator   The allocator to use, NULL for the default
+ *
+ * @return  af_lib_t *        Instance of af_lib_t, NULL if there was no memory for it or there's one already
+ */
+af_lib_t *af_lib_create_with_allocator(af_lib_event_callback_t event_cb, af_transport_t *transport, const af_lib_allocator_t *allocator);
+
 /**
  * af_lib_send_set_response
  *
@@ -231,10 +437,105 @@ af_lib_t *af_lib_create_with_unified_callback(af_lib_event_callback_t event_cb,
  */
 af_lib_error_t af_lib_send_set_response(af_lib_t *af_lib, const uint16_t attribute_id, bool set_succeeded, const uint16_t value_len, const uint8_t *value);
 
+/**
+ * af_lib_set_coalescing
+ *
+ * With coalescing on, setting an attribute that already has an update or set waiting in the queue replaces the queued
+ * value in place instead of queuing another request, so only the latest value goes out and the queue doesn't fill up
+ * with stale ones. Off by default. Replies to server sets are never coalesced.
+ *
+ * @param af_lib    - an instance of af_lib_t
+ * @param enable    - whether or not to coalesce
+ */
+void af_lib_set_coalescing(af_lib_t *af_lib, bool enable);
+
+/**
+ * af_lib_get_coalesced_count
+ *
+ * How many values for an attribute were replaced by a newer one before they were sent. Counts are kept for the first
+ * AF_LIB_COALESCE_COUNTERS attributes that get coalesced, any others always read 0.
+ *
+ * @param af_lib        - an instance of af_lib_t
+ * @param attribute_id  - the attribute to get the count for
+ *
+ * @return the number of values dropped in favour of a newer one
+ */
+uint16_t af_lib_get_coalesced_count(af_lib_t *af_lib, const uint16_t attribute_id);
+
+// Message types counted separately in af_lib_stats_t, anything else is counted as AF_LIB_STATS_MSG_OTHER
+typedef enum {
+    AF_LIB_STATS_MSG_SET,
+    AF_LIB_STATS_MSG_GET,
+    AF_LIB_STATS_MSG_UPDATE,
+    AF_LIB_STATS_MSG_UPDATE_REJECTED,
+    AF_LIB_STATS_MSG_SET_DEFAULT,
+    AF_LIB_STATS_MSG_OTHER,
+    AF_LIB_STATS_MSG_COUNT
+} af_lib_stats_msg_t;
+
+typedef struct {
+    uint32_t buckets[AF_LIB_STATS_BUCKETS];     // See AF_LIB_STATS_BUCKETS for the range each one covers
+} af_lib_histogram_t;
+
+typedef struct {
+    uint32_t syncs;                             // Sync exchanges with the ASR, successful or not
+    uint32_t sync_retries;                      // Syncs that had to be sent again
+    uint32_t checksum_failures;                 // Status replies from the ASR with a bad checksum
+    uint32_t collisions;                        // Syncs where the ASR had something to send at the same time
+    uint32_t bytes_tx;                          // Command bytes sent to the ASR, statuses not included
+    uint32_t bytes_rx;                          // Command bytes received from the ASR
+    uint32_t messages_tx[AF_LIB_STATS_MSG_COUNT];
+    uint32_t messages_rx[AF_LIB_STATS_MSG_COUNT];
+    uint32_t queue_overflows;                   // Requests refused because the queue was full
+    uint32_t set_response_timeouts;             // ASR sets that af_lib_send_set_response() wasn't called for in time
+    uint32_t communication_breakdowns;
+    af_lib_histogram_t queue_latency;           // From a request being queued to it having been sent
+    af_lib_histogram_t response_latency;        // From a get or non-MCU set being sent to the ASR responding
+    af_lib_histogram_t callback_latency;        // From the interrupt starting a transfer from the ASR to its callback
+} af_lib_stats_t;
+
+/**
+ * af_lib_get_stats
+ *
+ * Copy out the counters and latency histograms afLib has kept since the instance was created. All of them only ever
+ * go up, so compare two copies to see what happened in between.
+ *
+ * @param af_lib    - an instance of af_lib_t
+ * @param stats     - filled in with the statistics
+ *
+ * @return AF_SUCCESS               - stats has been filled in
+ * @return AF_ERROR_NOT_SUPPORTED   - afLib was built with AF_LIB_STATS set to 0
+ */
+af_lib_error_t af_lib_get_stats(af_lib_t *af_lib, af_lib_stats_t *stats);
+
+/**
+ * af_lib_get_trace
+ *
+ * Copy out the trace records afLib has kept, oldest first, AF_TRACE_RECORD_SIZE bytes each in the layout af_trace.h
+ * describes. Only whole records are copied, and the newest ones if they don't all fit. Nothing is cleared, so two
+ * copies can overlap.
+ *
+ * @param af_lib    - an instance of af_lib_t
+ * @param bytes     - where to put the records
+ * @param len       - room in bytes
+ *
+ * @return the number of bytes copied, 0 if afLib was built with AF_LIB_TRACE_SIZE set to 0
+ */
+size_t af_lib_get_trace(af_lib_t *af_lib, uint8_t *bytes, size_t len);
+
+/**
+ * af_lib_dump_trace
+ *
+ * Log the trace records as lines of hex, each starting with AF_TRACE_LOG_PREFIX, for extras/trace to turn into a
+ * timeline. Logging is slow, so do it once whatever is being looked at is over.
+ */
+void af_lib_dump_trace(af_lib_t *af_lib);
+
 /**
  * af_lib_dump_queue
  *
- * Dump (ie. log) the afLib request queue state (contents and other relevant information)
+ * Dump (ie. log) the afLib request queue state (contents and other relevant information). Nothing is logged unless
+ * AF_LOG_LEVEL is AF_LOG_LEVEL_DEBUG or higher.
  */
 void af_lib_dump_queue();
 
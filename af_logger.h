@@ -22,6 +22,63 @@
 extern "C" {
 #endif
 
+// Levels for AF_LOG_LEVEL, each one logging everything the ones before it do
+#define AF_LOG_LEVEL_NONE                   0
+#define AF_LOG_LEVEL_ERROR                  1   // Things afLib couldn't do
+#define AF_LOG_LEVEL_WARN                   2   // Things that went wrong and were recovered from
+#define AF_LOG_LEVEL_INFO                   3   // Changes to the link and to the ASR's state
+#define AF_LOG_LEVEL_DEBUG                  4   // Output of the dump functions
+#define AF_LOG_LEVEL_TRACE                  5   // Every state change and interrupt
+
+/* How much afLib logs. Calls above this level compile to nothing, their strings included, so on small boards lower
+ * levels get back flash and (on AVR, where strings are copied to RAM) RAM. DEBUG_TRANSPORT is the old way of asking
+ * for AF_LOG_LEVEL_TRACE.
+ */
+#ifndef AF_LOG_LEVEL
+#if defined(DEBUG_TRANSPORT) && DEBUG_TRANSPORT > 0
+#define AF_LOG_LEVEL                        AF_LOG_LEVEL_TRACE
+#else
+#define AF_LOG_LEVEL                        AF_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+/**
+ * AF_LOG_ERROR, AF_LOG_WARN, AF_LOG_INFO, AF_LOG_DEBUG, AF_LOG_TRACE
+ *
+ * Make the af_logger calls given, separated by semicolons, only when AF_LOG_LEVEL includes the level:
+ *
+ *     AF_LOG_WARN(af_logger_print_buffer("Retrying attribute "); af_logger_println_value(attr_id));
+ */
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_ERROR
+#define AF_LOG_ERROR(...)                   do { __VA_ARGS__; } while (0)
+#else
+#define AF_LOG_ERROR(...)                   do { } while (0)
+#endif
+
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_WARN
+#define AF_LOG_WARN(...)                    do { __VA_ARGS__; } while (0)
+#else
+#define AF_LOG_WARN(...)                    do { } while (0)
+#endif
+
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_INFO
+#define AF_LOG_INFO(...)                    do { __VA_ARGS__; } while (0)
+#else
+#define AF_LOG_INFO(...)                    do { } while (0)
+#endif
+
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
+#define AF_LOG_DEBUG(...)                   do { __VA_ARGS__; } while (0)
+#else
+#define AF_LOG_DEBUG(...)                   do { } while (0)
+#endif
+
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_TRACE
+#define AF_LOG_TRACE(...)                   do { __VA_ARGS__; } while (0)
+#else
+#define AF_LOG_TRACE(...)                   do { } while (0)
+#endif
+
 typedef enum {
     AF_LOGGER_BIN = 2,
     AF_LOGGER_OCT = 8,
@@ -36,6 +93,21 @@ void af_logger_println_value(int32_t val);
 void af_logger_println_buffer(const char* val);
 void af_logger_println_formatted_value(int32_t val, af_logger_format_t format);
 
+/* Defined for loggers that buffer their output and provide af_logger_poll(), as the Arduino one does. Other ports that
+ * buffer define it for the build, ports that write straight through leave it and af_logger_poll() out.
+ */
+#if defined(ARDUINO) && !defined(AF_LOGGER_HAS_POLL)
+#define AF_LOGGER_HAS_POLL
+#endif
+
+/**
+ * af_logger_poll
+ *
+ * Give a logger that buffers its output the chance to write some of it out, without waiting on the output. afLib
+ * calls this from af_lib_loop() when AF_LOGGER_HAS_POLL is defined, never from an interrupt.
+ */
+void af_logger_poll(void);
+
 #ifdef __cplusplus
 } /* end of extern "C" */
 #endif
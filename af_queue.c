@@ -201,6 +201,52 @@ void *af_queue_peek_tail_from_interrupt(queue_t *p_q)
     return _af_queue_peek_tail(p_q, true);
 }
 
+static void *__af_queue_find(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context)
+{
+    af_queue_elem_desc_t *p_desc = p_q->p_head;
+
+    while (p_desc != NULL) {
+        if (p_match(p_desc->data, p_context)) {
+            return p_desc->data;
+        }
+        p_desc = p_desc->p_next_alloc;
+    }
+
+    return NULL;
+}
+
+static void *_af_queue_find(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context, bool interrupt_context)
+{
+    void *p_data;
+
+    if (!interrupt_context) {
+        uint8_t is_nested;
+
+        is_nested = m_p_preemption_disable();
+        {
+            p_data = __af_queue_find(p_q, p_match, p_context);
+        }
+        m_p_preemption_enable(is_nested);
+    } else {
+        p_data = __af_queue_find(p_q, p_match, p_context);
+    }
+
+    return p_data;
+}
+
+/*
+ * Return the oldest element in the queue that p_match accepts, or NULL. The element stays in the queue.
+ */
+void *af_queue_find(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context)
+{
+    return _af_queue_find(p_q, p_match, p_context, false);
+}
+
+void *af_queue_find_from_interrupt(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context)
+{
+    return _af_queue_find(p_q, p_match, p_context, true);
+}
+
 void af_queue_elem_free(queue_t *p_q, void *p_data)
 {
     _af_queue_elem_free(p_q, p_data, false);
@@ -226,15 +272,15 @@ void af_queue_init(queue_t *p_q, int elem_size, int max_elem, uint8_t *p_mem)
     p_q->num_available = max_elem;
 
     for (i = 0; i < max_elem - 1; ++i) {
-        offset = i * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), 4) + ALIGN_SIZE(elem_size, 4));
+        offset = i * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), AF_QUEUE_ALIGN) + ALIGN_SIZE(elem_size, AF_QUEUE_ALIGN));
         p_desc = (af_queue_elem_desc_t *)(p_mem + offset);
 
-        offset = (i + 1) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), 4) + ALIGN_SIZE(elem_size, 4));
+        offset = (i + 1) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), AF_QUEUE_ALIGN) + ALIGN_SIZE(elem_size, AF_QUEUE_ALIGN));
         p_desc_next = (af_queue_elem_desc_t *)(p_mem + offset);
         p_desc->p_next_free = p_desc_next;
     }
 
-    offset = (max_elem - 1) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), 4) + ALIGN_SIZE(elem_size, 4));
+    offset = (max_elem - 1) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), AF_QUEUE_ALIGN) + ALIGN_SIZE(elem_size, AF_QUEUE_ALIGN));
     p_desc = (af_queue_elem_desc_t *)(p_mem + offset);
     p_desc->p_next_free = NULL;
 }
@@ -9,6 +9,7 @@
 #define AF_QUEUE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef  __cplusplus
 extern "C" {
@@ -17,7 +18,10 @@ extern "C" {
 #define ALIGN_SIZE( sizeToAlign, PowerOfTwo ) \
         (((sizeToAlign) + (PowerOfTwo) - 1) & ~((PowerOfTwo) - 1))
 
-#define AF_QUEUE_DECLARE(q, elem_size, max_elem) queue_t volatile (q); uint8_t volatile (q##_mem)[(max_elem) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), 4) + ALIGN_SIZE((elem_size), 4))]
+// Elements start with pointers, so keep them pointer aligned on hosts with pointers wider than 4 bytes
+#define AF_QUEUE_ALIGN (sizeof(void *) > 4 ? sizeof(void *) : 4)
+
+#define AF_QUEUE_DECLARE(q, elem_size, max_elem) queue_t volatile (q); uint8_t volatile (q##_mem)[(max_elem) * (ALIGN_SIZE(sizeof(af_queue_elem_desc_t), AF_QUEUE_ALIGN) + ALIGN_SIZE((elem_size), AF_QUEUE_ALIGN))]
 #define AF_QUEUE_INIT(q, elem_size, max_elem) af_queue_init((queue_t *)&(q), elem_size, max_elem, (uint8_t *)(q##_mem))
 #define AF_QUEUE_GET(p_q) af_queue_get((queue_t *)(p_q))
 #define AF_QUEUE_GET_FROM_INTERRUPT(p_q) af_queue_get_from_interrupt((queue_t *)(p_q))
@@ -31,6 +35,8 @@ extern "C" {
 #define AF_QUEUE_PEEK_TAIL_FROM_INTERRUPT(p_q) af_queue_peek_tail_from_interrupt((queue_t *)(p_q))
 #define AF_QUEUE_PUT(p_q, p_data) af_queue_put((queue_t *)(p_q), p_data)
 #define AF_QUEUE_PUT_FROM_INTERRUPT(p_q, p_data) af_queue_put_from_interrupt((queue_t *)(p_q), p_data)
+#define AF_QUEUE_FIND(p_q, p_match, p_context) af_queue_find((queue_t *)(p_q), p_match, p_context)
+#define AF_QUEUE_FIND_FROM_INTERRUPT(p_q, p_match, p_context) af_queue_find_from_interrupt((queue_t *)(p_q), p_match, p_context)
 #define AF_QUEUE_GET_NUM_AVAILABLE(p_q) af_queue_get_num_available((queue_t *)(p_q))
 
 typedef struct af_queue_elem_desc_s
@@ -62,6 +68,8 @@ void af_queue_elem_free(queue_t *p_q, void *p_data);
 void af_queue_elem_free_from_interrupt(queue_t *p_q, void *p_data);
 void af_queue_put(queue_t *p_q, void *p_data);
 void af_queue_put_from_interrupt(queue_t *p_q, void *p_data);
+void *af_queue_find(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context);
+void *af_queue_find_from_interrupt(queue_t *p_q, bool (*p_match)(void *p_data, void *p_context), void *p_context);
 void af_queue_dump(queue_t *p_q, void (*p_element_data)(void*));
 uint32_t af_queue_get_num_available(queue_t *p_q);
 
@@ -94,26 +94,23 @@ bool af_status_command_is_valid(af_status_command_t *af_status_command) {
 }
 
 void af_status_command_dump(af_status_command_t *af_status_command) {
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
     af_logger_print_buffer("cmd              : ");
     af_logger_println_buffer(AF_STATUS_COMMAND_STATUS == af_status_command->cmd ? "STATUS" : "STATUS_ACK");
     af_logger_print_buffer("bytes to send    : ");
     af_logger_println_formatted_value(af_status_command->bytes_to_send, AF_LOGGER_DEC);
     af_logger_print_buffer("bytes to receive : ");
     af_logger_println_formatted_value(af_status_command->bytes_to_recv, AF_LOGGER_DEC);
+#endif
 }
 
 void af_status_command_dump_bytes(af_status_command_t *af_status_command) {
+#if AF_LOG_LEVEL >= AF_LOG_LEVEL_DEBUG
     int len = af_status_command_get_size(af_status_command);
-    uint8_t *bytes;
+    uint8_t bytes[sizeof(af_status_command_t)];
     int i = 0;
     int b;
 
-    bytes = (uint8_t *)malloc(len);
-    if (bytes == NULL) {
-        af_logger_print_buffer("malloc failed!");
-        return;
-    }
-
     af_status_command_get_bytes(af_status_command, bytes);
 
     af_logger_print_buffer("len  : ");
@@ -133,7 +130,6 @@ void af_status_command_dump_bytes(af_status_command_t *af_status_command) {
         }
     }
     af_logger_println_buffer("");
-
-    free(bytes);
+#endif
 }
 
@@ -0,0 +1,52 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * What afLib records in its trace ring when built with AF_LIB_TRACE_SIZE, and how af_lib_get_trace() lays it out.
+ *
+ * Each record is AF_TRACE_RECORD_SIZE bytes, little endian whatever the MCU: a 32 bit af_utils_micros() timestamp,
+ * the attribute id and a length (16 bits each), then the state machine's state and the event. extras/trace turns a
+ * dump of them into a timeline.
+ */
+#ifndef AF_TRACE_H
+#define AF_TRACE_H
+
+#include <stdint.h>
+
+#define AF_TRACE_RECORD_SIZE                10
+
+// af_lib_dump_trace() starts every line it logs with this, so a dump can be picked out of the rest of the log
+#define AF_TRACE_LOG_PREFIX                 "afTrace "
+
+typedef enum {
+    AF_TRACE_EVENT_STATE = 1,       // The state machine moved to state, attr is the command going out if any and len the bytes left to move
+    AF_TRACE_EVENT_INTERRUPT,       // len interrupts came in from the ASR
+    AF_TRACE_EVENT_QUEUED,          // A request for attr with a len byte value was queued
+    AF_TRACE_EVENT_SENT,            // A command for attr with a len byte value has gone out
+    AF_TRACE_EVENT_RECEIVED,        // A command for attr with a len byte value came in
+    AF_TRACE_EVENT_RESPONSE,        // The ASR answered the get or set of attr, len is the request id
+    AF_TRACE_EVENT_SYNC_RETRY,      // A sync failed, len is how many have in a row
+} af_trace_event_t;
+
+typedef struct {
+    uint32_t time;
+    uint16_t attr_id;
+    uint16_t len;
+    uint8_t state;
+    uint8_t event;                  // af_trace_event_t
+} af_trace_record_t;
+
+#endif /* AF_TRACE_H */
@@ -0,0 +1,86 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "af_transport.h"
+#include "af_lib.h"
+
+#include <stddef.h>
+
+// With AF_TRANSPORT defined the transport that's built provides these itself
+#ifndef AF_TRANSPORT
+
+void af_transport_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    af_transport->ops->check_for_interrupt(af_transport, interrupts_pending, idle);
+}
+
+int af_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
+    return af_transport->ops->exchange_status(af_transport, af_status_command_tx, af_status_command_rx);
+}
+
+int af_transport_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
+    return af_transport->ops->write_status(af_transport, af_status_command);
+}
+
+int af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    return af_transport->ops->send_bytes_offset(af_transport, bytes, bytes_to_send, offset);
+}
+
+int af_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    return af_transport->ops->recv_bytes_offset(af_transport, bytes, bytes_len, bytes_to_recv, offset);
+}
+
+bool af_transport_has_work(af_transport_t *af_transport) {
+    if (NULL == af_transport->ops->has_work) {
+        return false;
+    }
+    return af_transport->ops->has_work(af_transport);
+}
+
+int af_transport_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    if (NULL == af_transport->ops->get_baud_rate) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    return af_transport->ops->get_baud_rate(af_transport, baud_rate, max_baud_rate);
+}
+
+int af_transport_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate) {
+    if (NULL == af_transport->ops->set_baud_rate) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    return af_transport->ops->set_baud_rate(af_transport, baud_rate);
+}
+
+int af_transport_get_spi_config(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length) {
+    if (NULL == af_transport->ops->get_spi_config) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    return af_transport->ops->get_spi_config(af_transport, clock_rate, frame_length, max_clock_rate, max_frame_length);
+}
+
+int af_transport_set_spi_config(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length) {
+    if (NULL == af_transport->ops->set_spi_config) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    return af_transport->ops->set_spi_config(af_transport, clock_rate, frame_length);
+}
+
+void af_transport_destroy(af_transport_t *af_transport) {
+    if (af_transport->ops->destroy != NULL) {
+        af_transport->ops->destroy(af_transport);
+    }
+}
+
+#endif /* AF_TRANSPORT */
@@ -27,19 +27,77 @@ extern "C" {
 // The maximum time any transfer operation should take.  If this time elapses then the function should return a AF_ERROR_TIMEOUT result
 #define MAX_TRANSFER_TIME_MS                10000
 
-typedef struct af_transport_t af_transport_t; // A specific implementation can fill in what's appropriate for it in their c file
+/*
+ * AF_TRANSPORT
+ *
+ * Define as SPI or UART to build for that transport alone. Its own functions are then the af_transport_* calls below,
+ * so afLib calls them directly rather than through an ops table, and the other transport isn't built at all. Left
+ * undefined, every transport is built and each call goes through the table of the transport it's given.
+ */
+#define AF_TRANSPORT_ID_SPI                 1
+#define AF_TRANSPORT_ID_UART                2
+#define AF_TRANSPORT_ID_(t)                 AF_TRANSPORT_ID_ ## t
+#define AF_TRANSPORT_ID(t)                  AF_TRANSPORT_ID_(t)
+
+#if defined(AF_TRANSPORT)
+#define AF_TRANSPORT_ENABLED(t)             (AF_TRANSPORT_ID(AF_TRANSPORT) == AF_TRANSPORT_ID_ ## t)
+#if !AF_TRANSPORT_ENABLED(SPI) && !AF_TRANSPORT_ENABLED(UART)
+#error "AF_TRANSPORT must be SPI or UART"
+#endif
+#else
+#define AF_TRANSPORT_ENABLED(t)             1
+#endif
+
+typedef struct af_transport_t af_transport_t;
+
+/**
+ * af_transport_ops_t
+ *
+ * What an interface implements, one table shared by all instances of it. The af_transport_* calls below go through
+ * the table of the transport they're given, so different kinds of transport can be used side by side. The optional
+ * entries can be left NULL, the matching call then returns AF_ERROR_NOT_SUPPORTED (or false).
+ */
+typedef struct af_transport_ops_t {
+    void (*check_for_interrupt)(af_transport_t *af_transport, int *interrupts_pending, bool idle);
+    int (*exchange_status)(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx);
+    int (*write_status)(af_transport_t *af_transport, af_status_command_t *af_status_command);
+    int (*send_bytes_offset)(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset);
+    int (*recv_bytes_offset)(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset);
+
+    // Optional
+    bool (*has_work)(af_transport_t *af_transport);
+    int (*get_baud_rate)(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate);
+    int (*set_baud_rate)(af_transport_t *af_transport, uint32_t baud_rate);
+    int (*get_spi_config)(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length);
+    int (*set_spi_config)(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length);
+    void (*destroy)(af_transport_t *af_transport);
+} af_transport_ops_t;
+
+/**
+ * af_transport_t
+ *
+ * The start of every transport. An implementation puts this first in its own struct and keeps whatever else it needs
+ * after it. ops is NULL when AF_TRANSPORT is defined.
+ */
+struct af_transport_t {
+    const af_transport_ops_t *ops;
+};
 
 /*
  * checkForInterrupt
  *
  * For interfaces that don't use the interrupt pin to signal they want the state machine to run (like UART).
  */
-void af_transport_check_for_interrupt(af_transport_t *af_transport, volatile int *interrupts_pending, bool idle);
+void af_transport_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle);
 
 /*
  * exchangeStatus
  *
  * Write a status message to the interface and read one back.
+ *
+ * @return AF_SUCCESS       - the status was exchanged
+ * @return AF_ERROR_BUSY    - the status was written but the reply isn't all in yet, afLib calls again on its next loop
+ *                            and the transport picks up where it left off without writing the status again
  */
 int af_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx);
 
@@ -54,35 +112,100 @@ int af_transport_write_status(af_transport_t *af_transport, af_status_command_t
  * sendBytesOffset
  *
  * Write bytes using an interface specific packet size.
- * It may take multiple calls to this method to write all of the bytes.
+ * It may take multiple calls to this method to write all of the bytes, or one call may write several packets if the
+ * interface can tell when the ASR is ready for the next one.
  *
  * @param bytes         buffer of bytes to be written.
  * @param bytesToSend   Pointer to count of total number of bytes to be written.
  *                      This value is decremented after each packet is written and will be 0 when all bytes have been sent.
  * @param offset        Pointer to offset into bytes buffer.
  *                      This value is incremented after each packet is written and will equal bytesToSend when all bytes have been sent.
+ *
+ * @return AF_SUCCESS       - the bytes taken this call are on their way
+ * @return AF_ERROR_BUSY    - the transport is still pushing out bytes it buffered, afLib calls again on its next loop
+ *                            even if bytesToSend is already 0
  */
-void af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset);
+int af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset);
 
 /*
  * recvBytesOffset
  *
  * Read bytes using an interface specific packet size.
- * It may take multiple calls to this method to read all of the bytes.
+ * It may take multiple calls to this method to read all of the bytes, or one call may read several packets if the
+ * interface can tell when the ASR is ready for the next one.
  *
  * @param bytes         Pointer to buffer of bytes to read into.
- *                      This buffer is allocated for all bytesToRecv before the first packet is read.
+ *                      If this is NULL before the first packet is read, a buffer is allocated for all bytesToRecv.
  *                      NOTE: IT IS THE CALLER'S RESPONSIBILITY TO FREE THIS BUFFER.
+ *                      Otherwise it's a caller supplied buffer that is large enough for all bytesToRecv.
+ * @param bytesLen      Set to the total number of bytes being read when the first packet is read.
  * @param bytesToRecv   Pointer to count of total number of bytes to be read.
  *                      This value is decremented after each packet is read and will be 0 when all bytes have been read.
  * @param offset        Pointer to offset into bytes buffer.
  *                      This value is incremented after each packet is read and will equal bytesToRecv when all bytes have been read.
  *
  * @return AF_SUCCESS       - bytes received successfully
+ * @return AF_ERROR_BUSY    - the bytes that had arrived were taken but more are needed, afLib calls again on its next loop
  * @return AF_ERROR_TIMEOUT - receiving the bytes took too long, this will effectively make afLib reject the current transfer and go back to the idle state
  */
 int af_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset);
 
+/*
+ * hasWork
+ *
+ * True if the interface has something for afLib that another pass through af_lib_loop would pick up right away, like
+ * received bytes that haven't been looked at or transmit bytes still draining. Optional.
+ */
+bool af_transport_has_work(af_transport_t *af_transport);
+
+/*
+ * getBaudRate
+ *
+ * For UART interfaces, the baud rate the interface is running at and the highest one the MCU side can handle.
+ *
+ * @return AF_SUCCESS               - both rates were filled in
+ * @return AF_ERROR_NOT_SUPPORTED   - the interface doesn't have a baud rate
+ */
+int af_transport_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate);
+
+/*
+ * setBaudRate
+ *
+ * Switch a UART interface to a new baud rate without tearing it down. Anything already queued for transmit goes out
+ * at the old rate first.
+ *
+ * @return AF_SUCCESS               - the interface now runs at baud_rate
+ * @return AF_ERROR_NOT_SUPPORTED   - the interface doesn't have a baud rate
+ */
+int af_transport_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate);
+
+/*
+ * getSpiConfig
+ *
+ * For SPI interfaces, the clock rate and frame length in use and the highest ones the MCU side can handle.
+ *
+ * @return AF_SUCCESS               - all four values were filled in
+ * @return AF_ERROR_NOT_SUPPORTED   - the interface isn't SPI
+ */
+int af_transport_get_spi_config(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length);
+
+/*
+ * setSpiConfig
+ *
+ * Switch an SPI interface to a new clock rate and frame length, taking effect with the next transfer.
+ *
+ * @return AF_SUCCESS               - the interface now uses the new settings
+ * @return AF_ERROR_NOT_SUPPORTED   - the interface isn't SPI
+ */
+int af_transport_set_spi_config(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length);
+
+/*
+ * destroy
+ *
+ * Tear down the interface and free what it allocated. Optional.
+ */
+void af_transport_destroy(af_transport_t *af_transport);
+
 #ifdef __cplusplus
 } /* end of extern "C" */
 #endif
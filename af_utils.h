@@ -29,6 +29,13 @@ extern "C" {
  */
 long af_utils_millis();
 
+/**
+ * Utility function to return a free running microsecond count, it's only used for measuring intervals so it may wrap
+ *
+ * @return
+ */
+uint32_t af_utils_micros();
+
 
 /**
  * Various functions to read/write Little Endian values
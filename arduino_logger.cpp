@@ -17,9 +17,150 @@
 #include "Arduino.h"
 
 #include "af_logger.h"
+#include "af_event_ring.h"
 #include "arduino_logger.h"
 
+/* Bytes of log output held for af_logger_poll() to write out, a power of two no larger than 128. A message that
+ * doesn't fit in what's left is dropped whole and counted, rather than holding up the caller. One longer than the
+ * whole buffer could never fit, so it goes through a buffer's worth at a time, waiting on Serial. Set to 0 to have
+ * every message written out before the call returns, which is slow but doesn't lose the last lines before a crash.
+ * It's also the setting for cores whose Serial doesn't implement availableForWrite(), as nothing buffered gets out
+ * there.
+ */
+#ifndef ARDUINO_LOGGER_BUFFER_SIZE
+#define ARDUINO_LOGGER_BUFFER_SIZE          128
+#endif
+
+#if (ARDUINO_LOGGER_BUFFER_SIZE & (ARDUINO_LOGGER_BUFFER_SIZE - 1)) != 0 || ARDUINO_LOGGER_BUFFER_SIZE > 128
+#error "ARDUINO_LOGGER_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+// Room for a 32 bit value in binary, or a sign and the digits in decimal, and the terminator
+#define VALUE_BUFFER_SIZE                   34
+
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+AF_EVENT_RING_DECLARE(log_ring_t, ARDUINO_LOGGER_BUFFER_SIZE);
+
+// Written and emptied only from the loop, never from an interrupt, so its two ends are never in use at once
+static log_ring_t s_ring;
+#endif
+static uint32_t s_dropped;
+
+/**
+ * pump
+ *
+ * Hand Serial as many buffered bytes as it can take without making us wait.
+ */
+static void pump() {
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+    int room = Serial.availableForWrite();
+    uint8_t c;
+
+    while (room-- > 0 && AF_EVENT_RING_GET(&s_ring, &c)) {
+        Serial.write(c);
+    }
+#endif
+}
+
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+/**
+ * put_waiting
+ *
+ * Buffer a byte, waiting for Serial to take some of what's buffered if there's no room for it.
+ */
+static void put_waiting(uint8_t c) {
+    while (0 == AF_EVENT_RING_SPACE(&s_ring)) {
+        pump();
+    }
+    AF_EVENT_RING_PUT(&s_ring, c);
+}
+
+/**
+ * log_long_message
+ *
+ * Write out a message too long for the buffer ever to hold, refilling it as Serial empties it.
+ */
+static void log_long_message(const char *text, size_t len, bool newline) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        put_waiting((uint8_t)text[i]);
+    }
+    if (newline) {
+        put_waiting('\r');
+        put_waiting('\n');
+    }
+    pump();
+}
+#endif
+
+/**
+ * log_message
+ *
+ * Buffer text, and a line ending if asked for, as one message that goes out whole or not at all.
+ */
+static void log_message(const char *text, bool newline) {
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+    size_t len = strlen(text);
+    size_t total = len + (newline ? 2 : 0);
+    size_t i;
+
+    if (total > ARDUINO_LOGGER_BUFFER_SIZE) {
+        log_long_message(text, len, newline);
+        return;
+    }
+    if (total > AF_EVENT_RING_SPACE(&s_ring)) {
+        pump();
+        if (total > AF_EVENT_RING_SPACE(&s_ring)) {
+            s_dropped++;
+            return;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        AF_EVENT_RING_PUT(&s_ring, (uint8_t)text[i]);
+    }
+    if (newline) {
+        AF_EVENT_RING_PUT(&s_ring, '\r');
+        AF_EVENT_RING_PUT(&s_ring, '\n');
+    }
+    pump();
+#else
+    if (newline) {
+        Serial.println(text);
+    } else {
+        Serial.print(text);
+    }
+    Serial.flush();
+#endif
+}
+
+/**
+ * format_value
+ *
+ * Write val out the way Print::print(long, base) does, signed in decimal and unsigned in any other base.
+ */
+static const char *format_value(char *buffer, int32_t val, af_logger_format_t format) {
+    static const char digits[] = "0123456789ABCDEF";
+    bool negative = AF_LOGGER_DEC == format && val < 0;
+    uint32_t n = negative ? 0 - (uint32_t)val : (uint32_t)val;
+    char *p = &buffer[VALUE_BUFFER_SIZE - 1];
+
+    *p = 0;
+    do {
+        *--p = digits[n % format];
+        n /= format;
+    } while (n > 0);
+    if (negative) {
+        *--p = '-';
+    }
+    return p;
+}
+
 void arduino_logger_start(int baud_rate) {
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+    AF_EVENT_RING_INIT(&s_ring);
+#endif
+    s_dropped = 0;
     Serial.begin(baud_rate);
     while (!Serial) {
         ;
@@ -27,35 +168,53 @@ void arduino_logger_start(int baud_rate) {
 }
 
 void arduino_logger_stop() {
+    arduino_logger_flush();
     Serial.end();
 }
 
-void af_logger_print_value(int32_t val) {
-    Serial.print(val);
+void arduino_logger_flush() {
+#if ARDUINO_LOGGER_BUFFER_SIZE > 0
+    uint8_t c;
+
+    while (AF_EVENT_RING_GET(&s_ring, &c)) {
+        Serial.write(c);
+    }
+#endif
     Serial.flush();
 }
 
+uint32_t arduino_logger_dropped() {
+    return s_dropped;
+}
+
+void af_logger_poll(void) {
+    pump();
+}
+
+void af_logger_print_value(int32_t val) {
+    char buffer[VALUE_BUFFER_SIZE];
+    log_message(format_value(buffer, val, AF_LOGGER_DEC), false);
+}
+
 void af_logger_print_buffer(const char* val) {
-    Serial.print(val);
-    Serial.flush();
+    log_message(val, false);
 }
 
 void af_logger_print_formatted_value(int32_t val, af_logger_format_t format) {
-    Serial.print(val, format);
-    Serial.flush();
+    char buffer[VALUE_BUFFER_SIZE];
+    log_message(format_value(buffer, val, format), false);
 }
 
 void af_logger_println_value(int32_t val) {
-    Serial.println(val);
-    Serial.flush();
+    char buffer[VALUE_BUFFER_SIZE];
+    log_message(format_value(buffer, val, AF_LOGGER_DEC), true);
 }
 
 void af_logger_println_buffer(const char* val) {
-    Serial.println(val);
-    Serial.flush();
+    log_message(val, true);
 }
 
 void af_logger_println_formatted_value(int32_t val, af_logger_format_t format) {
-    Serial.println(val, format);
-    Serial.flush();
+    char buffer[VALUE_BUFFER_SIZE];
+    log_message(format_value(buffer, val, format), true);
 }
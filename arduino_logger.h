@@ -17,8 +17,25 @@
 #ifndef AF_ARDUINO_LOGGER_H
 #define AF_ARDUINO_LOGGER_H
 
+#include <stdint.h>
+
 void arduino_logger_start(int baud_rate);
 void arduino_logger_stop();
 
+/**
+ * arduino_logger_flush
+ *
+ * Write out everything still buffered, waiting on Serial as long as it takes. Worth calling before sleeping or
+ * resetting so the last lines aren't lost.
+ */
+void arduino_logger_flush();
+
+/**
+ * arduino_logger_dropped
+ *
+ * @return how many messages have been thrown away since arduino_logger_start() because the buffer was full
+ */
+uint32_t arduino_logger_dropped();
+
 #endif /* AF_ARDUINO_LOGGER_H */
 
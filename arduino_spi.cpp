@@ -15,26 +15,109 @@
  */
 
 #include "arduino_spi.h"
+
+#if AF_TRANSPORT_ENABLED(SPI)
+
 #include "af_logger.h"
 #include "af_lib.h"
 
 #include <SPI.h>
+#include "af_allocator.h"
+
+// The clock the transport starts with, and the ASR after it reboots
+#define AF_SPI_CLOCK_RATE                   1000000
+
+/* Fastest clock and longest frame afLib may negotiate. The default clock is the fastest an AVR's SPI can be driven. */
+#ifndef AF_SPI_MAX_CLOCK_RATE
+#if defined(F_CPU)
+#define AF_SPI_MAX_CLOCK_RATE               (F_CPU / 2)
+#else
+#define AF_SPI_MAX_CLOCK_RATE               4000000
+#endif
+#endif
+
+#ifndef AF_SPI_MAX_FRAME_LEN
+#define AF_SPI_MAX_FRAME_LEN                64
+#endif
+
+/*
+ * Send or receive the frames of a command in one SPI transaction, starting the next frame as soon as the ASR signals
+ * it's ready rather than one frame per interrupt through af_lib_loop. Needs arduino_spi_setup_interrupts. The bus and
+ * af_lib_loop are held for the whole burst, up to AF_SPI_BURST_BUDGET_US, so it's off unless set to 1.
+ */
+#ifndef AF_SPI_BURST
+#define AF_SPI_BURST                        0
+#endif
+
+// Longest a burst may hold the bus, after which the rest of the command goes a frame per interrupt as usual
+#ifndef AF_SPI_BURST_BUDGET_US
+#define AF_SPI_BURST_BUDGET_US              1000
+#endif
+
+/*
+ * Hand commands longer than a frame to interrupts: the loop starts the first frame and the ASR's ready interrupt starts
+ * each one after it, so afLib only hears about the command once it's all been moved. Needs arduino_spi_setup_interrupts
+ * and takes the place of AF_SPI_BURST. Only the loop is freed up unless AF_SPI_START_DMA is defined too: without DMA the
+ * ready interrupt clocks each whole frame out itself, chip select setup included, before it returns.
+ */
+#ifndef AF_SPI_ASYNC
+#define AF_SPI_ASYNC                        0
+#endif
+
+/*
+ * For cores with DMA, AF_SPI_START_DMA(bytes, len, send) starts a frame without waiting for it and the port calls
+ * arduino_spi_frame_complete() from the transfer's completion interrupt. Without it the ready interrupt clocks each
+ * frame out itself.
+ */
+
+// How long to wait for the ASR to be ready for the next frame of a burst before leaving it to the interrupt
+#ifndef AF_SPI_READY_TIMEOUT_US
+#define AF_SPI_READY_TIMEOUT_US             2000
+#endif
+
+// Chip select to first clock for status exchanges, which can start before the ASR is waiting for us
+#define AF_SPI_STATUS_SETUP_US              8
+
+/* Chip select to first clock for data frames. The same as for status exchanges unless set lower for an ASR that has
+ * been checked to keep up, as it has already signalled it's ready for the frame.
+ */
+#ifndef AF_SPI_FRAME_SETUP_US
+#define AF_SPI_FRAME_SETUP_US               AF_SPI_STATUS_SETUP_US
+#endif
+
+/*
+ * Transmit-only block transfer, which leaves the caller's buffer alone. Where the core doesn't have one we clock the
+ * bytes out one at a time, which is what SPI.transfer(buffer, len) does on those cores anyway.
+ */
+#ifndef AF_SPI_WRITE_BYTES
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#define AF_SPI_WRITE_BYTES(bytes, len)      SPI.writeBytes((bytes), (len))
+#elif defined(TEENSYDUINO) && !defined(__AVR__)
+#define AF_SPI_WRITE_BYTES(bytes, len)      SPI.transfer((bytes), NULL, (len))
+#endif
+#endif
 
 class ArduinoSPI {
 public:
 
     ArduinoSPI(int chipSelect, uint16_t frame_length);
 
-    void checkForInterrupt(volatile int *interrupts_pending, bool idle);
+    void checkForInterrupt(int *interrupts_pending, bool idle);
     int exchangeStatus(af_status_command_t *tx, af_status_command_t *rx);
     int writeStatus(af_status_command_t *c);
-    void sendBytes(uint8_t *bytes, int len);
-    void recvBytes(uint8_t *bytes, int len);
     void sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset);
-    void recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset);
+    int recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset);
+    bool hasWork();
+    void getConfig(uint32_t *clockRate, uint16_t *frameLength);
+    void setConfig(uint32_t clockRate, uint16_t frameLength);
+#if AF_SPI_ASYNC
+    bool onReady();
+    void frameComplete();
+#endif
 
 private:
     SPISettings _spiSettings;
+    uint32_t _clockRate;
     int _chipSelect;
     uint16_t _frameLength;
 
@@ -42,24 +125,99 @@ private:
     void beginSPI(); /* settings are in this class */
     void endSPI();
     void transfer(uint8_t *bytes, int len);
+    void write(uint8_t *bytes, int len);
+    bool waitForReady(unsigned long burstStart);
+    void transferFrames(uint8_t *bytes, uint16_t *remaining, uint16_t *offset, bool send);
+
+#if AF_SPI_ASYNC
+    enum {
+        JOB_IDLE,
+        JOB_RUNNING,
+        JOB_DONE,
+    };
+
+    // The command being moved by interrupts, the ISR owns everything but _jobState between JOB_RUNNING and JOB_DONE
+    volatile uint8_t _jobState;
+    uint8_t *_jobBytes;
+    bool _jobSend;
+    volatile uint16_t _jobRemaining;
+    volatile uint16_t _jobDone;
+    uint16_t _jobFrameLength;
+    bool _owedInterrupt;
+
+    int transferAsync(uint8_t *bytes, uint16_t *remaining, uint16_t *offset, bool send);
+    void startFrame();
+    void cancelJob();
+#endif
 };
 
-struct af_transport_t {
+typedef struct {
+    af_transport_t base;    // Must be first
     ArduinoSPI *arduinoSPI;
+} arduino_spi_transport_t;
+
+#ifdef AF_TRANSPORT
+// Built alone, afLib calls this transport directly
+#define ARDUINO_SPI_OPS                     NULL
+#else
+static const af_transport_ops_t s_spi_ops = {
+    af_transport_check_for_interrupt_spi,
+    af_transport_exchange_status_spi,
+    af_transport_write_status_spi,
+    af_transport_send_bytes_offset_spi,
+    af_transport_recv_bytes_offset_spi,
+    af_transport_has_work_spi,
+    NULL,
+    NULL,
+    af_transport_get_spi_config_spi,
+    af_transport_set_spi_config_spi,
+    arduino_spi_destroy,
 };
+#define ARDUINO_SPI_OPS                     (&s_spi_ops)
+#endif
+
+static ArduinoSPI *arduino_spi(af_transport_t *af_transport) {
+    return ((arduino_spi_transport_t *)af_transport)->arduinoSPI;
+}
 
+// The interrupt handler has no way to tell transports apart, so this is the one SPI transport's state
 static af_lib_t* s_af_lib = NULL;
 
+// While a burst is waiting between frames the ASR's interrupt is its ready signal, and the burst consumes it
+static volatile bool s_bursting = false;
+static volatile bool s_asrReady = false;
+
+#if AF_SPI_ASYNC
+// The transport with a command in flight, its ready interrupts start the next frame instead of going to afLib
+static ArduinoSPI * volatile s_asyncSPI = NULL;
+#endif
+
 void isrWrapper() {
-    if (s_af_lib) {
+    if (s_bursting) {
+        s_asrReady = true;
+#if AF_SPI_ASYNC
+    } else if (s_asyncSPI != NULL && s_asyncSPI->onReady()) {
+        // Started the next frame
+#endif
+    } else if (s_af_lib) {
         af_lib_mcu_isr(s_af_lib);
     }
 }
 
 af_transport_t* arduino_spi_create(int chipSelect, uint16_t frame_length) {
-    af_transport_t *result = new af_transport_t();
+#ifdef AF_LIB_NO_HEAP
+    // Only one SPI transport without a heap, it's constructed the first time through
+    static ArduinoSPI s_arduinoSPI(chipSelect, frame_length);
+    static arduino_spi_transport_t s_transport;
+    s_transport.base.ops = ARDUINO_SPI_OPS;
+    s_transport.arduinoSPI = &s_arduinoSPI;
+    return &s_transport.base;
+#else
+    arduino_spi_transport_t *result = new arduino_spi_transport_t();
+    result->base.ops = ARDUINO_SPI_OPS;
     result->arduinoSPI = new ArduinoSPI(chipSelect, frame_length);
-    return result;
+    return &result->base;
+#endif
 }
 
 af_lib_error_t arduino_spi_setup_interrupts(af_lib_t* af_lib, int mcuInterrupt) {
@@ -69,43 +227,98 @@ af_lib_error_t arduino_spi_setup_interrupts(af_lib_t* af_lib, int mcuInterrupt)
     s_af_lib = af_lib;
     pinMode(mcuInterrupt, INPUT);
     attachInterrupt(mcuInterrupt, isrWrapper, FALLING);
+#if AF_SPI_ASYNC
+    // Frames are moved from this interrupt, keep it out of other libraries' SPI transactions
+    SPI.usingInterrupt(mcuInterrupt);
+#endif
 
     return AF_SUCCESS;
 }
 
 void arduino_spi_destroy(af_transport_t *af_transport) {
-    delete af_transport->arduinoSPI;
-    delete af_transport;
+#ifndef AF_LIB_NO_HEAP
+    arduino_spi_transport_t *transport = (arduino_spi_transport_t *)af_transport;
+    delete transport->arduinoSPI;
+    delete transport;
+#endif
 }
 
-void af_transport_check_for_interrupt_spi(af_transport_t *af_transport, volatile int *interrupts_pending, bool idle) {
-    af_transport->arduinoSPI->checkForInterrupt(interrupts_pending, idle);
+void af_transport_check_for_interrupt_spi(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    arduino_spi(af_transport)->checkForInterrupt(interrupts_pending, idle);
 }
 
 int af_transport_exchange_status_spi(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
-    return af_transport->arduinoSPI->exchangeStatus(af_status_command_tx, af_status_command_rx);
+    return arduino_spi(af_transport)->exchangeStatus(af_status_command_tx, af_status_command_rx);
 }
 
 int af_transport_write_status_spi(af_transport_t *af_transport, af_status_command_t *af_status_command) {
-    return af_transport->arduinoSPI->writeStatus(af_status_command);
+    return arduino_spi(af_transport)->writeStatus(af_status_command);
 }
 
-void af_transport_send_bytes_offset_spi(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
-    af_transport->arduinoSPI->sendBytesOffset(bytes, bytes_to_send, offset);
+int af_transport_send_bytes_offset_spi(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    arduino_spi(af_transport)->sendBytesOffset(bytes, bytes_to_send, offset);
+    return AF_SUCCESS;
+}
+
+int af_transport_recv_bytes_offset_spi(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    return arduino_spi(af_transport)->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+}
+
+bool af_transport_has_work_spi(af_transport_t *af_transport) {
+    return arduino_spi(af_transport)->hasWork();
+}
+
+int af_transport_get_spi_config_spi(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length) {
+    arduino_spi(af_transport)->getConfig(clock_rate, frame_length);
+    *max_clock_rate = AF_SPI_MAX_CLOCK_RATE;
+    *max_frame_length = AF_SPI_MAX_FRAME_LEN;
+    return AF_SUCCESS;
 }
 
-void af_transport_recv_bytes_offset_spi(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
-    af_transport->arduinoSPI->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+int af_transport_set_spi_config_spi(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length) {
+    if (0 == clock_rate || 0 == frame_length || clock_rate > AF_SPI_MAX_CLOCK_RATE || frame_length > AF_SPI_MAX_FRAME_LEN) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    arduino_spi(af_transport)->setConfig(clock_rate, frame_length);
+    return AF_SUCCESS;
 }
 
 ArduinoSPI::ArduinoSPI(int chipSelect, uint16_t frame_length)
 {
     _chipSelect = chipSelect;
     _frameLength = frame_length;
-    _spiSettings = SPISettings(1000000, LSBFIRST, SPI_MODE0);
+    _clockRate = AF_SPI_CLOCK_RATE;
+    _spiSettings = SPISettings(_clockRate, LSBFIRST, SPI_MODE0);
+#if AF_SPI_ASYNC
+    _jobState = JOB_IDLE;
+    _owedInterrupt = false;
+#endif
     begin();
 }
 
+bool ArduinoSPI::hasWork()
+{
+#if AF_SPI_ASYNC
+    return _owedInterrupt;
+#else
+    return false;
+#endif
+}
+
+void ArduinoSPI::getConfig(uint32_t *clockRate, uint16_t *frameLength)
+{
+    *clockRate = _clockRate;
+    *frameLength = _frameLength;
+}
+
+void ArduinoSPI::setConfig(uint32_t clockRate, uint16_t frameLength)
+{
+    // Every transfer begins its own transaction, so the new settings apply from the next one
+    _clockRate = clockRate;
+    _frameLength = frameLength;
+    _spiSettings = SPISettings(_clockRate, LSBFIRST, SPI_MODE0);
+}
+
 void ArduinoSPI::begin()
 {
     pinMode(_chipSelect, OUTPUT);
@@ -116,7 +329,7 @@ void ArduinoSPI::beginSPI() /* settings are in this class */
 {
     SPI.beginTransaction(_spiSettings);
     digitalWrite(_chipSelect, LOW);
-    delayMicroseconds(8);
+    delayMicroseconds(AF_SPI_STATUS_SETUP_US);
 }
 
 void ArduinoSPI::endSPI()
@@ -130,9 +343,91 @@ void ArduinoSPI::transfer(uint8_t *bytes, int len)
     SPI.transfer(bytes, len);
 }
 
-void ArduinoSPI::checkForInterrupt(volatile int *interrupts_pending, bool idle)
+void ArduinoSPI::write(uint8_t *bytes, int len)
+{
+#ifdef AF_SPI_WRITE_BYTES
+    AF_SPI_WRITE_BYTES(bytes, len);
+#else
+    for (int i = 0; i < len; i++) {
+        SPI.transfer(bytes[i]);
+    }
+#endif
+}
+
+/**
+ * waitForReady
+ *
+ * Wait for the ASR to signal it's ready for the next frame of a burst. If it doesn't in time, or the burst has used up
+ * its budget, the burst is over and its interrupt goes back to afLib, which sends the rest of the command the usual way.
+ */
+bool ArduinoSPI::waitForReady(unsigned long burstStart)
+{
+    unsigned long start = micros();
+
+    while (!s_asrReady) {
+        if (micros() - start > AF_SPI_READY_TIMEOUT_US || micros() - burstStart > AF_SPI_BURST_BUDGET_US) {
+            // The signal may arrive just as we give up, so check again with the ISR held off
+            noInterrupts();
+            s_bursting = false;
+            bool ready = s_asrReady;
+            interrupts();
+            return ready;
+        }
+    }
+    return true;
+}
+
+/**
+ * transferFrames
+ *
+ * Move as much of a command as the ASR is ready for, a frame per chip select, inside a single transaction and straight
+ * to or from the caller's buffer. Without a ready signal or with AF_SPI_BURST off this is one frame per call.
+ */
+void ArduinoSPI::transferFrames(uint8_t *bytes, uint16_t *remaining, uint16_t *offset, bool send)
+{
+    bool burst = AF_SPI_BURST && !AF_SPI_ASYNC && s_af_lib != NULL;
+    unsigned long burstStart = micros();
+
+    SPI.beginTransaction(_spiSettings);
+
+    while (*remaining > 0) {
+        uint16_t len = *remaining > _frameLength ? _frameLength : *remaining;
+        bool more = burst && *remaining > len && micros() - burstStart < AF_SPI_BURST_BUDGET_US;
+
+        // Claim the ready signal that follows this frame before the ASR can send it, or leave it to afLib after the last
+        s_asrReady = false;
+        s_bursting = more;
+
+        digitalWrite(_chipSelect, LOW);
+        delayMicroseconds(AF_SPI_FRAME_SETUP_US);
+        if (send) {
+            write(bytes + *offset, len);
+        } else {
+            transfer(bytes + *offset, len);
+        }
+        digitalWrite(_chipSelect, HIGH);
+
+        *offset += len;
+        *remaining -= len;
+
+        if (!more || !waitForReady(burstStart)) {
+            break;
+        }
+    }
+
+    s_bursting = false;
+    SPI.endTransaction();
+}
+
+void ArduinoSPI::checkForInterrupt(int *interrupts_pending, bool idle)
 {
-    // Nothing required here.
+#if AF_SPI_ASYNC
+    // The interrupt that finished a command was spent reporting it, afLib still needs one to complete the command
+    if (_owedInterrupt) {
+        _owedInterrupt = false;
+        *interrupts_pending += 1;
+    }
+#endif
 }
 
 int ArduinoSPI::exchangeStatus(af_status_command_t *tx, af_status_command_t *rx)
@@ -144,6 +439,9 @@ int ArduinoSPI::exchangeStatus(af_status_command_t *tx, af_status_command_t *rx)
     int index = 0;
     af_status_command_get_bytes(tx, bytes);
 
+#if AF_SPI_ASYNC
+    cancelJob();
+#endif
     beginSPI();
 
     for (int i=0; i < len; i++)
@@ -179,6 +477,9 @@ int ArduinoSPI::writeStatus(af_status_command_t *c)
     int index = 0;
     af_status_command_get_bytes(c, bytes);
 
+#if AF_SPI_ASYNC
+    cancelJob();
+#endif
     beginSPI();
 
     for (int i=0;i<len;i++)
@@ -200,56 +501,211 @@ int ArduinoSPI::writeStatus(af_status_command_t *c)
     return result;
 }
 
-void ArduinoSPI::sendBytes(uint8_t *bytes, int len)
+#if AF_SPI_ASYNC
+/**
+ * transferAsync
+ *
+ * Move a command by interrupts. The first call starts it and leaves the counts alone, so afLib waits in the same state
+ * for the interrupt that says the whole command has gone. The call that interrupt brings catches the counts up.
+ */
+int ArduinoSPI::transferAsync(uint8_t *bytes, uint16_t *remaining, uint16_t *offset, bool send)
 {
-    beginSPI();
+    switch (_jobState) {
+        case JOB_IDLE:
+            _jobBytes = bytes + *offset;
+            _jobSend = send;
+            _jobRemaining = *remaining;
+            _jobDone = 0;
+            _jobFrameLength = _frameLength;
+            // The ASR is already waiting for the first frame. Its interrupt is held off until the frame has started,
+            // otherwise the ISR could see the job running and start the same frame
+            noInterrupts();
+            _jobState = JOB_RUNNING;
+            s_asyncSPI = this;
+            startFrame();
+            interrupts();
+            break;
+
+        case JOB_DONE:
+            s_asyncSPI = NULL;
+            _jobState = JOB_IDLE;
+            *offset += _jobDone;
+            *remaining = 0;
+            _owedInterrupt = true;
+            break;
+
+        default:
+            break;
+    }
+    return AF_SUCCESS;
+}
 
-    transfer(bytes, len);
+/**
+ * startFrame
+ *
+ * Start the next frame of the command, called with the ASR's interrupt held off.
+ */
+void ArduinoSPI::startFrame()
+{
+    uint16_t len = _jobRemaining > _jobFrameLength ? _jobFrameLength : _jobRemaining;
 
-    endSPI();
+    SPI.beginTransaction(_spiSettings);
+    digitalWrite(_chipSelect, LOW);
+    delayMicroseconds(AF_SPI_FRAME_SETUP_US);
+#ifdef AF_SPI_START_DMA
+    AF_SPI_START_DMA(_jobBytes + _jobDone, len, _jobSend);
+#else
+    if (_jobSend) {
+        write(_jobBytes + _jobDone, len);
+    } else {
+        transfer(_jobBytes + _jobDone, len);
+    }
+    frameComplete();
+#endif
 }
 
-void ArduinoSPI::recvBytes(uint8_t *bytes, int len)
+/**
+ * cancelJob
+ *
+ * afLib only goes back to exchanging status once it's given up on a command, so stop moving it.
+ */
+void ArduinoSPI::cancelJob()
 {
-    beginSPI();
+    noInterrupts();
+    if (_jobState != JOB_IDLE) {
+        s_asyncSPI = NULL;
+        _jobState = JOB_IDLE;
+    }
+    _owedInterrupt = false;
+    interrupts();
+}
 
-    transfer(bytes, len);
+/**
+ * frameComplete
+ *
+ * The frame startFrame began is on the wire, called from the transfer's completion interrupt when it was a DMA one.
+ */
+void ArduinoSPI::frameComplete()
+{
+    uint16_t len = _jobRemaining > _jobFrameLength ? _jobFrameLength : _jobRemaining;
 
-    endSPI();
+    _jobDone += len;
+    _jobRemaining -= len;
+    digitalWrite(_chipSelect, HIGH);
+    SPI.endTransaction();
+}
+
+/**
+ * onReady
+ *
+ * The ASR is ready for the next frame of a command in flight. Returns false once there are none left, which makes this
+ * the interrupt that tells afLib the command is done.
+ */
+bool ArduinoSPI::onReady()
+{
+    if (JOB_RUNNING != _jobState) {
+        return false;
+    }
+    if (0 == _jobRemaining) {
+        _jobState = JOB_DONE;
+        return false;
+    }
+    startFrame();
+    return true;
+}
+#endif
+
+void arduino_spi_frame_complete(void)
+{
+#if AF_SPI_ASYNC
+    if (s_asyncSPI != NULL) {
+        s_asyncSPI->frameComplete();
+    }
+#endif
 }
 
 void ArduinoSPI::sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset)
 {
-    uint16_t len = 0;
+#if AF_SPI_ASYNC
+    // Nothing to gain from interrupts for a single frame
+    if (s_af_lib != NULL && (JOB_IDLE != _jobState || *bytesToSend > _frameLength)) {
+        transferAsync(bytes, bytesToSend, offset, true);
+        return;
+    }
+#endif
+    transferFrames(bytes, bytesToSend, offset, true);
+}
 
-    len = *bytesToSend > _frameLength ? _frameLength : *bytesToSend;
+int ArduinoSPI::recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset)
+{
+    if (*offset == 0) {
+        *bytesLen = *bytesToRecv;
+        if (*bytes == NULL) {
+            *bytes = (uint8_t*)af_allocator_malloc(*bytesLen);
+            if (*bytes == NULL) {
+                return AF_ERROR_UNKNOWN;
+            }
+        }
+    }
 
-    uint8_t buffer[len];
-    memset(buffer, 0xff, sizeof(buffer));
+#if AF_SPI_ASYNC
+    if (s_af_lib != NULL && (JOB_IDLE != _jobState || *bytesToRecv > _frameLength)) {
+        return transferAsync(*bytes, bytesToRecv, offset, false);
+    }
+#endif
+    transferFrames(*bytes, bytesToRecv, offset, false);
 
-    memcpy(buffer, &bytes[*offset], len);
+    return AF_SUCCESS;
+}
 
-    sendBytes(buffer, len);
+#ifdef AF_TRANSPORT
+/*
+ * The only transport in the build, so these are afLib's transport calls
+ */
+void af_transport_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    arduino_spi(af_transport)->checkForInterrupt(interrupts_pending, idle);
+}
 
-    *offset += len;
-    *bytesToSend -= len;
+int af_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
+    return arduino_spi(af_transport)->exchangeStatus(af_status_command_tx, af_status_command_rx);
 }
 
-void ArduinoSPI::recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset)
-{
-    uint16_t len = 0;
+int af_transport_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
+    return arduino_spi(af_transport)->writeStatus(af_status_command);
+}
 
-    len = *bytesToRecv > _frameLength ? _frameLength : *bytesToRecv;
+int af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    arduino_spi(af_transport)->sendBytesOffset(bytes, bytes_to_send, offset);
+    return AF_SUCCESS;
+}
 
-    if (*offset == 0) {
-        *bytesLen = *bytesToRecv;
-        *bytes = (uint8_t*)malloc(*bytesLen);
-    }
+int af_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    return arduino_spi(af_transport)->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+}
+
+bool af_transport_has_work(af_transport_t *af_transport) {
+    return arduino_spi(af_transport)->hasWork();
+}
+
+int af_transport_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    return AF_ERROR_NOT_SUPPORTED;
+}
+
+int af_transport_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate) {
+    return AF_ERROR_NOT_SUPPORTED;
+}
 
-    uint8_t *start = *bytes + *offset;
+int af_transport_get_spi_config(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length) {
+    return af_transport_get_spi_config_spi(af_transport, clock_rate, frame_length, max_clock_rate, max_frame_length);
+}
 
-    recvBytes(start, len);
+int af_transport_set_spi_config(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length) {
+    return af_transport_set_spi_config_spi(af_transport, clock_rate, frame_length);
+}
 
-    *offset += len;
-    *bytesToRecv -= len;
+void af_transport_destroy(af_transport_t *af_transport) {
+    arduino_spi_destroy(af_transport);
 }
+#endif /* AF_TRANSPORT */
+
+#endif /* AF_TRANSPORT_ENABLED(SPI) */
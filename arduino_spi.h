@@ -23,7 +23,12 @@
 #include <af_msg_types.h>
 
 
-// You shouldn't call this directly but instead use the arduino_transport_create_spi call
+/*
+ * You shouldn't call this directly but instead use the arduino_transport_create_spi call.
+ *
+ * There can only be one SPI transport at a time. The ASR's interrupt handler and the state it shares with the
+ * transport are global, so a second transport would take them over from the first.
+ */
 af_transport_t* arduino_spi_create(int chipSelect, uint16_t frame_length);
 
 /**
@@ -37,12 +42,20 @@ af_transport_t* arduino_spi_create(int chipSelect, uint16_t frame_length);
  */
 af_lib_error_t arduino_spi_setup_interrupts(af_lib_t* af_lib, int mcuInterrupt);
 
-void af_transport_check_for_interrupt_spi(af_transport_t *af_transport, volatile int *interrupts_pending, bool idle);
+void af_transport_check_for_interrupt_spi(af_transport_t *af_transport, int *interrupts_pending, bool idle);
 int af_transport_exchange_status_spi(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx);
 int af_transport_write_status_spi(af_transport_t *af_transport, af_status_command_t *af_status_command);
-void af_transport_send_bytes_offset_spi(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset);
-void af_transport_recv_bytes_offset_spi(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset);
+int af_transport_send_bytes_offset_spi(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset);
+int af_transport_recv_bytes_offset_spi(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset);
+bool af_transport_has_work_spi(af_transport_t *af_transport);
+int af_transport_get_spi_config_spi(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length);
+int af_transport_set_spi_config_spi(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length);
 
 void arduino_spi_destroy(af_transport_t *af_transport);
 
+/**
+ * For ports that define AF_SPI_START_DMA: call this from the DMA completion interrupt once the frame it started is done.
+ */
+void arduino_spi_frame_complete(void);
+
 #endif /* AF_ARDUINO_SPI_TRANSPORT_H */
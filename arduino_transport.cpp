@@ -17,75 +17,31 @@
 #include "arduino_transport.h"
 #include "arduino_spi.h"
 #include "arduino_uart.h"
+#include "af_lib.h"
 
-typedef enum {
-    ARDUINO_TRANSPORT_SPI,
-    ARDUINO_TRANSPORT_UART
-} arduino_transport_t;
-
-static arduino_transport_t s_transport_type;
+// Each transport carries its own ops table, so all that's left here is picking the one to create
 
+#if AF_TRANSPORT_ENABLED(SPI)
 af_transport_t* arduino_transport_create_spi(int chipSelect) {
-    s_transport_type = ARDUINO_TRANSPORT_SPI;
     return arduino_spi_create(chipSelect, DEFAULT_SPI_FRAME_LEN);
 }
 
 
 af_transport_t* arduino_transport_create_spi(int chipSelect, uint16_t frame_length) {
-    s_transport_type = ARDUINO_TRANSPORT_SPI;
     return arduino_spi_create(chipSelect, frame_length);
 }
+#endif
 
+#if AF_TRANSPORT_ENABLED(UART)
 af_transport_t* arduino_transport_create_uart(uint8_t rxPin, uint8_t txPin, uint32_t baud_rate) {
-    s_transport_type = ARDUINO_TRANSPORT_UART;
     return arduino_uart_create(rxPin, txPin, baud_rate);
 }
 
-void arduino_transport_destroy(af_transport_t *af_transport) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        arduino_spi_destroy(af_transport);
-    } else {
-        arduino_uart_destroy(af_transport);
-    }
-}
-
-void af_transport_check_for_interrupt(af_transport_t *af_transport, volatile int *interrupts_pending, bool idle) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        af_transport_check_for_interrupt_spi(af_transport, interrupts_pending, idle);
-    } else {
-        af_transport_check_for_interrupt_uart(af_transport, interrupts_pending, idle);
-    }
-}
-
-int af_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        return af_transport_exchange_status_spi(af_transport, af_status_command_tx, af_status_command_rx);
-    } else {
-        return af_transport_exchange_status_uart(af_transport, af_status_command_tx, af_status_command_rx);
-    }
+af_transport_t* arduino_transport_create_uart(HardwareSerial *serial, uint32_t baud_rate) {
+    return arduino_uart_create_hardware(serial, baud_rate);
 }
+#endif
 
-int af_transport_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        return af_transport_write_status_spi(af_transport, af_status_command);
-    } else {
-        return af_transport_write_status_uart(af_transport, af_status_command);
-    }
-}
-
-void af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        af_transport_send_bytes_offset_spi(af_transport, bytes, bytes_to_send, offset);
-    } else {
-        af_transport_send_bytes_offset_uart(af_transport, bytes, bytes_to_send, offset);
-    }
-}
-
-int af_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
-    if (ARDUINO_TRANSPORT_SPI == s_transport_type) {
-        af_transport_recv_bytes_offset_spi(af_transport, bytes, bytes_len, bytes_to_recv, offset);
-    } else {
-        return af_transport_recv_bytes_offset_uart(af_transport, bytes, bytes_len, bytes_to_recv, offset);
-    }
-    return AF_SUCCESS;
+void arduino_transport_destroy(af_transport_t *af_transport) {
+    af_transport_destroy(af_transport);
 }
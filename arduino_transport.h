@@ -19,11 +19,19 @@
 
 #include "af_transport.h"
 
+class HardwareSerial;
+
 #define DEFAULT_SPI_FRAME_LEN                       ((uint16_t)16)
 
+#if AF_TRANSPORT_ENABLED(SPI)
 af_transport_t* arduino_transport_create_spi(int chipSelect);
 af_transport_t* arduino_transport_create_spi(int chipSelect, uint16_t frame_length);
+#endif
+#if AF_TRANSPORT_ENABLED(UART)
 af_transport_t* arduino_transport_create_uart(uint8_t rxPin, uint8_t txPin, uint32_t baud_rate);
+// Talk to the ASR over a hardware serial port such as Serial1, which transmits from its own interrupt
+af_transport_t* arduino_transport_create_uart(HardwareSerial *serial, uint32_t baud_rate);
+#endif
 
 void arduino_transport_destroy(af_transport_t *af_transport);
 
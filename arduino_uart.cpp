@@ -14,140 +14,339 @@
  * limitations under the License.
  */
 
-#include <SoftwareSerial.h>
-#include <SPI.h>
 #include "arduino_uart.h"
+
+#if AF_TRANSPORT_ENABLED(UART)
+
+#include <Arduino.h>
+#include <SoftwareSerial.h>
 #include "af_lib.h"
 #include "af_logger.h"
 #include "af_msg_types.h"
 #include "af_utils.h"
+#include "af_allocator.h"
 
 #define INT_CHAR                            0x32
 #define MAX_WAIT_TIME                       1000
 
+/* Bytes the transport holds between af_lib_loop() calls, a power of two no larger than 128.
+ * It has to fit a status reply plus whatever the ASR sends ahead of it.
+ */
+#ifndef AF_UART_RX_BUFFER_SIZE
+#define AF_UART_RX_BUFFER_SIZE              64
+#endif
+
+#if (AF_UART_RX_BUFFER_SIZE & (AF_UART_RX_BUFFER_SIZE - 1)) != 0 || AF_UART_RX_BUFFER_SIZE > 128
+#error "AF_UART_RX_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+/* Bytes queued for transmit, a power of two no larger than 128. Frames bigger than this go out as it drains. */
+#ifndef AF_UART_TX_BUFFER_SIZE
+#define AF_UART_TX_BUFFER_SIZE              64
+#endif
+
+#if (AF_UART_TX_BUFFER_SIZE & (AF_UART_TX_BUFFER_SIZE - 1)) != 0 || AF_UART_TX_BUFFER_SIZE > 128
+#error "AF_UART_TX_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+/* SoftwareSerial holds the CPU for every byte it writes, so only this many go out per af_lib_loop() call.
+ * At 9600 baud each byte takes about a millisecond.
+ */
+#ifndef AF_UART_SOFTWARE_TX_CHUNK
+#define AF_UART_SOFTWARE_TX_CHUNK           4
+#endif
+
+/* Highest baud rates afLib may negotiate for each kind of port. SoftwareSerial stops being reliable above
+ * 38400 on a 16MHz AVR.
+ */
+#ifndef AF_UART_SOFTWARE_MAX_BAUD_RATE
+#define AF_UART_SOFTWARE_MAX_BAUD_RATE      38400
+#endif
+
+#ifndef AF_UART_HARDWARE_MAX_BAUD_RATE
+#define AF_UART_HARDWARE_MAX_BAUD_RATE      115200
+#endif
+
 class ArduinoUART {
 public:
-    ArduinoUART(uint8_t rxPin, uint8_t txPin, uint32_t baud_rate);
+    ArduinoUART(SoftwareSerial *serial, uint32_t baud_rate);
+    ArduinoUART(HardwareSerial *serial, uint32_t baud_rate);
 
-    void checkForInterrupt(volatile int *interrupts_pending, bool idle);
+    void checkForInterrupt(int *interrupts_pending, bool idle);
     int exchangeStatus(af_status_command_t *tx, af_status_command_t *rx);
     int writeStatus(af_status_command_t *c);
     void sendBytes(uint8_t *bytes, int len);
-    int recvBytes(uint8_t *bytes, int len);
-    void sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset);
+    int sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset);
     int recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset);
+    bool hasWork();
+    void getBaudRate(uint32_t *baudRate, uint32_t *maxBaudRate);
+    void setBaudRate(uint32_t baudRate);
 
 private:
-    SoftwareSerial *_uart;
-
-    int available();
-    char peek();
-    int read(uint8_t *buffer, int len);
-    char read();
+    Stream *_uart;
+    HardwareSerial *_hardware;      // Set when _uart is a hardware port, which buffers and transmits from its own interrupt
+    SoftwareSerial *_software;      // Set otherwise
+    uint32_t _baudRate;
+
+    // Received bytes, indexes run freely and wrap at 256
+    uint8_t _rx[AF_UART_RX_BUFFER_SIZE];
+    uint8_t _rxHead;
+    uint8_t _rxTail;
+
+    // Bytes waiting to be handed to the serial port, same scheme as _rx
+    uint8_t _tx[AF_UART_TX_BUFFER_SIZE];
+    uint8_t _txHead;
+    uint8_t _txTail;
+
+    bool _statusSent;               // exchangeStatus has written its status and is waiting on the reply
+    bool _waiting;                  // A read is waiting on the ASR, since _waitStart
+    unsigned long _waitStart;
+
+    void fillRx();
+    uint8_t rxCount();
+    uint8_t rxPeek();
+    uint8_t rxRead();
+    int keepWaiting(bool progress);
+    uint8_t txCount();
+    void pumpTx();
     void write(uint8_t *buffer, int len);
 };
 
-struct af_transport_t {
+typedef struct {
+    af_transport_t base;                // Must be first
     ArduinoUART *arduinoUART;
+    SoftwareSerial *softwareSerial;     // Owned by the transport, NULL for a hardware port
+} arduino_uart_transport_t;
+
+#ifdef AF_TRANSPORT
+// Built alone, afLib calls this transport directly
+#define ARDUINO_UART_OPS                    NULL
+#else
+static const af_transport_ops_t s_uart_ops = {
+    af_transport_check_for_interrupt_uart,
+    af_transport_exchange_status_uart,
+    af_transport_write_status_uart,
+    af_transport_send_bytes_offset_uart,
+    af_transport_recv_bytes_offset_uart,
+    af_transport_has_work_uart,
+    af_transport_get_baud_rate_uart,
+    af_transport_set_baud_rate_uart,
+    NULL,
+    NULL,
+    arduino_uart_destroy,
 };
+#define ARDUINO_UART_OPS                    (&s_uart_ops)
+#endif
+
+static ArduinoUART *arduino_uart(af_transport_t *af_transport) {
+    return ((arduino_uart_transport_t *)af_transport)->arduinoUART;
+}
 
 af_transport_t* arduino_uart_create(uint8_t rxPin, uint8_t txPin, uint32_t baud_rate) {
-    af_transport_t* result = new af_transport_t();
-    result->arduinoUART = new ArduinoUART(rxPin, txPin, baud_rate);
-    return result;
+    pinMode(rxPin, INPUT);
+    pinMode(txPin, OUTPUT);
+
+#ifdef AF_LIB_NO_HEAP
+    // Only one UART transport without a heap, it's constructed the first time through
+    static SoftwareSerial s_softwareSerial(rxPin, txPin);
+    static ArduinoUART s_arduinoUART(&s_softwareSerial, baud_rate);
+    static arduino_uart_transport_t s_transport;
+    s_transport.base.ops = ARDUINO_UART_OPS;
+    s_transport.arduinoUART = &s_arduinoUART;
+    s_transport.softwareSerial = NULL;
+    return &s_transport.base;
+#else
+    arduino_uart_transport_t* result = new arduino_uart_transport_t();
+    result->base.ops = ARDUINO_UART_OPS;
+    result->softwareSerial = new SoftwareSerial(rxPin, txPin);
+    result->arduinoUART = new ArduinoUART(result->softwareSerial, baud_rate);
+    return &result->base;
+#endif
+}
+
+af_transport_t* arduino_uart_create_hardware(HardwareSerial *serial, uint32_t baud_rate) {
+#ifdef AF_LIB_NO_HEAP
+    static ArduinoUART s_arduinoUART(serial, baud_rate);
+    static arduino_uart_transport_t s_transport;
+    s_transport.base.ops = ARDUINO_UART_OPS;
+    s_transport.arduinoUART = &s_arduinoUART;
+    s_transport.softwareSerial = NULL;
+    return &s_transport.base;
+#else
+    arduino_uart_transport_t* result = new arduino_uart_transport_t();
+    result->base.ops = ARDUINO_UART_OPS;
+    result->softwareSerial = NULL;
+    result->arduinoUART = new ArduinoUART(serial, baud_rate);
+    return &result->base;
+#endif
 }
 
 void arduino_uart_destroy(af_transport_t *af_transport) {
-    delete af_transport->arduinoUART;
-    delete af_transport;
+#ifndef AF_LIB_NO_HEAP
+    arduino_uart_transport_t *transport = (arduino_uart_transport_t *)af_transport;
+    delete transport->arduinoUART;
+    delete transport->softwareSerial;
+    delete transport;
+#endif
 }
 
-void af_transport_check_for_interrupt_uart(af_transport_t *af_transport, volatile int *interrupts_pending, bool idle) {
-    af_transport->arduinoUART->checkForInterrupt(interrupts_pending, idle);
+void af_transport_check_for_interrupt_uart(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    arduino_uart(af_transport)->checkForInterrupt(interrupts_pending, idle);
 }
 
 int af_transport_exchange_status_uart(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
-    return af_transport->arduinoUART->exchangeStatus(af_status_command_tx, af_status_command_rx);
+    return arduino_uart(af_transport)->exchangeStatus(af_status_command_tx, af_status_command_rx);
 }
 
 int af_transport_write_status_uart(af_transport_t *af_transport, af_status_command_t *af_status_command) {
-    return af_transport->arduinoUART->writeStatus(af_status_command);
+    return arduino_uart(af_transport)->writeStatus(af_status_command);
 }
 
-void af_transport_send_bytes_offset_uart(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
-    af_transport->arduinoUART->sendBytesOffset(bytes, bytes_to_send, offset);
+int af_transport_send_bytes_offset_uart(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    return arduino_uart(af_transport)->sendBytesOffset(bytes, bytes_to_send, offset);
 }
 
 int af_transport_recv_bytes_offset_uart(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
-    return af_transport->arduinoUART->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+    return arduino_uart(af_transport)->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+}
+
+bool af_transport_has_work_uart(af_transport_t *af_transport) {
+    return arduino_uart(af_transport)->hasWork();
+}
+
+int af_transport_get_baud_rate_uart(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    arduino_uart(af_transport)->getBaudRate(baud_rate, max_baud_rate);
+    return AF_SUCCESS;
+}
+
+int af_transport_set_baud_rate_uart(af_transport_t *af_transport, uint32_t baud_rate) {
+    arduino_uart(af_transport)->setBaudRate(baud_rate);
+    return AF_SUCCESS;
 }
 
-ArduinoUART::ArduinoUART(uint8_t rxPin, uint8_t txPin, uint32_t baud_rate)
+ArduinoUART::ArduinoUART(SoftwareSerial *serial, uint32_t baud_rate)
+    : _uart(serial), _hardware(NULL), _software(serial), _baudRate(baud_rate), _rxHead(0), _rxTail(0), _txHead(0), _txTail(0), _statusSent(false), _waiting(false), _waitStart(0)
 {
-    pinMode(rxPin, INPUT);
-    pinMode(txPin, OUTPUT);
+    serial->begin(baud_rate);
+}
 
-    _uart = new SoftwareSerial(rxPin, txPin);
-    _uart->begin(baud_rate);
+ArduinoUART::ArduinoUART(HardwareSerial *serial, uint32_t baud_rate)
+    : _uart(serial), _hardware(serial), _software(NULL), _baudRate(baud_rate), _rxHead(0), _rxTail(0), _txHead(0), _txTail(0), _statusSent(false), _waiting(false), _waitStart(0)
+{
+    serial->begin(baud_rate);
 }
 
-int ArduinoUART::available()
+/**
+ * fillRx
+ *
+ * The serial driver buffers bytes from its receive interrupt. Move everything it has into our ring in one go so
+ * nothing here ever waits on the line.
+ */
+void ArduinoUART::fillRx()
 {
-    return _uart->available();
+    int b;
+
+    while (rxCount() < AF_UART_RX_BUFFER_SIZE && (b = _uart->read()) != -1) {
+        //af_logger_print_buffer("<"); af_logger_println_formatted_value(b, AF_LOGGER_HEX);
+        _rx[_rxHead++ & (AF_UART_RX_BUFFER_SIZE - 1)] = (uint8_t)b;
+    }
 }
 
-char ArduinoUART::peek()
+uint8_t ArduinoUART::rxCount()
 {
-    return _uart->peek();
+    return (uint8_t)(_rxHead - _rxTail);
 }
 
-char ArduinoUART::read()
+uint8_t ArduinoUART::rxPeek()
 {
-    return _uart->read();
+    return _rx[_rxTail & (AF_UART_RX_BUFFER_SIZE - 1)];
 }
 
-int ArduinoUART::read(uint8_t *buffer, int len)
+uint8_t ArduinoUART::rxRead()
 {
-    memset(buffer, 0, len);
-    for (int i = 0; i < len; i++) {
-        int b;
-        unsigned long time = af_utils_millis();
-        while (((b = _uart->read()) == -1)) {
-            if (af_utils_millis() - time > MAX_WAIT_TIME) {
-                return -1;
-            }
-        }
-        buffer[i] = (uint8_t )b;
-        //af_logger_print_buffer("<"); af_logger_println_formatted_value(buffer[i], AF_LOGGER_HEX);
+    return _rx[_rxTail++ & (AF_UART_RX_BUFFER_SIZE - 1)];
+}
+
+/**
+ * keepWaiting
+ *
+ * Called when a read is still short of bytes. Returns AF_ERROR_BUSY while it's worth waiting for more and
+ * AF_ERROR_TIMEOUT once nothing has arrived for MAX_WAIT_TIME.
+ */
+int ArduinoUART::keepWaiting(bool progress)
+{
+    unsigned long now = af_utils_millis();
+
+    if (!_waiting || progress) {
+        _waiting = true;
+        _waitStart = now;
+    } else if (now - _waitStart > MAX_WAIT_TIME) {
+        _waiting = false;
+        return AF_ERROR_TIMEOUT;
+    }
+    return AF_ERROR_BUSY;
+}
+
+uint8_t ArduinoUART::txCount()
+{
+    return (uint8_t)(_txHead - _txTail);
+}
+
+/**
+ * pumpTx
+ *
+ * Hand the serial port as many queued bytes as it can take without making us wait.
+ */
+void ArduinoUART::pumpTx()
+{
+    int room = (_hardware != NULL) ? _hardware->availableForWrite() : AF_UART_SOFTWARE_TX_CHUNK;
+
+    while (room-- > 0 && txCount() > 0) {
+        //af_logger_print_buffer(">"); af_logger_println_formatted_value(_tx[_txTail & (AF_UART_TX_BUFFER_SIZE - 1)], AF_LOGGER_HEX);
+        _uart->write(_tx[_txTail++ & (AF_UART_TX_BUFFER_SIZE - 1)]);
     }
-    return len;
 }
 
+/**
+ * write
+ *
+ * Queue bytes for transmit. Only waits on the port if the queue is too full to take them all.
+ */
 void ArduinoUART::write(uint8_t *buffer, int len)
 {
     for (int i = 0; i < len; i++) {
-//        af_logger_print_buffer(">"); af_logger_println_formatted_value(buffer[i], AF_LOGGER_HEX);
-        _uart->write(buffer[i]);
+        while (txCount() >= AF_UART_TX_BUFFER_SIZE) {
+            pumpTx();
+        }
+        _tx[_txHead++ & (AF_UART_TX_BUFFER_SIZE - 1)] = buffer[i];
     }
+    pumpTx();
 }
 
-void ArduinoUART::checkForInterrupt(volatile int *interrupts_pending, bool idle) {
-    if (available()) {
-        if (peek() == INT_CHAR) {
+void ArduinoUART::checkForInterrupt(int *interrupts_pending, bool idle) {
+    pumpTx();
+    fillRx();
+
+    while (rxCount() > 0) {
+        if (rxPeek() == INT_CHAR) {
             if (*interrupts_pending == 0) {
                 //af_logger_println_buffer("INT");
-                read();
+                rxRead();
                 *interrupts_pending += 1;
+                // No longer idle, anything after this belongs to the transfer it starts
+                break;
             } else if (idle) {
-                read();
+                rxRead();
             } else {
                 //af_logger_println_buffer("INT(Pending)");
+                break;
             }
         } else {
-            if (*interrupts_pending == 0) {
-                //af_logger_print_buffer("Skipping: "); af_logger_println_formatted_value(peek(), AF_LOGGER_HEX);
-                read();
+            if (*interrupts_pending != 0) {
+                break;
             }
+            //af_logger_print_buffer("Skipping: "); af_logger_println_formatted_value(rxPeek(), AF_LOGGER_HEX);
+            rxRead();
         }
     }
 }
@@ -160,30 +359,38 @@ int ArduinoUART::exchangeStatus(af_status_command_t *tx, af_status_command_t *rx
     int index = 0;
     af_status_command_get_bytes(tx, bytes);
 
-    for (int i=0; i < len; i++)
-    {
-        rbytes[i]=bytes[i];
+    if (!_statusSent) {
+        for (int i=0; i < len; i++)
+        {
+            rbytes[i]=bytes[i];
+        }
+        rbytes[len]=af_status_command_get_checksum(tx);
+        sendBytes(rbytes, len + 1);
+        _statusSent = true;
+        _waiting = false;
     }
-    rbytes[len]=af_status_command_get_checksum(tx);
-    sendBytes(rbytes, len + 1);
+
+    pumpTx();
+    fillRx();
 
     // Skip any interrupts that may have come in.
-    int read_result = recvBytes(rbytes, 1);
-    if (read_result < 0) {
-        return AF_ERROR_TIMEOUT;
+    while (rxCount() > 0 && rxPeek() == INT_CHAR) {
+        rxRead();
     }
-    while (rbytes[0] == INT_CHAR) {
-        read_result = recvBytes(rbytes, 1);
-        if (read_result < 0) {
-            return AF_ERROR_TIMEOUT;
+
+    // Wait for the whole reply to be in before taking any of it
+    if (rxCount() < len + 1) {
+        result = keepWaiting(false);
+        if (result != AF_ERROR_BUSY) {
+            _statusSent = false;
         }
+        return result;
     }
-
-    // Okay, we have a good first char, now read the rest.
-    read_result = recvBytes(&rbytes[1], len);
-    if (read_result < 0) {
-        return AF_ERROR_TIMEOUT;
+    for (int i = 0; i < len + 1; i++) {
+        rbytes[i] = rxRead();
     }
+    _statusSent = false;
+    _waiting = false;
 
     uint8_t cmd = bytes[index++];
     if (cmd != SYNC_REQUEST && cmd != SYNC_ACK) {
@@ -232,22 +439,29 @@ void ArduinoUART::sendBytes(uint8_t *bytes, int len) {
     write(bytes, len);
 }
 
-int ArduinoUART::recvBytes(uint8_t *bytes, int len) {
-    return read(bytes, len);
-}
-
-void ArduinoUART::sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset)
+int ArduinoUART::sendBytesOffset(uint8_t *bytes, uint16_t *bytesToSend, uint16_t *offset)
 {
     uint16_t len = 0;
 
-    len = *bytesToSend;
+    pumpTx();
 
-    sendBytes(bytes, len);
+    // Queue as much as there's room for, the rest waits for a later call
+    len = AF_UART_TX_BUFFER_SIZE - txCount();
+    if (len > *bytesToSend) {
+        len = *bytesToSend;
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        _tx[_txHead++ & (AF_UART_TX_BUFFER_SIZE - 1)] = bytes[*offset + i];
+    }
+    pumpTx();
 
 //  dumpBytes("Sending:", len, bytes);
 
     *offset += len;
     *bytesToSend -= len;
+
+    // The frame isn't sent until the last of it has been handed to the port
+    return txCount() > 0 ? AF_ERROR_BUSY : AF_SUCCESS;
 }
 
 int ArduinoUART::recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *bytesToRecv, uint16_t *offset)
@@ -258,14 +472,24 @@ int ArduinoUART::recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *
 
     if (*offset == 0) {
         *bytesLen = *bytesToRecv;
-        *bytes = (uint8_t*)malloc(*bytesLen);
+        if (*bytes == NULL) {
+            *bytes = (uint8_t*)af_allocator_malloc(*bytesLen);
+            if (*bytes == NULL) {
+                return AF_ERROR_UNKNOWN;
+            }
+        }
     }
 
     uint8_t * start = *bytes + *offset;
 
-    int read_result = recvBytes(start, len);
-    if (read_result < 0) {
-        return AF_ERROR_TIMEOUT;
+    // Take whatever has arrived, afLib calls again for the rest
+    pumpTx();
+    fillRx();
+    if (len > rxCount()) {
+        len = rxCount();
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        start[i] = rxRead();
     }
 
 //  dumpBytes("Receiving:", len, _readBuffer);
@@ -273,5 +497,88 @@ int ArduinoUART::recvBytesOffset(uint8_t **bytes, uint16_t *bytesLen, uint16_t *
     *offset += len;
     *bytesToRecv -= len;
 
+    if (*bytesToRecv > 0) {
+        return keepWaiting(len > 0);
+    }
+    _waiting = false;
+
     return AF_SUCCESS;
 }
+
+bool ArduinoUART::hasWork()
+{
+    return txCount() > 0 || rxCount() > 0 || _uart->available() > 0;
+}
+
+void ArduinoUART::getBaudRate(uint32_t *baudRate, uint32_t *maxBaudRate)
+{
+    *baudRate = _baudRate;
+    *maxBaudRate = (_hardware != NULL) ? AF_UART_HARDWARE_MAX_BAUD_RATE : AF_UART_SOFTWARE_MAX_BAUD_RATE;
+}
+
+void ArduinoUART::setBaudRate(uint32_t baudRate)
+{
+    // Whatever is still queued was meant for the old rate
+    while (txCount() > 0) {
+        pumpTx();
+    }
+    if (_hardware != NULL) {
+        _hardware->flush();
+        _hardware->end();
+        _hardware->begin(baudRate);
+    } else {
+        _software->begin(baudRate);
+    }
+    _baudRate = baudRate;
+}
+
+#ifdef AF_TRANSPORT
+/*
+ * The only transport in the build, so these are afLib's transport calls
+ */
+void af_transport_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    arduino_uart(af_transport)->checkForInterrupt(interrupts_pending, idle);
+}
+
+int af_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
+    return arduino_uart(af_transport)->exchangeStatus(af_status_command_tx, af_status_command_rx);
+}
+
+int af_transport_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
+    return arduino_uart(af_transport)->writeStatus(af_status_command);
+}
+
+int af_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    return arduino_uart(af_transport)->sendBytesOffset(bytes, bytes_to_send, offset);
+}
+
+int af_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    return arduino_uart(af_transport)->recvBytesOffset(bytes, bytes_len, bytes_to_recv, offset);
+}
+
+bool af_transport_has_work(af_transport_t *af_transport) {
+    return arduino_uart(af_transport)->hasWork();
+}
+
+int af_transport_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    return af_transport_get_baud_rate_uart(af_transport, baud_rate, max_baud_rate);
+}
+
+int af_transport_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate) {
+    return af_transport_set_baud_rate_uart(af_transport, baud_rate);
+}
+
+int af_transport_get_spi_config(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length) {
+    return AF_ERROR_NOT_SUPPORTED;
+}
+
+int af_transport_set_spi_config(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length) {
+    return AF_ERROR_NOT_SUPPORTED;
+}
+
+void af_transport_destroy(af_transport_t *af_transport) {
+    arduino_uart_destroy(af_transport);
+}
+#endif /* AF_TRANSPORT */
+
+#endif /* AF_TRANSPORT_ENABLED(UART) */
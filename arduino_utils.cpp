@@ -19,4 +19,8 @@
 
 long af_utils_millis() {
     return millis();
+}
+
+uint32_t af_utils_micros() {
+    return micros();
 }
\ No newline at end of file
@@ -26,6 +26,8 @@
 
    void arduino_logger_start(int baud_rate);
    void arduino_logger_stop();
+   void arduino_logger_flush();
+   uint32_t arduino_logger_dropped();
 
    The Arduino implementation uses the default "Serial" console output, so all you have to
    give it is a baud rate for your console interface. Other platforms may require different
@@ -34,6 +36,12 @@
    The use of "_logger_stop()" is optional and only needed if you need to reuse the debug
    interface for some other use.
 
+   Logging doesn't wait for the console: messages are buffered and written out as the
+   serial port has room, each time af_lib_loop() runs or a message is logged. A message
+   that doesn't fit in the buffer is dropped, and arduino_logger_dropped() says how many
+   have been. To log more than the buffer holds in one go, as this demo does, call
+   arduino_logger_flush() in between to wait for the console to catch up.
+
    Functions available in the platform-independent af_logger subsystem:
 
    void af_logger_print_value(int32_t val);
@@ -64,11 +72,13 @@ void setup() {
   af_logger_println_buffer("afLib af_logger logging subsystem demo");
   af_logger_println_buffer("--------------------------------------");
   af_logger_println_buffer("");   // prints a blank newline
+  arduino_logger_flush();
 
   af_logger_print_buffer("The Ultimate Answer to Life, the Universe, and Everything is: ");
   uint8_t answer = 0x2a;
   af_logger_println_value(answer);
   af_logger_println_buffer("");
+  arduino_logger_flush();
 
   af_logger_print_buffer("Party in octal like it's ");
   af_logger_println_formatted_value(1999, AF_LOGGER_OCT);
@@ -78,6 +88,7 @@ void setup() {
   af_logger_print_formatted_value(24, AF_LOGGER_BIN);
   af_logger_println_buffer(" hours in a binary day.");
   af_logger_println_buffer("");
+  arduino_logger_flush();
 
   uint32_t ph = 8675309;
   af_logger_print_value(ph);
@@ -0,0 +1,1166 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asr_sim.h"
+#include "af_lib.h"
+#include "af_module_states.h"
+#include "af_msg_types.h"
+#include "af_utils.h"
+
+// Attributes the ASR answers for itself, matching the ones af_lib.c uses
+#define ATTR_ASR_CAPABILITIES               AF_ATTRIBUTE_ID_ASR_CAPABILITIES
+#define ATTR_AFLIB_PROTOCOL_VERSION         1209
+#define ATTR_DEVICE_PROTOCOL_VERSION        1208
+#define ATTR_APPLICATION_VERSION            2003
+#define ATTR_SYSTEM_COMMAND                 65012
+#define ATTR_ASR_STATE                      AF_SYSTEM_ASR_STATE_ATTR_ID
+#define ATTR_UART_CONFIG                    65000
+#define ATTR_SPI_CONFIG                     65069
+
+#define SYSTEM_COMMAND_REBOOT               1
+#define UART_CONFIG_LEN                     4
+#define SPI_CONFIG_LEN                      10
+
+// ASR versions after this one report AF_MODULE_STATE_INITIALIZED rather than AF_MODULE_STATE_LINKED once they're up
+#define VERSION_STATE_EXTENSIONS            0x5062
+
+// The command byte, both byte counts and the checksum
+#define STATUS_LEN                          6
+
+// How long an interrupt asking for a sync can go unanswered before the ASR asks again
+#define ATTENTION_RETRY_US                  1000000
+
+// Commands the ASR can have waiting for afLib, anything beyond this is dropped like a module would
+#define SEND_QUEUE_SIZE                     32
+
+// What asr_sim_peek can have lined up, a transfer never needs more than a few
+#define TOKEN_QUEUE_SIZE                    16
+
+static const uint32_t s_uart_baud_rates[] = { 4800, 9600, 38400, 115200 };
+#define UART_BAUD_RATE_COUNT                (sizeof(s_uart_baud_rates) / sizeof(s_uart_baud_rates[0]))
+
+// Where the handshake is
+#define HANDSHAKE_IDLE                      0
+#define HANDSHAKE_SYNCED                    1   // Replied to a sync, waiting for the ack
+#define HANDSHAKE_RECEIVING                 2
+#define HANDSHAKE_SENDING                   3
+
+// Where the boot sequence is
+#define BOOT_DOWN                           0   // Rebooting, nothing is answered
+#define BOOT_ANNOUNCED                      1   // Protocol version sent, waiting for afLib's
+#define BOOT_UP                             2
+
+typedef struct {
+    uint16_t attr_id;
+    uint8_t reject_state;   // Sets from afLib are rejected with this state, UPDATE_STATE_UPDATED to accept them
+    bool is_default;        // Sent to afLib as a set default once the ASR is up
+    uint16_t value_len;
+    uint8_t *value;
+} sim_attr_t;
+
+typedef struct {
+    long at;                // Milliseconds after the simulator was created
+    long every;             // 0 to run once
+    char *line;
+} sim_event_t;
+
+typedef struct {
+    uint8_t *bytes;         // The length followed by the command
+    uint16_t len;
+    bool switches_link;     // Apply the pending link change once this has gone out
+} sim_frame_t;
+
+typedef struct {
+    uint8_t kind;
+    uint32_t due;
+} sim_token_t;
+
+struct asr_sim_t {
+    bool spi;
+    uint32_t rate;
+    uint16_t frame_length;
+    uint32_t base_rate;
+    uint16_t base_frame_length;
+    uint32_t max_rate;
+    uint16_t max_frame_length;
+    uint32_t next_rate;
+    uint16_t next_frame_length;
+    bool link_switching;    // The change goes through with the interrupt that ends the transfer
+
+    uint32_t latency_us;
+    uint32_t reboot_us;
+    uint8_t protocol_version;
+    uint16_t collide_every;
+    uint16_t corrupt_every;
+    uint32_t data_syncs;
+    uint32_t replies;
+
+    uint8_t boot;
+    uint32_t boot_at;
+
+    uint8_t handshake;
+    uint16_t to_recv;
+    uint16_t to_send;
+    uint16_t tx_offset;
+    bool attention;         // An interrupt asking for a sync is lined up
+    uint32_t attention_at;
+    bool reboot_requested;
+    uint8_t reply[STATUS_LEN];
+
+    uint8_t *rx;
+    uint16_t rx_len;
+    uint16_t rx_size;
+
+    sim_frame_t queue[SEND_QUEUE_SIZE];
+    uint8_t queue_head;
+    uint8_t queue_count;
+
+    uint8_t reorder;        // Answers to afLib's gets and sets held back until there are this many
+    sim_frame_t held[SEND_QUEUE_SIZE];
+    uint8_t held_count;
+
+    sim_token_t tokens[TOKEN_QUEUE_SIZE];
+    uint8_t token_head;
+    uint8_t token_count;
+    uint32_t line_free;     // When the ASR's side of the bus is next free
+
+    sim_attr_t *attrs;
+    uint16_t attr_count;
+    sim_event_t *events;
+    uint16_t event_count;
+    long start;
+
+    uint8_t request_id;
+    uint16_t sets_outstanding;
+    asr_sim_stats_t stats;
+};
+
+static bool is_due(uint32_t due, uint32_t now) {
+    return (int32_t)(now - due) >= 0;
+}
+
+/**
+ * wire_time
+ *
+ * Microseconds len bytes take on the bus: ten bits a byte on a UART, eight on SPI.
+ */
+static uint32_t wire_time(asr_sim_t *sim, uint32_t len) {
+    return (uint32_t)((uint64_t)len * (sim->spi ? 8 : 10) * 1000000 / sim->rate);
+}
+
+/**
+ * schedule
+ *
+ * Line up something for afLib. It goes once the ASR has taken in_len bytes off the bus and thought about them for the
+ * latency, and no sooner than the bus is free; out_len is how long it then has the bus for.
+ */
+static void schedule(asr_sim_t *sim, uint8_t kind, uint16_t in_len, uint16_t out_len) {
+    uint32_t now = af_utils_micros();
+    uint32_t due = now + wire_time(sim, in_len) + sim->latency_us;
+    sim_token_t *token;
+
+    if (!is_due(sim->line_free, due)) {
+        due = sim->line_free;
+    }
+    if (sim->spi && ASR_SIM_STATUS == kind) {
+        // Clocked out while afLib's status is clocked in
+        due = now;
+    }
+    sim->line_free = due + wire_time(sim, out_len);
+
+    if (TOKEN_QUEUE_SIZE == sim->token_count) {
+        return;
+    }
+    token = &sim->tokens[(sim->token_head + sim->token_count) % TOKEN_QUEUE_SIZE];
+    token->kind = kind;
+    token->due = due;
+    sim->token_count++;
+}
+
+static void schedule_interrupt(asr_sim_t *sim, uint16_t in_len) {
+    schedule(sim, ASR_SIM_INTERRUPT, in_len, sim->spi ? 0 : 1);
+}
+
+static sim_attr_t *find_attr(asr_sim_t *sim, uint16_t attr_id) {
+    uint16_t i;
+
+    for (i = 0; i < sim->attr_count; i++) {
+        if (sim->attrs[i].attr_id == attr_id) {
+            return &sim->attrs[i];
+        }
+    }
+    return NULL;
+}
+
+static sim_attr_t *add_attr(asr_sim_t *sim, uint16_t attr_id) {
+    sim_attr_t *attr = find_attr(sim, attr_id);
+    sim_attr_t *attrs;
+
+    if (attr != NULL) {
+        return attr;
+    }
+    attrs = (sim_attr_t *)realloc(sim->attrs, (sim->attr_count + 1) * sizeof(sim_attr_t));
+    if (NULL == attrs) {
+        return NULL;
+    }
+    sim->attrs = attrs;
+    attr = &sim->attrs[sim->attr_count++];
+    memset(attr, 0, sizeof(sim_attr_t));
+    attr->attr_id = attr_id;
+    return attr;
+}
+
+static int store_attr(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    sim_attr_t *attr = add_attr(sim, attr_id);
+    uint8_t *copy;
+
+    if (NULL == attr) {
+        return AF_ERROR_UNKNOWN;
+    }
+    copy = (uint8_t *)malloc(value_len > 0 ? value_len : 1);
+    if (NULL == copy) {
+        return AF_ERROR_UNKNOWN;
+    }
+    memcpy(copy, value, value_len);
+    free(attr->value);
+    attr->value = copy;
+    attr->value_len = value_len;
+    return AF_SUCCESS;
+}
+
+/**
+ * queue_command
+ *
+ * Frame up a command for afLib the way af_command.c expects it: updates and rejections carry a state and reason,
+ * everything but a get and a rejection carries a value.
+ */
+static sim_frame_t *queue_command(asr_sim_t *sim, uint8_t cmd, uint8_t request_id, uint16_t attr_id, uint8_t state, uint8_t reason,
+                                  uint16_t value_len, const uint8_t *value) {
+    sim_frame_t *frame;
+    uint8_t *bytes;
+    uint16_t len = 2 + 4;
+
+    if (MSG_TYPE_UPDATE == cmd || MSG_TYPE_UPDATE_REJECTED == cmd) {
+        len += 2;
+    }
+    if (cmd != MSG_TYPE_GET && cmd != MSG_TYPE_UPDATE_REJECTED) {
+        len += 2 + value_len;
+    }
+
+    if (SEND_QUEUE_SIZE == sim->queue_count || BOOT_DOWN == sim->boot) {
+        sim->stats.dropped++;
+        return NULL;
+    }
+    bytes = (uint8_t *)malloc(len);
+    if (NULL == bytes) {
+        sim->stats.dropped++;
+        return NULL;
+    }
+
+    af_utils_write_little_endian_16(len - 2, bytes);
+    bytes[2] = cmd;
+    bytes[3] = request_id;
+    af_utils_write_little_endian_16(attr_id, &bytes[4]);
+    len = 6;
+    if (MSG_TYPE_UPDATE == cmd || MSG_TYPE_UPDATE_REJECTED == cmd) {
+        bytes[len++] = state;
+        bytes[len++] = reason;
+    }
+    if (cmd != MSG_TYPE_GET && cmd != MSG_TYPE_UPDATE_REJECTED) {
+        af_utils_write_little_endian_16(value_len, &bytes[len]);
+        memcpy(&bytes[len + 2], value, value_len);
+        len += 2 + value_len;
+    }
+
+    frame = &sim->queue[(sim->queue_head + sim->queue_count) % SEND_QUEUE_SIZE];
+    frame->bytes = bytes;
+    frame->len = len;
+    frame->switches_link = false;
+    sim->queue_count++;
+    return frame;
+}
+
+static sim_frame_t *queue_update(asr_sim_t *sim, uint8_t request_id, uint16_t attr_id, uint8_t state, uint8_t reason, uint16_t value_len, const uint8_t *value) {
+    return queue_command(sim, MSG_TYPE_UPDATE, request_id, attr_id, state, reason, value_len, value);
+}
+
+static void clear_queue(asr_sim_t *sim) {
+    while (sim->queue_count > 0) {
+        free(sim->queue[sim->queue_head].bytes);
+        sim->queue_head = (sim->queue_head + 1) % SEND_QUEUE_SIZE;
+        sim->queue_count--;
+    }
+    while (sim->held_count > 0) {
+        free(sim->held[--sim->held_count].bytes);
+    }
+}
+
+/**
+ * hold_answer
+ *
+ * With reorder set, take the answer to a get or set just queued back out of the queue until there are reorder of
+ * them, then queue them all again newest first. Nothing is held back while the ASR is booting.
+ */
+static void hold_answer(asr_sim_t *sim, sim_frame_t *frame) {
+    if (NULL == frame || sim->reorder < 2 || sim->boot != BOOT_UP) {
+        return;
+    }
+    // queue_command always adds to the end, so it's the last one
+    sim->held[sim->held_count++] = *frame;
+    sim->queue_count--;
+    if (sim->held_count < sim->reorder) {
+        return;
+    }
+    while (sim->held_count > 0) {
+        frame = &sim->held[--sim->held_count];
+        if (SEND_QUEUE_SIZE == sim->queue_count) {
+            sim->stats.dropped++;
+            free(frame->bytes);
+            continue;
+        }
+        sim->queue[(sim->queue_head + sim->queue_count) % SEND_QUEUE_SIZE] = *frame;
+        sim->queue_count++;
+    }
+}
+
+static void reset_link(asr_sim_t *sim) {
+    sim->rate = sim->base_rate;
+    sim->frame_length = sim->base_frame_length;
+    sim->link_switching = false;
+}
+
+static void switch_link(asr_sim_t *sim) {
+    sim->rate = sim->next_rate;
+    sim->frame_length = sim->next_frame_length;
+    sim->link_switching = false;
+    sim->stats.link_changes++;
+}
+
+/**
+ * finish_boot
+ *
+ * Tell afLib which firmware this is and that the ASR is up, then hand out the set defaults.
+ */
+static void finish_boot(asr_sim_t *sim) {
+    const sim_attr_t *version = find_attr(sim, ATTR_APPLICATION_VERSION);
+    uint8_t state = AF_MODULE_STATE_LINKED;
+    uint16_t i;
+
+    sim->boot = BOOT_UP;
+    if (version != NULL && version->value_len >= 8 && af_utils_read_little_endian_64(version->value) > VERSION_STATE_EXTENSIONS) {
+        state = AF_MODULE_STATE_INITIALIZED;
+    }
+    if (version != NULL) {
+        queue_update(sim, 0, ATTR_APPLICATION_VERSION, UPDATE_STATE_UPDATED, UPDATE_REASON_LOCAL_OR_MCU_UPDATE, version->value_len, version->value);
+    }
+    store_attr(sim, ATTR_ASR_STATE, 1, &state);
+    queue_update(sim, 0, ATTR_ASR_STATE, UPDATE_STATE_UPDATED, UPDATE_REASON_NOTIFY_MCU_WE_REBOOTED, 1, &state);
+
+    for (i = 0; i < sim->attr_count; i++) {
+        if (sim->attrs[i].is_default) {
+            queue_command(sim, MSG_TYPE_SET_DEFAULT, 0, sim->attrs[i].attr_id, 0, 0, sim->attrs[i].value_len, sim->attrs[i].value);
+        }
+    }
+}
+
+/**
+ * boot
+ *
+ * Come back up on the link's base settings and announce the protocol version, afLib answers with its own before the
+ * rest of the sequence goes out. ASRs older than protocol 2 don't wait for it.
+ */
+static void boot(asr_sim_t *sim) {
+    uint8_t version[2];
+
+    reset_link(sim);
+    sim->handshake = HANDSHAKE_IDLE;
+    if (sim->protocol_version >= 2) {
+        sim->boot = BOOT_ANNOUNCED;
+        af_utils_write_little_endian_16(sim->protocol_version, version);
+        queue_update(sim, 0, ATTR_DEVICE_PROTOCOL_VERSION, UPDATE_STATE_UPDATED, UPDATE_REASON_LOCAL_OR_MCU_UPDATE, sizeof(version), version);
+    } else {
+        finish_boot(sim);
+    }
+}
+
+/**
+ * link_config
+ *
+ * The MCU UART or SPI Config value for where the ASR's end of the link is, or for a get, how fast it can go.
+ */
+static uint16_t link_config(asr_sim_t *sim, uint16_t attr_id, uint8_t *config) {
+    uint8_t i;
+
+    memset(config, 0, SPI_CONFIG_LEN);
+    if (ATTR_UART_CONFIG == attr_id) {
+        for (i = 0; i < UART_BAUD_RATE_COUNT; i++) {
+            if (s_uart_baud_rates[i] == sim->rate) {
+                config[0] = i;
+            }
+        }
+        config[1] = 8;
+        config[3] = 1;
+        return UART_CONFIG_LEN;
+    }
+    af_utils_write_little_endian_32(sim->max_rate, config);
+    af_utils_write_little_endian_16(sim->max_frame_length, config + 4);
+    return SPI_CONFIG_LEN;
+}
+
+/**
+ * on_link_set
+ *
+ * afLib wants the link faster. Agree if it's within the ASR's limits and switch once the reply has gone out.
+ */
+static void on_link_set(asr_sim_t *sim, uint8_t request_id, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    sim_frame_t *frame;
+    uint32_t rate = 0;
+    uint16_t frame_length = 0;
+    bool ok;
+
+    if (ATTR_UART_CONFIG == attr_id) {
+        ok = !sim->spi && value_len >= UART_CONFIG_LEN && value[0] < UART_BAUD_RATE_COUNT && s_uart_baud_rates[value[0]] <= sim->max_rate;
+        if (ok) {
+            rate = s_uart_baud_rates[value[0]];
+        }
+    } else {
+        ok = sim->spi && value_len >= SPI_CONFIG_LEN;
+        if (ok) {
+            rate = af_utils_read_little_endian_32(value);
+            frame_length = af_utils_read_little_endian_16(value + 4);
+            ok = rate > 0 && rate <= sim->max_rate && frame_length > 0 && frame_length <= sim->max_frame_length;
+        }
+    }
+
+    if (!ok) {
+        sim->stats.rejected++;
+        queue_command(sim, MSG_TYPE_UPDATE_REJECTED, request_id, attr_id, UPDATE_STATE_FORBIDDEN, UPDATE_REASON_INTERNAL_SET_REJECTED, 0, NULL);
+        return;
+    }
+    frame = queue_command(sim, MSG_TYPE_UPDATE, request_id, attr_id, UPDATE_STATE_UPDATED, UPDATE_REASON_MCU_SET, value_len, value);
+    if (frame != NULL) {
+        frame->switches_link = true;
+        sim->next_rate = rate;
+        sim->next_frame_length = frame_length;
+    }
+}
+
+static void on_get(asr_sim_t *sim, uint8_t request_id, uint16_t attr_id) {
+    const sim_attr_t *attr = find_attr(sim, attr_id);
+    uint8_t config[SPI_CONFIG_LEN];
+
+    sim->stats.gets++;
+    if ((ATTR_UART_CONFIG == attr_id && !sim->spi) || (ATTR_SPI_CONFIG == attr_id && sim->spi)) {
+        queue_update(sim, request_id, attr_id, UPDATE_STATE_UPDATED, UPDATE_REASON_GET_RESPONSE, link_config(sim, attr_id, config), config);
+    } else if (attr != NULL && attr->value != NULL) {
+        hold_answer(sim, queue_update(sim, request_id, attr_id, UPDATE_STATE_UPDATED, UPDATE_REASON_GET_RESPONSE, attr->value_len, attr->value));
+    } else {
+        hold_answer(sim, queue_update(sim, request_id, attr_id, UPDATE_STATE_UNKNOWN_UUID, UPDATE_REASON_GET_RESPONSE, 0, NULL));
+    }
+}
+
+static void on_set(asr_sim_t *sim, uint8_t request_id, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    const sim_attr_t *attr = find_attr(sim, attr_id);
+
+    sim->stats.sets++;
+    if (ATTR_UART_CONFIG == attr_id || ATTR_SPI_CONFIG == attr_id) {
+        on_link_set(sim, request_id, attr_id, value_len, value);
+        return;
+    }
+    if (ATTR_SYSTEM_COMMAND == attr_id && value_len > 0 && SYSTEM_COMMAND_REBOOT == value[0]) {
+        // Goes down as soon as the transfer is done, without answering
+        sim->reboot_requested = true;
+        return;
+    }
+    if (attr != NULL && attr->reject_state != UPDATE_STATE_UPDATED) {
+        sim->stats.rejected++;
+        hold_answer(sim, queue_command(sim, MSG_TYPE_UPDATE_REJECTED, request_id, attr_id, attr->reject_state, UPDATE_REASON_INTERNAL_SET_REJECTED, 0, NULL));
+        return;
+    }
+
+    store_attr(sim, attr_id, value_len, value);
+    hold_answer(sim, queue_update(sim, request_id, attr_id, UPDATE_STATE_UPDATED, UPDATE_REASON_MCU_SET, value_len, value));
+    if (ATTR_AFLIB_PROTOCOL_VERSION == attr_id && BOOT_ANNOUNCED == sim->boot) {
+        finish_boot(sim);
+    }
+}
+
+static void on_update(asr_sim_t *sim, uint16_t attr_id, uint8_t reason, uint16_t value_len, const uint8_t *value) {
+    sim->stats.updates++;
+    if (UPDATE_REASON_SERVICE_SET == reason && sim->sets_outstanding > 0) {
+        sim->sets_outstanding--;
+        sim->stats.set_responses++;
+    }
+    store_attr(sim, attr_id, value_len, value);
+}
+
+/**
+ * on_frames
+ *
+ * Everything afLib sent in one transfer, which may be several commands back to back when it batches.
+ */
+static void on_frames(asr_sim_t *sim, const uint8_t *bytes, uint16_t len) {
+    uint16_t frame_len;
+    uint16_t value_len;
+    uint16_t attr_id;
+    uint8_t cmd;
+
+    while (len >= 2) {
+        frame_len = af_utils_read_little_endian_16(bytes);
+        if (frame_len < 4 || frame_len > len - 2) {
+            sim->stats.bad_status++;
+            return;
+        }
+        sim->stats.frames_in++;
+        cmd = bytes[2];
+        attr_id = af_utils_read_little_endian_16(&bytes[4]);
+
+        if (MSG_TYPE_GET == cmd) {
+            on_get(sim, bytes[3], attr_id);
+        } else if (MSG_TYPE_SET == cmd && frame_len >= 6) {
+            value_len = af_utils_read_little_endian_16(&bytes[6]);
+            if (value_len <= frame_len - 6) {
+                on_set(sim, bytes[3], attr_id, value_len, &bytes[8]);
+            }
+        } else if (MSG_TYPE_UPDATE == cmd && frame_len >= 8) {
+            value_len = af_utils_read_little_endian_16(&bytes[8]);
+            if (value_len <= frame_len - 8) {
+                on_update(sim, attr_id, bytes[7], value_len, &bytes[10]);
+            }
+        } else {
+            sim->stats.bad_status++;
+        }
+
+        bytes += frame_len + 2;
+        len -= frame_len + 2;
+    }
+}
+
+/**
+ * end_transfer
+ *
+ * The transfer is over: the last interrupt has been lined up, so a reboot afLib asked for can happen now.
+ */
+static void end_transfer(asr_sim_t *sim) {
+    sim->handshake = HANDSHAKE_IDLE;
+    if (sim->reboot_requested) {
+        sim->reboot_requested = false;
+        asr_sim_reboot(sim);
+    }
+}
+
+/**
+ * run_events
+ *
+ * Run the script's timed commands that are due. They wait while the ASR is down, except for reboots.
+ */
+static void run_events(asr_sim_t *sim) {
+    long elapsed = af_utils_millis() - sim->start;
+    sim_event_t *event;
+    uint16_t i;
+
+    for (i = 0; i < sim->event_count; i++) {
+        event = &sim->events[i];
+        if (event->at < 0 || event->at > elapsed || (sim->boot != BOOT_UP && strncmp(event->line, "reboot", 6) != 0)) {
+            continue;
+        }
+        event->at = event->every > 0 ? event->at + event->every : -1;
+        asr_sim_script(sim, event->line);
+    }
+}
+
+asr_sim_t *asr_sim_create(void) {
+    asr_sim_t *sim = (asr_sim_t *)malloc(sizeof(asr_sim_t));
+    uint8_t value[8];
+
+    if (NULL == sim) {
+        return NULL;
+    }
+    memset(sim, 0, sizeof(asr_sim_t));
+    sim->base_rate = sim->rate = 9600;
+    sim->max_rate = 115200;
+    sim->latency_us = 200;
+    sim->reboot_us = 100000;
+    sim->protocol_version = 2;
+    sim->start = af_utils_millis();
+    sim->line_free = af_utils_micros();
+
+    value[0] = 0x40;
+    store_attr(sim, ATTR_ASR_CAPABILITIES, 1, value);
+    af_utils_write_little_endian_64(0x6000, value);
+    store_attr(sim, ATTR_APPLICATION_VERSION, 8, value);
+
+    // Powered up, so the boot sequence goes out as soon as the simulator is polled
+    sim->boot = BOOT_DOWN;
+    sim->boot_at = af_utils_micros();
+    return sim;
+}
+
+void asr_sim_destroy(asr_sim_t *sim) {
+    uint16_t i;
+
+    if (NULL == sim) {
+        return;
+    }
+    clear_queue(sim);
+    for (i = 0; i < sim->attr_count; i++) {
+        free(sim->attrs[i].value);
+    }
+    for (i = 0; i < sim->event_count; i++) {
+        free(sim->events[i].line);
+    }
+    free(sim->attrs);
+    free(sim->events);
+    free(sim->rx);
+    free(sim);
+}
+
+/**
+ * parse_value
+ *
+ * A typed value from the script into value, returning its length or -1.
+ */
+static int parse_value(const char *type, char *rest, uint8_t *value, uint16_t size) {
+    unsigned long long n;
+    char *end;
+    int len = 0;
+
+    while (isspace((unsigned char)*rest)) {
+        rest++;
+    }
+    if (0 == strcmp(type, "str")) {
+        len = (int)strcspn(rest, "\r\n");
+        if (len > size) {
+            return -1;
+        }
+        memcpy(value, rest, len);
+        return len;
+    }
+    if (0 == strcmp(type, "hex")) {
+        while (isxdigit((unsigned char)rest[0]) && isxdigit((unsigned char)rest[1]) && len < size) {
+            char pair[3] = { rest[0], rest[1], 0 };
+            value[len++] = (uint8_t)strtoul(pair, NULL, 16);
+            rest += 2;
+        }
+        return len;
+    }
+
+    n = strtoull(rest, &end, 0);
+    if (end == rest) {
+        return -1;
+    }
+    if (0 == strcmp(type, "u8")) {
+        value[0] = (uint8_t)n;
+        return 1;
+    } else if (0 == strcmp(type, "u16")) {
+        af_utils_write_little_endian_16((uint16_t)n, value);
+        return 2;
+    } else if (0 == strcmp(type, "u32")) {
+        af_utils_write_little_endian_32((uint32_t)n, value);
+        return 4;
+    } else if (0 == strcmp(type, "u64")) {
+        af_utils_write_little_endian_64(n, value);
+        return 8;
+    }
+    return -1;
+}
+
+static int parse_link(asr_sim_t *sim, char *kind, char *rate, char *frame_length, bool base) {
+    bool spi;
+    unsigned long r;
+    unsigned long f = 0;
+
+    if (NULL == kind || NULL == rate) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    spi = 0 == strcmp(kind, "spi");
+    if (!spi && strcmp(kind, "uart") != 0) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    r = strtoul(rate, NULL, 0);
+    if (spi) {
+        f = frame_length != NULL ? strtoul(frame_length, NULL, 0) : 0;
+        if (0 == f || f > 0xffff) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+    }
+    if (0 == r) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+
+    if (base) {
+        sim->spi = spi;
+        sim->rate = sim->base_rate = r;
+        sim->frame_length = sim->base_frame_length = f;
+        if (sim->max_rate < r || (spi && sim->max_frame_length < f)) {
+            sim->max_rate = r;
+            sim->max_frame_length = f;
+        }
+    } else {
+        sim->max_rate = r;
+        sim->max_frame_length = f;
+    }
+    return AF_SUCCESS;
+}
+
+int asr_sim_script(asr_sim_t *sim, const char *line) {
+    char buffer[512];
+    uint8_t value[256];
+    char *save = NULL;
+    char *cmd;
+    char *arg;
+    char *type;
+    sim_attr_t *attr;
+    sim_event_t *events;
+    long n;
+    int len;
+
+    if (strlen(line) >= sizeof(buffer)) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    strcpy(buffer, line);
+    buffer[strcspn(buffer, "#\r\n")] = 0;
+
+    cmd = strtok_r(buffer, " \t", &save);
+    if (NULL == cmd) {
+        return AF_SUCCESS;
+    }
+
+    if (0 == strcmp(cmd, "at") || 0 == strcmp(cmd, "every")) {
+        arg = strtok_r(NULL, " \t", &save);
+        if (NULL == arg || NULL == save || 0 == *save) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        n = strtol(arg, NULL, 0);
+        if (n < 0 || ('e' == cmd[0] && 0 == n)) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        events = (sim_event_t *)realloc(sim->events, (sim->event_count + 1) * sizeof(sim_event_t));
+        if (NULL == events) {
+            return AF_ERROR_UNKNOWN;
+        }
+        sim->events = events;
+        events[sim->event_count].at = n;
+        events[sim->event_count].every = 'e' == cmd[0] ? n : 0;
+        events[sim->event_count].line = strdup(save);
+        if (NULL == events[sim->event_count].line) {
+            return AF_ERROR_UNKNOWN;
+        }
+        sim->event_count++;
+        return AF_SUCCESS;
+    }
+
+    if (0 == strcmp(cmd, "reboot")) {
+        asr_sim_reboot(sim);
+        return AF_SUCCESS;
+    }
+
+    if (0 == strcmp(cmd, "bus") || 0 == strcmp(cmd, "max")) {
+        char *kind = strtok_r(NULL, " \t", &save);
+        char *rate = strtok_r(NULL, " \t", &save);
+        return parse_link(sim, kind, rate, strtok_r(NULL, " \t", &save), 'b' == cmd[0]);
+    }
+
+    if (0 == strcmp(cmd, "capabilities")) {
+        arg = strtok_r(NULL, " \t", &save);
+        len = arg != NULL ? parse_value("hex", arg, value, sizeof(value)) : 0;
+        if (len <= 0) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        return store_attr(sim, ATTR_ASR_CAPABILITIES, len, value);
+    }
+
+    arg = strtok_r(NULL, " \t", &save);
+    if (NULL == arg) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    n = strtol(arg, NULL, 0);
+
+    if (0 == strcmp(cmd, "latency")) {
+        sim->latency_us = n;
+    } else if (0 == strcmp(cmd, "reboot-time")) {
+        sim->reboot_us = n;
+    } else if (0 == strcmp(cmd, "protocol")) {
+        sim->protocol_version = n;
+    } else if (0 == strcmp(cmd, "collide")) {
+        sim->collide_every = n;
+    } else if (0 == strcmp(cmd, "corrupt")) {
+        sim->corrupt_every = n;
+    } else if (0 == strcmp(cmd, "reorder")) {
+        if (n < 0 || n > SEND_QUEUE_SIZE) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        sim->reorder = n;
+    } else if (0 == strcmp(cmd, "version")) {
+        af_utils_write_little_endian_64(strtoull(arg, NULL, 0), value);
+        return store_attr(sim, ATTR_APPLICATION_VERSION, 8, value);
+    } else if (0 == strcmp(cmd, "reject")) {
+        attr = add_attr(sim, n);
+        arg = strtok_r(NULL, " \t", &save);
+        if (NULL == attr || NULL == arg) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        attr->reject_state = strtoul(arg, NULL, 0);
+    } else {
+        type = strtok_r(NULL, " \t", &save);
+        len = type != NULL && save != NULL ? parse_value(type, save, value, sizeof(value)) : -1;
+        if (len < 0 || n <= 0 || n > 0xffff) {
+            return AF_ERROR_INVALID_PARAM;
+        }
+        if (0 == strcmp(cmd, "attr")) {
+            return store_attr(sim, n, len, value);
+        } else if (0 == strcmp(cmd, "default")) {
+            if (store_attr(sim, n, len, value) != AF_SUCCESS) {
+                return AF_ERROR_UNKNOWN;
+            }
+            find_attr(sim, n)->is_default = true;
+        } else if (0 == strcmp(cmd, "update")) {
+            return asr_sim_send_update(sim, n, len, value);
+        } else if (0 == strcmp(cmd, "set")) {
+            return asr_sim_send_set(sim, n, len, value);
+        } else {
+            return AF_ERROR_INVALID_PARAM;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+int asr_sim_load_script(asr_sim_t *sim, const char *path) {
+    char line[512];
+    int result = AF_SUCCESS;
+    FILE *file = fopen(path, "r");
+
+    if (NULL == file) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    while (AF_SUCCESS == result && fgets(line, sizeof(line), file) != NULL) {
+        result = asr_sim_script(sim, line);
+        if (result != AF_SUCCESS) {
+            fprintf(stderr, "%s: can't run \"%s\"\n", path, strtok(line, "\r\n"));
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+int asr_sim_set_attribute(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    return store_attr(sim, attr_id, value_len, value);
+}
+
+const uint8_t *asr_sim_get_attribute(asr_sim_t *sim, uint16_t attr_id, uint16_t *value_len) {
+    const sim_attr_t *attr = find_attr(sim, attr_id);
+
+    if (NULL == attr || NULL == attr->value) {
+        return NULL;
+    }
+    *value_len = attr->value_len;
+    return attr->value;
+}
+
+int asr_sim_send_update(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    if (store_attr(sim, attr_id, value_len, value) != AF_SUCCESS) {
+        return AF_ERROR_UNKNOWN;
+    }
+    return queue_command(sim, MSG_TYPE_UPDATE, 0, attr_id, UPDATE_STATE_UPDATED, UPDATE_REASON_LOCAL_OR_MCU_UPDATE, value_len, value) != NULL ?
+           AF_SUCCESS : AF_ERROR_QUEUE_OVERFLOW;
+}
+
+int asr_sim_send_set(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value) {
+    if (0 == ++sim->request_id) {
+        sim->request_id++;
+    }
+    if (NULL == queue_command(sim, MSG_TYPE_SET, sim->request_id, attr_id, 0, 0, value_len, value)) {
+        return AF_ERROR_QUEUE_OVERFLOW;
+    }
+    sim->sets_outstanding++;
+    return AF_SUCCESS;
+}
+
+void asr_sim_reboot(asr_sim_t *sim) {
+    sim->stats.reboots++;
+    sim->boot = BOOT_DOWN;
+    sim->boot_at = af_utils_micros() + sim->reboot_us;
+    sim->handshake = HANDSHAKE_IDLE;
+    sim->attention = false;
+    sim->sets_outstanding = 0;
+    // The interrupt ending this transfer still goes out at the old rate, boot goes back to the base one
+    clear_queue(sim);
+}
+
+bool asr_sim_is_up(asr_sim_t *sim) {
+    return BOOT_UP == sim->boot;
+}
+
+const asr_sim_stats_t *asr_sim_get_stats(asr_sim_t *sim) {
+    return &sim->stats;
+}
+
+void asr_sim_poll(asr_sim_t *sim) {
+    if (BOOT_DOWN == sim->boot && is_due(sim->boot_at, af_utils_micros())) {
+        boot(sim);
+    }
+    run_events(sim);
+
+    // Ask for a sync if there's something for afLib and nothing else going on, and again if afLib missed it
+    if (sim->attention && is_due(sim->attention_at + ATTENTION_RETRY_US, af_utils_micros())) {
+        sim->attention = false;
+    }
+    if (HANDSHAKE_IDLE == sim->handshake && sim->queue_count > 0 && !sim->attention && 0 == sim->token_count) {
+        sim->attention = true;
+        sim->attention_at = af_utils_micros();
+        schedule_interrupt(sim, 0);
+    }
+}
+
+uint8_t asr_sim_peek(asr_sim_t *sim) {
+    const sim_token_t *token = &sim->tokens[sim->token_head];
+
+    if (0 == sim->token_count || !is_due(token->due, af_utils_micros())) {
+        return ASR_SIM_NONE;
+    }
+    return token->kind;
+}
+
+void asr_sim_pop(asr_sim_t *sim) {
+    if (sim->token_count > 0) {
+        if (sim->link_switching && ASR_SIM_INTERRUPT == sim->tokens[sim->token_head].kind) {
+            switch_link(sim);
+        }
+        sim->token_head = (sim->token_head + 1) % TOKEN_QUEUE_SIZE;
+        sim->token_count--;
+    }
+}
+
+int32_t asr_sim_next_due(asr_sim_t *sim) {
+    uint32_t now = af_utils_micros();
+    int32_t next = -1;
+    int32_t until;
+    long elapsed;
+    uint16_t i;
+
+    if (sim->token_count > 0) {
+        until = (int32_t)(sim->tokens[sim->token_head].due - now);
+        next = until > 0 ? until : 0;
+    }
+    if (sim->attention && 0 == sim->token_count) {
+        until = (int32_t)(sim->attention_at + ATTENTION_RETRY_US - now);
+        until = until > 0 ? until : 0;
+        next = next < 0 || until < next ? until : next;
+    }
+    if (BOOT_DOWN == sim->boot) {
+        until = (int32_t)(sim->boot_at - now);
+        until = until > 0 ? until : 0;
+        next = next < 0 || until < next ? until : next;
+    }
+    elapsed = af_utils_millis() - sim->start;
+    for (i = 0; i < sim->event_count; i++) {
+        if (sim->events[i].at >= 0) {
+            until = sim->events[i].at > elapsed ? (int32_t)(sim->events[i].at - elapsed) * 1000 : 0;
+            next = next < 0 || until < next ? until : next;
+        }
+    }
+    return next;
+}
+
+int asr_sim_status(asr_sim_t *sim, const uint8_t *status, uint16_t len) {
+    uint8_t checksum = 0;
+    uint16_t mcu_send;
+    uint16_t mcu_recv;
+    uint16_t recv = 0;
+    uint8_t i;
+
+    if (len < STATUS_LEN) {
+        sim->stats.bad_status++;
+        return AF_ERROR_INVALID_COMMAND;
+    }
+    for (i = 0; i < STATUS_LEN - 1; i++) {
+        checksum += status[i];
+    }
+    if (checksum != status[STATUS_LEN - 1] || (status[0] != SYNC_REQUEST && status[0] != SYNC_ACK)) {
+        sim->stats.bad_status++;
+        return AF_ERROR_INVALID_COMMAND;
+    }
+    if (BOOT_DOWN == sim->boot) {
+        // Nobody home, afLib will time out and try again
+        return AF_SUCCESS;
+    }
+    mcu_send = af_utils_read_little_endian_16(&status[1]);
+    mcu_recv = af_utils_read_little_endian_16(&status[3]);
+
+    if (SYNC_ACK == status[0]) {
+        if (sim->handshake != HANDSHAKE_SYNCED || mcu_send != sim->to_recv || mcu_recv != sim->to_send) {
+            sim->stats.bad_status++;
+            sim->handshake = HANDSHAKE_IDLE;
+            return AF_SUCCESS;
+        }
+        if (sim->to_recv > 0) {
+            sim->handshake = HANDSHAKE_RECEIVING;
+            sim->rx_len = 0;
+            schedule_interrupt(sim, STATUS_LEN);
+        } else if (sim->to_send > 0) {
+            sim->handshake = HANDSHAKE_SENDING;
+            sim->tx_offset = 0;
+            schedule_interrupt(sim, STATUS_LEN);
+            if (!sim->spi) {
+                schedule(sim, ASR_SIM_FRAME, 0, sim->to_send);
+                schedule_interrupt(sim, 0);
+            }
+        } else {
+            schedule_interrupt(sim, STATUS_LEN);
+            end_transfer(sim);
+        }
+        return AF_SUCCESS;
+    }
+
+    // A sync starts everything over, whatever was lined up for the last one is stale
+    sim->stats.syncs++;
+    sim->token_count = 0;
+    sim->attention = false;
+    sim->handshake = HANDSHAKE_IDLE;
+
+    if (sim->queue_count > 0) {
+        recv = sim->queue[sim->queue_head].len;
+    }
+    if (mcu_send > 0) {
+        sim->data_syncs++;
+        if (sim->collide_every > 0 && 0 == sim->data_syncs % sim->collide_every) {
+            // The ASR had its own transfer going, afLib backs off and syncs again
+            sim->stats.collisions++;
+            if (0 == recv) {
+                recv = STATUS_LEN;
+            }
+        } else {
+            recv = 0;
+        }
+    }
+
+    sim->reply[0] = SYNC_REQUEST;
+    af_utils_write_little_endian_16(mcu_send, &sim->reply[1]);
+    af_utils_write_little_endian_16(recv, &sim->reply[3]);
+    sim->reply[5] = 0;
+    for (i = 0; i < STATUS_LEN - 1; i++) {
+        sim->reply[5] += sim->reply[i];
+    }
+
+    if (0 == mcu_send || 0 == recv) {
+        sim->handshake = HANDSHAKE_SYNCED;
+        sim->to_recv = mcu_send;
+        sim->to_send = recv;
+    }
+    if (sim->corrupt_every > 0 && 0 == ++sim->replies % sim->corrupt_every) {
+        sim->stats.corrupted++;
+        sim->reply[5] ^= 0xff;
+        sim->handshake = HANDSHAKE_IDLE;
+    }
+
+    schedule(sim, ASR_SIM_STATUS, STATUS_LEN, STATUS_LEN);
+    schedule_interrupt(sim, 0);
+    return AF_SUCCESS;
+}
+
+const uint8_t *asr_sim_status_reply(asr_sim_t *sim, uint16_t *len) {
+    *len = STATUS_LEN;
+    return sim->reply;
+}
+
+uint16_t asr_sim_expecting(asr_sim_t *sim) {
+    return HANDSHAKE_RECEIVING == sim->handshake ? sim->to_recv - sim->rx_len : 0;
+}
+
+uint16_t asr_sim_receive(asr_sim_t *sim, const uint8_t *bytes, uint16_t len) {
+    uint8_t *rx;
+
+    if (sim->handshake != HANDSHAKE_RECEIVING) {
+        return 0;
+    }
+    if (len > sim->to_recv - sim->rx_len) {
+        len = sim->to_recv - sim->rx_len;
+    }
+    if (sim->rx_size < sim->to_recv) {
+        rx = (uint8_t *)realloc(sim->rx, sim->to_recv);
+        if (NULL == rx) {
+            return 0;
+        }
+        sim->rx = rx;
+        sim->rx_size = sim->to_recv;
+    }
+    memcpy(&sim->rx[sim->rx_len], bytes, len);
+    sim->rx_len += len;
+    sim->stats.bytes_in += len;
+
+    if (sim->rx_len < sim->to_recv) {
+        // Ready for the next frame
+        if (sim->spi) {
+            schedule_interrupt(sim, len);
+        }
+        return len;
+    }
+
+    on_frames(sim, sim->rx, sim->rx_len);
+    schedule_interrupt(sim, len);
+    end_transfer(sim);
+    return len;
+}
+
+uint16_t asr_sim_transmit(asr_sim_t *sim, uint8_t *bytes, uint16_t len) {
+    sim_frame_t *frame = &sim->queue[sim->queue_head];
+
+    if (sim->handshake != HANDSHAKE_SENDING || 0 == sim->queue_count) {
+        return 0;
+    }
+    if (len > sim->to_send - sim->tx_offset) {
+        len = sim->to_send - sim->tx_offset;
+    }
+    memcpy(bytes, &frame->bytes[sim->tx_offset], len);
+    sim->tx_offset += len;
+    sim->stats.bytes_out += len;
+    if (sim->spi) {
+        schedule_interrupt(sim, len);
+    }
+
+    if (sim->tx_offset == sim->to_send) {
+        if (frame->switches_link) {
+            // A UART's last interrupt comes after the frame, and still at the old rate
+            if (sim->spi) {
+                switch_link(sim);
+            } else {
+                sim->link_switching = true;
+            }
+        }
+        free(frame->bytes);
+        sim->queue_head = (sim->queue_head + 1) % SEND_QUEUE_SIZE;
+        sim->queue_count--;
+        sim->stats.frames_out++;
+        end_transfer(sim);
+    }
+    return len;
+}
+
+bool asr_sim_is_spi(asr_sim_t *sim) {
+    return sim->spi;
+}
+
+void asr_sim_get_link(asr_sim_t *sim, uint32_t *rate, uint16_t *frame_length, uint32_t *max_rate, uint16_t *max_frame_length) {
+    *rate = sim->rate;
+    *frame_length = sim->frame_length;
+    *max_rate = sim->max_rate;
+    *max_frame_length = sim->max_frame_length;
+}
@@ -0,0 +1,256 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A software ASR for running afLib on a host without a module.
+ *
+ * It takes the ASR's side of the sync/ack handshake and the frames that follow, keeps a table of attributes to answer
+ * gets and sets from, and goes through the same boot sequence a module does: protocol version, firmware version and
+ * ASR state, then any set defaults. Rebooting it, from a script or by afLib setting the system command attribute,
+ * takes the link back to its base settings and starts that sequence again. Replies are held back by the configured
+ * latency plus the time the bytes would take on the bus, so afLib sees the same timing it would against a module on
+ * that link.
+ *
+ * The simulator itself doesn't touch a descriptor. asr_sim_transport.c puts it directly behind an af_transport_t in
+ * the same process, and asr_sim_uart.c puts it on the far end of a socketpair or a pseudo-terminal for afLib to reach
+ * through posix_uart, or for a separate process to open like a serial port. Everything it does can be scripted,
+ * one command per line, either from a file or a line at a time:
+ *
+ *     bus uart 9600               link the ASR starts on, "bus spi <clock> <frame length>" for SPI
+ *     max uart 115200             fastest the ASR agrees to when afLib negotiates, "max spi <clock> <frame length>"
+ *     latency 200                 microseconds the ASR takes to answer each step of the handshake
+ *     reboot-time 100000          microseconds from a reboot to the ASR announcing itself again
+ *     protocol 2                  protocol version, below 2 the ASR doesn't announce one
+ *     version 0x6000              firmware version reported in attribute 2003
+ *     capabilities 40             ASR capability bytes in hex, 40 is batched frames
+ *     collide 10                  every 10th sync in which afLib has something to send runs into one from the ASR
+ *     corrupt 0                   every Nth status reply goes out with a bad checksum
+ *     reorder 4                   hold answers to afLib's gets and sets until there are 4, then send them newest first
+ *     attr 1024 u32 7             ASR attribute value, types are u8, u16, u32, u64, hex and str
+ *     reject 1025 6               reject afLib's sets of 1025 with update state 6
+ *     default 3 u8 1              send afLib a set default for MCU attribute 3 once the ASR is up
+ *     at 1000 set 3 u8 7          1000ms after start ask afLib to set MCU attribute 3
+ *     every 500 update 1024 u32 9 push an update of 1024 every 500ms
+ *     at 3000 reboot              reboot the ASR, so afLib sees it come back up
+ */
+#ifndef AF_ASR_SIM_H
+#define AF_ASR_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef struct asr_sim_t asr_sim_t;
+
+typedef struct {
+    uint32_t syncs;             // Sync requests from afLib
+    uint32_t collisions;        // Syncs answered with a collision
+    uint32_t corrupted;         // Status replies sent with a bad checksum
+    uint32_t bad_status;        // Statuses or commands from afLib that don't parse, or statuses out of turn
+    uint32_t frames_in;         // Commands received, counting each one in a batch
+    uint32_t frames_out;        // Commands sent
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    uint32_t sets;              // Sets of ASR attributes from afLib
+    uint32_t gets;
+    uint32_t updates;           // Updates of MCU attributes from afLib
+    uint32_t rejected;          // Sets answered with an update rejected
+    uint32_t set_responses;     // Updates answering a set the ASR sent
+    uint32_t link_changes;
+    uint32_t reboots;
+    uint32_t dropped;           // Commands to afLib lost because the send queue was full
+} asr_sim_stats_t;
+
+// What the transport side has to deliver next, see asr_sim_peek
+#define ASR_SIM_NONE                        0
+#define ASR_SIM_INTERRUPT                   1   // The ASR wants afLib's attention, INT_CHAR on a UART
+#define ASR_SIM_STATUS                      2   // The reply to afLib's sync request
+#define ASR_SIM_FRAME                       3   // The frame afLib has acked, read it with asr_sim_transmit
+
+/**
+ * asr_sim_create
+ *
+ * A simulated ASR with the defaults above, powered up and about to boot.
+ */
+asr_sim_t *asr_sim_create(void);
+
+void asr_sim_destroy(asr_sim_t *sim);
+
+/**
+ * asr_sim_script
+ *
+ * Run one script command. Blank lines and anything after a # are ignored.
+ *
+ * @return AF_SUCCESS or AF_ERROR_INVALID_PARAM if the line doesn't parse
+ */
+int asr_sim_script(asr_sim_t *sim, const char *line);
+
+/**
+ * asr_sim_load_script
+ *
+ * Run every line of a script file, stopping at the first one that doesn't parse.
+ *
+ * @return AF_SUCCESS, AF_ERROR_NOT_SUPPORTED if the file can't be opened or AF_ERROR_INVALID_PARAM
+ */
+int asr_sim_load_script(asr_sim_t *sim, const char *path);
+
+/**
+ * asr_sim_set_attribute
+ *
+ * Set the value the ASR holds for an attribute, without telling afLib.
+ */
+int asr_sim_set_attribute(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value);
+
+/**
+ * asr_sim_get_attribute
+ *
+ * The value the ASR holds for an attribute, including the MCU attributes afLib has updated.
+ *
+ * @return the value, or NULL if the ASR has never seen the attribute
+ */
+const uint8_t *asr_sim_get_attribute(asr_sim_t *sim, uint16_t attr_id, uint16_t *value_len);
+
+/**
+ * asr_sim_send_update
+ *
+ * Change an ASR attribute and tell afLib about it.
+ */
+int asr_sim_send_update(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value);
+
+/**
+ * asr_sim_send_set
+ *
+ * Ask afLib to set one of its attributes, as the service would.
+ */
+int asr_sim_send_set(asr_sim_t *sim, uint16_t attr_id, uint16_t value_len, const uint8_t *value);
+
+/**
+ * asr_sim_reboot
+ *
+ * Reboot the ASR: the link goes back to its base settings, afLib's queued commands are lost and the boot sequence
+ * starts again once the reboot time has passed.
+ */
+void asr_sim_reboot(asr_sim_t *sim);
+
+/**
+ * asr_sim_is_up
+ *
+ * True once afLib has been told the ASR is initialized.
+ */
+bool asr_sim_is_up(asr_sim_t *sim);
+
+const asr_sim_stats_t *asr_sim_get_stats(asr_sim_t *sim);
+
+/*
+ * Transport side
+ *
+ * What asr_sim_transport.c and asr_sim_uart.c drive the simulator with. Bytes from afLib go in through asr_sim_status
+ * and asr_sim_receive, and whatever the ASR wants to send comes back out of asr_sim_peek in order, each once its time
+ * has come.
+ */
+
+/**
+ * asr_sim_poll
+ *
+ * Run the script's timed commands and finish a reboot that's due.
+ */
+void asr_sim_poll(asr_sim_t *sim);
+
+/**
+ * asr_sim_peek
+ *
+ * What the ASR sends next, if it's due yet. ASR_SIM_STATUS is read with asr_sim_status_reply and ASR_SIM_FRAME with
+ * asr_sim_transmit, either way asr_sim_pop moves on to the next.
+ *
+ * @return ASR_SIM_NONE if there's nothing due
+ */
+uint8_t asr_sim_peek(asr_sim_t *sim);
+
+void asr_sim_pop(asr_sim_t *sim);
+
+/**
+ * asr_sim_next_due
+ *
+ * Microseconds until something is due from asr_sim_peek or the script, for a host that sleeps in between.
+ *
+ * @return -1 if nothing is waiting
+ */
+int32_t asr_sim_next_due(asr_sim_t *sim);
+
+/**
+ * asr_sim_status
+ *
+ * A status command from afLib: a sync request, answered by a status reply, or the ack that starts the transfer.
+ *
+ * @return AF_SUCCESS, or AF_ERROR_INVALID_COMMAND if len bytes aren't a status with a good checksum
+ */
+int asr_sim_status(asr_sim_t *sim, const uint8_t *status, uint16_t len);
+
+/**
+ * asr_sim_status_reply
+ *
+ * The status reply for the ASR_SIM_STATUS just peeked, len bytes including the checksum.
+ */
+const uint8_t *asr_sim_status_reply(asr_sim_t *sim, uint16_t *len);
+
+/**
+ * asr_sim_expecting
+ *
+ * How many more bytes of afLib's transfer the ASR is waiting for, 0 when the next thing it expects is a status.
+ */
+uint16_t asr_sim_expecting(asr_sim_t *sim);
+
+/**
+ * asr_sim_receive
+ *
+ * The next bytes of afLib's transfer. On SPI each call is one frame.
+ *
+ * @return how many of them were taken
+ */
+uint16_t asr_sim_receive(asr_sim_t *sim, const uint8_t *bytes, uint16_t len);
+
+/**
+ * asr_sim_transmit
+ *
+ * Copy out up to len more bytes of the frame the ASR is sending. On SPI each call is one frame.
+ *
+ * @return how many bytes were copied
+ */
+uint16_t asr_sim_transmit(asr_sim_t *sim, uint8_t *bytes, uint16_t len);
+
+/**
+ * asr_sim_is_spi
+ *
+ * Whether the ASR is on SPI, otherwise it's on a UART.
+ */
+bool asr_sim_is_spi(asr_sim_t *sim);
+
+/**
+ * asr_sim_get_link
+ *
+ * Where the ASR's end of the link is now and the fastest it agrees to. rate is the baud rate on a UART or the clock
+ * on SPI, frame_length is 0 on a UART.
+ */
+void asr_sim_get_link(asr_sim_t *sim, uint32_t *rate, uint16_t *frame_length, uint32_t *max_rate, uint16_t *max_frame_length);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* AF_ASR_SIM_H */
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * asr_sim: a simulated ASR behind a pseudo-terminal, for running an afLib host program against without a module.
+ *
+ *     asr_sim [-e line]... [script]...
+ *
+ * Scripts are run in order, then each -e line (see asr_sim.h for what they can say). The device to open is printed
+ * on startup, and what went over the link when the simulator is stopped with Ctrl-C. Built from the repository root
+ * with:
+ *
+ *     cc -std=gnu99 -I. -Iextras/asr_sim -o asr_sim extras/asr_sim/asr_sim_main.c extras/asr_sim/asr_sim.c \
+ *         extras/asr_sim/asr_sim_uart.c extras/posix/posix_utils.c extras/posix/posix_logger.c af_utils.c
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "asr_sim.h"
+#include "asr_sim_uart.h"
+#include "af_lib.h"
+
+static volatile sig_atomic_t s_stop;
+
+static void on_signal(int sig) {
+    s_stop = 1;
+}
+
+static void print_stats(const asr_sim_stats_t *stats) {
+    printf("syncs %u, collisions %u, corrupted %u, bad statuses %u\n", stats->syncs, stats->collisions, stats->corrupted, stats->bad_status);
+    printf("frames in %u (%u bytes), out %u (%u bytes), dropped %u\n", stats->frames_in, stats->bytes_in, stats->frames_out, stats->bytes_out, stats->dropped);
+    printf("sets %u, gets %u, updates %u, rejected %u, set responses %u\n", stats->sets, stats->gets, stats->updates, stats->rejected, stats->set_responses);
+    printf("link changes %u, reboots %u\n", stats->link_changes, stats->reboots);
+}
+
+int main(int argc, char **argv) {
+    asr_sim_t *sim = asr_sim_create();
+    asr_sim_uart_t *uart;
+    char **lines;
+    int line_count = 0;
+    int opt;
+    int i;
+
+    lines = (char **)malloc(argc * sizeof(char *));
+    if (NULL == sim || NULL == lines) {
+        fprintf(stderr, "asr_sim: out of memory\n");
+        return 1;
+    }
+    while ((opt = getopt(argc, argv, "e:h")) != -1) {
+        if ('e' == opt) {
+            lines[line_count++] = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-e line]... [script]...\n", argv[0]);
+            return 'h' == opt ? 0 : 1;
+        }
+    }
+    for (i = optind; i < argc; i++) {
+        if (asr_sim_load_script(sim, argv[i]) != AF_SUCCESS) {
+            fprintf(stderr, "asr_sim: can't run %s\n", argv[i]);
+            return 1;
+        }
+    }
+    for (i = 0; i < line_count; i++) {
+        if (asr_sim_script(sim, lines[i]) != AF_SUCCESS) {
+            fprintf(stderr, "asr_sim: bad line: %s\n", lines[i]);
+            return 1;
+        }
+    }
+    free(lines);
+
+    uart = asr_sim_uart_create_pty(sim);
+    if (NULL == uart) {
+        perror("asr_sim: pseudo-terminal");
+        return 1;
+    }
+    printf("%s\n", asr_sim_uart_pty_name(uart));
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    while (!s_stop) {
+        if (asr_sim_uart_run(uart, 1000) < 0 && !s_stop) {
+            perror("asr_sim: poll");
+            break;
+        }
+    }
+
+    print_stats(asr_sim_get_stats(sim));
+    asr_sim_uart_destroy(uart);
+    asr_sim_destroy(sim);
+    return 0;
+}
@@ -0,0 +1,259 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "asr_sim_transport.h"
+#include "af_lib.h"
+#include "af_utils.h"
+#include "af_allocator.h"
+
+#define MAX_WAIT_TIME                       1000
+
+// How fast afLib's end of the link can go, the simulator's own limits decide how much of it is used
+#define ASR_SIM_TRANSPORT_MAX_BAUD_RATE     115200
+#define ASR_SIM_TRANSPORT_MAX_CLOCK_RATE    8000000
+#define ASR_SIM_TRANSPORT_MAX_FRAME_LENGTH  256
+
+typedef struct {
+    af_transport_t base;    // Must be first
+    asr_sim_t *sim;
+    uint32_t rate;          // afLib's end of the link, which may not match the ASR's
+    uint16_t frame_length;
+    bool status_sent;
+    long wait_start;
+} asr_sim_transport_t;
+
+static bool link_matches(asr_sim_transport_t *transport) {
+    uint32_t rate;
+    uint16_t frame_length;
+    uint32_t max_rate;
+    uint16_t max_frame_length;
+
+    asr_sim_get_link(transport->sim, &rate, &frame_length, &max_rate, &max_frame_length);
+    return rate == transport->rate && frame_length == transport->frame_length;
+}
+
+/**
+ * send_status
+ *
+ * Hand the simulator a status, scrambled if the two ends of the link disagree on how fast it's going.
+ */
+static void send_status(asr_sim_transport_t *transport, af_status_command_t *af_status_command) {
+    uint16_t len = af_status_command_get_size(af_status_command);
+    uint8_t bytes[len + 1];
+
+    af_status_command_get_bytes(af_status_command, bytes);
+    bytes[len] = af_status_command_get_checksum(af_status_command);
+    if (!link_matches(transport)) {
+        bytes[len] ^= 0x55;
+    }
+    asr_sim_status(transport->sim, bytes, len + 1);
+}
+
+static void asr_sim_transport_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+    uint8_t kind;
+
+    asr_sim_poll(transport->sim);
+    while ((kind = asr_sim_peek(transport->sim)) != ASR_SIM_NONE) {
+        if (ASR_SIM_FRAME == kind) {
+            // recv_bytes_offset takes the frame itself
+            asr_sim_pop(transport->sim);
+        } else if (ASR_SIM_INTERRUPT == kind) {
+            if (0 == *interrupts_pending) {
+                asr_sim_pop(transport->sim);
+                *interrupts_pending += 1;
+                break;
+            } else if (idle) {
+                asr_sim_pop(transport->sim);
+            } else {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+static int asr_sim_transport_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+    const uint8_t *reply;
+    uint16_t len;
+    uint8_t kind;
+
+    if (!transport->status_sent) {
+        send_status(transport, af_status_command_tx);
+        transport->status_sent = true;
+        transport->wait_start = af_utils_millis();
+    }
+
+    asr_sim_poll(transport->sim);
+    while ((kind = asr_sim_peek(transport->sim)) != ASR_SIM_NONE && kind != ASR_SIM_STATUS) {
+        asr_sim_pop(transport->sim);
+    }
+    if (ASR_SIM_NONE == kind) {
+        if (af_utils_millis() - transport->wait_start > MAX_WAIT_TIME) {
+            transport->status_sent = false;
+            return AF_ERROR_TIMEOUT;
+        }
+        return AF_ERROR_BUSY;
+    }
+
+    reply = asr_sim_status_reply(transport->sim, &len);
+    asr_sim_pop(transport->sim);
+    transport->status_sent = false;
+
+    af_status_command_set_bytes_to_send(af_status_command_rx, af_utils_read_little_endian_16(&reply[1]));
+    af_status_command_set_bytes_to_recv(af_status_command_rx, af_utils_read_little_endian_16(&reply[3]));
+    af_status_command_set_checksum(af_status_command_rx, reply[len - 1]);
+    if (!link_matches(transport)) {
+        af_status_command_set_checksum(af_status_command_rx, reply[len - 1] ^ 0x55);
+    }
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
+    send_status((asr_sim_transport_t *)af_transport, af_status_command);
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+    uint16_t len = *bytes_to_send;
+
+    if (asr_sim_is_spi(transport->sim) && len > transport->frame_length) {
+        len = transport->frame_length;
+    }
+    len = asr_sim_receive(transport->sim, &bytes[*offset], len);
+    if (0 == len) {
+        return AF_ERROR_TIMEOUT;
+    }
+    *offset += len;
+    *bytes_to_send -= len;
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+    uint16_t len = *bytes_to_recv;
+
+    if (0 == *offset) {
+        *bytes_len = *bytes_to_recv;
+        if (NULL == *bytes) {
+            *bytes = (uint8_t *)af_allocator_malloc(*bytes_len);
+            if (NULL == *bytes) {
+                return AF_ERROR_UNKNOWN;
+            }
+        }
+    }
+
+    if (asr_sim_is_spi(transport->sim) && len > transport->frame_length) {
+        len = transport->frame_length;
+    }
+    len = asr_sim_transmit(transport->sim, *bytes + *offset, len);
+    if (0 == len) {
+        return AF_ERROR_TIMEOUT;
+    }
+    *offset += len;
+    *bytes_to_recv -= len;
+    return AF_SUCCESS;
+}
+
+static bool asr_sim_transport_has_work(af_transport_t *af_transport) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+
+    return asr_sim_peek(transport->sim) != ASR_SIM_NONE;
+}
+
+static int asr_sim_transport_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+
+    if (asr_sim_is_spi(transport->sim)) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    *baud_rate = transport->rate;
+    *max_baud_rate = ASR_SIM_TRANSPORT_MAX_BAUD_RATE;
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+
+    if (asr_sim_is_spi(transport->sim)) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    transport->rate = baud_rate;
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_get_spi_config(af_transport_t *af_transport, uint32_t *clock_rate, uint16_t *frame_length, uint32_t *max_clock_rate, uint16_t *max_frame_length) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+
+    if (!asr_sim_is_spi(transport->sim)) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    *clock_rate = transport->rate;
+    *frame_length = transport->frame_length;
+    *max_clock_rate = ASR_SIM_TRANSPORT_MAX_CLOCK_RATE;
+    *max_frame_length = ASR_SIM_TRANSPORT_MAX_FRAME_LENGTH;
+    return AF_SUCCESS;
+}
+
+static int asr_sim_transport_set_spi_config(af_transport_t *af_transport, uint32_t clock_rate, uint16_t frame_length) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_transport;
+
+    if (!asr_sim_is_spi(transport->sim) || 0 == frame_length) {
+        return AF_ERROR_NOT_SUPPORTED;
+    }
+    transport->rate = clock_rate;
+    transport->frame_length = frame_length;
+    return AF_SUCCESS;
+}
+
+static const af_transport_ops_t s_asr_sim_transport_ops = {
+    asr_sim_transport_check_for_interrupt,
+    asr_sim_transport_exchange_status,
+    asr_sim_transport_write_status,
+    asr_sim_transport_send_bytes_offset,
+    asr_sim_transport_recv_bytes_offset,
+    asr_sim_transport_has_work,
+    asr_sim_transport_get_baud_rate,
+    asr_sim_transport_set_baud_rate,
+    asr_sim_transport_get_spi_config,
+    asr_sim_transport_set_spi_config,
+    asr_sim_transport_destroy,
+};
+
+af_transport_t *asr_sim_transport_create(asr_sim_t *sim) {
+    asr_sim_transport_t *transport = (asr_sim_transport_t *)af_allocator_malloc(sizeof(asr_sim_transport_t));
+    uint32_t max_rate;
+    uint16_t max_frame_length;
+
+    if (NULL == transport) {
+        return NULL;
+    }
+    memset(transport, 0, sizeof(asr_sim_transport_t));
+    transport->base.ops = &s_asr_sim_transport_ops;
+    transport->sim = sim;
+    // Both ends start out on the ASR's base settings
+    asr_sim_get_link(sim, &transport->rate, &transport->frame_length, &max_rate, &max_frame_length);
+    return &transport->base;
+}
+
+void asr_sim_transport_destroy(af_transport_t *af_transport) {
+    af_allocator_free(af_transport);
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A transport that goes straight to a simulated ASR in the same process, with no descriptor or thread in between:
+ *
+ *     asr_sim_t *sim = asr_sim_create();
+ *     asr_sim_load_script(sim, "bench.asr");
+ *     af_lib_t *af_lib = af_lib_create_with_unified_callback(callback, asr_sim_transport_create(sim));
+ *     for (;;) {
+ *         af_lib_loop(af_lib);
+ *     }
+ *
+ * Interrupts come through check_for_interrupt as the simulator makes them due, the way INT_CHAR does on a UART. On
+ * SPI each call moves one frame, as on a module. The transport keeps its own end of the link, so if afLib and the
+ * ASR end up at different rates afLib's statuses arrive garbled, as they would on the wire.
+ */
+#ifndef AF_ASR_SIM_TRANSPORT_H
+#define AF_ASR_SIM_TRANSPORT_H
+
+#include "af_transport.h"
+#include "asr_sim.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+af_transport_t *asr_sim_transport_create(asr_sim_t *sim);
+
+// Leaves the simulator alone, it can outlive the transport
+void asr_sim_transport_destroy(af_transport_t *af_transport);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* AF_ASR_SIM_TRANSPORT_H */
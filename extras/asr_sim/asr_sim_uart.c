@@ -0,0 +1,312 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// posix_openpt and friends, and cfmakeraw
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "asr_sim_uart.h"
+#include "af_lib.h"
+
+#define INT_CHAR                            0x32
+#define STATUS_LEN                          6
+
+#define ASR_SIM_UART_RX_BUFFER_SIZE         1024
+
+// What bytes look like at the other end when the two ends disagree on the baud rate
+#define NOISE                               0x55
+
+struct asr_sim_uart_t {
+    asr_sim_t *sim;
+    int fd;
+    bool owns_fd;
+    bool is_tty;
+    char pty_name[64];
+
+    uint8_t rx[ASR_SIM_UART_RX_BUFFER_SIZE];
+    uint16_t rx_len;
+
+    // Written bytes the descriptor hasn't taken yet
+    uint8_t *tx;
+    uint32_t tx_start;
+    uint32_t tx_end;
+    uint32_t tx_size;
+};
+
+static const struct {
+    uint32_t baud_rate;
+    speed_t speed;
+} s_speeds[] = {
+    { 4800, B4800 },
+    { 9600, B9600 },
+    { 19200, B19200 },
+    { 38400, B38400 },
+    { 57600, B57600 },
+    { 115200, B115200 },
+};
+
+/**
+ * rates_match
+ *
+ * On a pseudo-terminal the other side's termios is visible from this one, so compare its baud rate with the ASR's.
+ * Anything else has no baud rate to get wrong.
+ */
+static bool rates_match(asr_sim_uart_t *uart) {
+    struct termios tio;
+    uint32_t rate;
+    uint16_t frame_length;
+    uint32_t max_rate;
+    uint16_t max_frame_length;
+    uint8_t i;
+
+    if (!uart->is_tty || tcgetattr(uart->fd, &tio) < 0) {
+        return true;
+    }
+    asr_sim_get_link(uart->sim, &rate, &frame_length, &max_rate, &max_frame_length);
+    for (i = 0; i < sizeof(s_speeds) / sizeof(s_speeds[0]); i++) {
+        if (s_speeds[i].baud_rate == rate) {
+            return cfgetospeed(&tio) == s_speeds[i].speed;
+        }
+    }
+    return true;
+}
+
+static void flush_tx(asr_sim_uart_t *uart) {
+    ssize_t n;
+
+    while (uart->tx_end > uart->tx_start) {
+        n = write(uart->fd, &uart->tx[uart->tx_start], uart->tx_end - uart->tx_start);
+        if (n <= 0) {
+            return;
+        }
+        uart->tx_start += n;
+    }
+    uart->tx_start = 0;
+    uart->tx_end = 0;
+}
+
+static void queue_tx(asr_sim_uart_t *uart, const uint8_t *bytes, uint32_t len, bool garble) {
+    uint8_t *tx;
+    uint32_t i;
+
+    if (uart->tx_end + len > uart->tx_size) {
+        tx = (uint8_t *)realloc(uart->tx, uart->tx_end + len);
+        if (NULL == tx) {
+            return;
+        }
+        uart->tx = tx;
+        uart->tx_size = uart->tx_end + len;
+    }
+    for (i = 0; i < len; i++) {
+        uart->tx[uart->tx_end++] = garble ? bytes[i] ^ NOISE : bytes[i];
+    }
+}
+
+/**
+ * fill_rx
+ *
+ * Read what afLib has sent. Returns how many bytes came in.
+ */
+static int fill_rx(asr_sim_uart_t *uart) {
+    int total = 0;
+    ssize_t n;
+
+    while (uart->rx_len < sizeof(uart->rx)) {
+        n = read(uart->fd, &uart->rx[uart->rx_len], sizeof(uart->rx) - uart->rx_len);
+        if (n <= 0) {
+            // EIO just means nobody has the other side of a pseudo-terminal open
+            break;
+        }
+        uart->rx_len += n;
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * handle_rx
+ *
+ * Give the simulator whole statuses, or as much of a transfer as has arrived. A status that doesn't check out loses
+ * its first byte so the next one gets found.
+ */
+static void handle_rx(asr_sim_uart_t *uart) {
+    uint16_t used = 0;
+    uint16_t want;
+
+    if (!rates_match(uart)) {
+        uart->rx_len = 0;
+        return;
+    }
+    while (used < uart->rx_len) {
+        want = asr_sim_expecting(uart->sim);
+        if (want > 0) {
+            used += asr_sim_receive(uart->sim, &uart->rx[used], uart->rx_len - used < want ? uart->rx_len - used : want);
+        } else if (uart->rx_len - used >= STATUS_LEN) {
+            used += asr_sim_status(uart->sim, &uart->rx[used], STATUS_LEN) == AF_SUCCESS ? STATUS_LEN : 1;
+        } else {
+            break;
+        }
+    }
+    memmove(uart->rx, &uart->rx[used], uart->rx_len - used);
+    uart->rx_len -= used;
+}
+
+/**
+ * handle_tx
+ *
+ * Write out everything the simulator has due.
+ */
+static int handle_tx(asr_sim_uart_t *uart) {
+    static const uint8_t int_char = INT_CHAR;
+    bool garble;
+    uint8_t frame[256];
+    const uint8_t *reply;
+    uint16_t len;
+    uint8_t kind;
+    int count = 0;
+
+    while ((kind = asr_sim_peek(uart->sim)) != ASR_SIM_NONE) {
+        // Popping an interrupt can move the ASR to a new rate, so check each time
+        garble = !rates_match(uart);
+        if (ASR_SIM_INTERRUPT == kind) {
+            queue_tx(uart, &int_char, 1, garble);
+        } else if (ASR_SIM_STATUS == kind) {
+            reply = asr_sim_status_reply(uart->sim, &len);
+            queue_tx(uart, reply, len, garble);
+        } else {
+            while ((len = asr_sim_transmit(uart->sim, frame, sizeof(frame))) > 0) {
+                queue_tx(uart, frame, len, garble);
+            }
+        }
+        asr_sim_pop(uart->sim);
+        count++;
+    }
+    flush_tx(uart);
+    return count;
+}
+
+static asr_sim_uart_t *asr_sim_uart_open(asr_sim_t *sim, int fd, bool owns_fd) {
+    asr_sim_uart_t *uart;
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return NULL;
+    }
+    uart = (asr_sim_uart_t *)malloc(sizeof(asr_sim_uart_t));
+    if (NULL == uart) {
+        return NULL;
+    }
+    memset(uart, 0, sizeof(asr_sim_uart_t));
+    uart->sim = sim;
+    uart->fd = fd;
+    uart->owns_fd = owns_fd;
+    uart->is_tty = isatty(fd);
+    return uart;
+}
+
+asr_sim_uart_t *asr_sim_uart_create(asr_sim_t *sim, int fd) {
+    return asr_sim_uart_open(sim, fd, false);
+}
+
+asr_sim_uart_t *asr_sim_uart_create_pty(asr_sim_t *sim) {
+    asr_sim_uart_t *uart;
+    struct termios tio;
+    const char *name;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (grantpt(fd) < 0 || unlockpt(fd) < 0 || NULL == (name = ptsname(fd)) || strlen(name) >= sizeof(uart->pty_name)) {
+        close(fd);
+        return NULL;
+    }
+    // Raw in both directions, so nothing between here and afLib touches the bytes
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    uart = asr_sim_uart_open(sim, fd, true);
+    if (NULL == uart) {
+        close(fd);
+        return NULL;
+    }
+    strcpy(uart->pty_name, name);
+    return uart;
+}
+
+const char *asr_sim_uart_pty_name(asr_sim_uart_t *uart) {
+    return uart->pty_name[0] != 0 ? uart->pty_name : NULL;
+}
+
+int asr_sim_uart_fd(asr_sim_uart_t *uart) {
+    return uart->fd;
+}
+
+int asr_sim_uart_run(asr_sim_uart_t *uart, int timeout_ms) {
+    struct pollfd pfd;
+    int32_t due;
+    int result;
+    int count;
+
+    asr_sim_poll(uart->sim);
+    due = asr_sim_next_due(uart->sim);
+    if (due >= 0 && (due + 999) / 1000 < timeout_ms) {
+        timeout_ms = (due + 999) / 1000;
+    }
+
+    pfd.fd = uart->fd;
+    pfd.events = POLLIN | (uart->tx_end > uart->tx_start ? POLLOUT : 0);
+    pfd.revents = 0;
+    do {
+        result = poll(&pfd, 1, timeout_ms);
+    } while (result < 0 && EINTR == errno);
+    if (result < 0) {
+        return result;
+    }
+    if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN) && timeout_ms > 0) {
+        // A pseudo-terminal nobody has opened yet polls as hung up straight away
+        usleep(timeout_ms * 1000);
+    }
+
+    flush_tx(uart);
+    count = fill_rx(uart);
+    handle_rx(uart);
+    asr_sim_poll(uart->sim);
+    count += handle_tx(uart);
+    return count;
+}
+
+void asr_sim_uart_destroy(asr_sim_uart_t *uart) {
+    if (uart->owns_fd) {
+        close(uart->fd);
+    }
+    free(uart->tx);
+    free(uart);
+}
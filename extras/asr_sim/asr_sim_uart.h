@@ -0,0 +1,77 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A simulated ASR on the far end of a byte stream, speaking the UART protocol: statuses and frames as they are, and
+ * INT_CHAR for an interrupt.
+ *
+ * Give it one end of a socketpair and posix_uart_create_fd the other to run afLib against it in one process, calling
+ * asr_sim_uart_run with a zero timeout in between af_lib_loop calls. Or give it a pseudo-terminal with
+ * asr_sim_uart_create_pty and open the other side like a serial port, from this process or any other; asr_sim_main.c
+ * does that as a standalone program. On a pseudo-terminal the simulator also sees the baud rate afLib's side is set
+ * to, and while it doesn't match the ASR's the two ends only see noise from each other.
+ */
+#ifndef AF_ASR_SIM_UART_H
+#define AF_ASR_SIM_UART_H
+
+#include "asr_sim.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef struct asr_sim_uart_t asr_sim_uart_t;
+
+/**
+ * asr_sim_uart_create
+ *
+ * Attach the simulator to fd, which is made non-blocking but not closed on destroy.
+ */
+asr_sim_uart_t *asr_sim_uart_create(asr_sim_t *sim, int fd);
+
+/**
+ * asr_sim_uart_create_pty
+ *
+ * Open a pseudo-terminal for the simulator to sit behind. asr_sim_uart_pty_name is the device to open for afLib.
+ */
+asr_sim_uart_t *asr_sim_uart_create_pty(asr_sim_t *sim);
+
+/**
+ * asr_sim_uart_pty_name
+ *
+ * @return the pseudo-terminal's device, or NULL if the simulator was given a descriptor instead
+ */
+const char *asr_sim_uart_pty_name(asr_sim_uart_t *uart);
+
+int asr_sim_uart_fd(asr_sim_uart_t *uart);
+
+/**
+ * asr_sim_uart_run
+ *
+ * Wait up to timeout_ms for afLib to send something or the simulator to have something due, then deal with whatever
+ * there is. A timeout of 0 just deals with what's already there.
+ *
+ * @return > 0 if anything was read or written, 0 if not, < 0 if poll failed
+ */
+int asr_sim_uart_run(asr_sim_uart_t *uart, int timeout_ms);
+
+void asr_sim_uart_destroy(asr_sim_uart_t *uart);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* AF_ASR_SIM_UART_H */
@@ -0,0 +1,503 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_bench: how fast the core afLib code runs on the host.
+ *
+ *     af_bench [-j] [-s scale] [-e line]... [filter]
+ *
+ * Each benchmark prints one line: its name, how many operations it timed, nanoseconds and operations per second, and
+ * how many allocations afLib made through its allocator per operation. -j prints JSON lines instead. Either way
+ * the output sorts and diffs cleanly between two builds, so run it before and after a change:
+ *
+ *     make -C extras/bench run > before.txt
+ *
+ * The txn_ benchmarks run whole transactions through the simulated ASR in extras/asr_sim, on an SPI link with no
+ * latency so they time afLib rather than the bus. -e adds a simulator script line to time them on a realistic link
+ * instead, "latency 200" for example. -s multiplies every operation count, and a filter only runs benchmarks whose
+ * names contain it.
+ *
+ * Logging is thrown away here, so a benchmark that makes afLib log doesn't end up timing the terminal.
+ */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "af_lib.h"
+#include "af_allocator.h"
+#include "af_command.h"
+#include "af_logger.h"
+#include "af_queue.h"
+#include "af_status_command.h"
+#include "af_utils.h"
+#include "sha2.h"
+#include "asr_sim.h"
+#include "asr_sim_transport.h"
+
+// An ASR attribute for sets, gets and notifications, and an MCU one for updates
+#define BENCH_ASR_ATTR_ID                   1024
+#define BENCH_MCU_ATTR_ID                   1
+
+// Give up on a transaction that takes longer than this, the simulator or afLib has wedged
+#define BENCH_TXN_TIMEOUT_MS                1000
+
+#define BENCH_QUEUE_ELEM_SIZE               16
+#define BENCH_QUEUE_DEPTH                   8
+
+typedef struct {
+    const char *name;
+    uint32_t ops;               // Before -s
+    int (*setup)(void);
+    int (*run)(uint32_t ops);
+} bench_t;
+
+static uint32_t s_allocs;
+static af_lib_t *s_af_lib;
+static af_transport_t *s_transport;
+static asr_sim_t *s_sim;
+static uint32_t s_events[AF_LIB_EVENT_COMMUNICATION_BREAKDOWN + 1];
+
+/****************************************************************************
+ *                                 Logging                                  *
+ ****************************************************************************/
+
+void af_logger_print_value(int32_t val) {
+}
+
+void af_logger_print_buffer(const char* val) {
+}
+
+void af_logger_print_formatted_value(int32_t val, af_logger_format_t format) {
+}
+
+void af_logger_println_value(int32_t val) {
+}
+
+void af_logger_println_buffer(const char* val) {
+}
+
+void af_logger_println_formatted_value(int32_t val, af_logger_format_t format) {
+}
+
+/****************************************************************************
+ *                                Allocator                                 *
+ ****************************************************************************/
+
+static void *counting_alloc(void *context, size_t size) {
+    s_allocs++;
+    return malloc(size);
+}
+
+static void counting_free(void *context, void *ptr) {
+    free(ptr);
+}
+
+static const af_lib_allocator_t s_counting_allocator = { counting_alloc, counting_free, NULL };
+
+/****************************************************************************
+ *                                 Queues                                   *
+ ****************************************************************************/
+
+AF_QUEUE_DECLARE(s_bench_queue, BENCH_QUEUE_ELEM_SIZE, BENCH_QUEUE_DEPTH);
+
+static uint8_t no_preemption_disable(void) {
+    return 0;
+}
+
+static void no_preemption_enable(uint8_t is_nested) {
+}
+
+static int queue_setup(void) {
+    af_queue_init_system(no_preemption_disable, no_preemption_enable);
+    AF_QUEUE_INIT(s_bench_queue, BENCH_QUEUE_ELEM_SIZE, BENCH_QUEUE_DEPTH);
+    return AF_SUCCESS;
+}
+
+// One element through the queue: take it from the free list, put it on, get it off and give it back
+static int bench_queue_put_get(uint32_t ops) {
+    void *elem;
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        elem = AF_QUEUE_ELEM_ALLOC(&s_bench_queue);
+        if (NULL == elem) {
+            return AF_ERROR_QUEUE_OVERFLOW;
+        }
+        AF_QUEUE_PUT(&s_bench_queue, elem);
+        elem = AF_QUEUE_GET(&s_bench_queue);
+        AF_QUEUE_ELEM_FREE(&s_bench_queue, elem);
+    }
+    return AF_SUCCESS;
+}
+
+// The same with the queue kept half full, so put and get walk past other elements
+static int bench_queue_put_get_half_full(uint32_t ops) {
+    void *elems[BENCH_QUEUE_DEPTH / 2];
+    void *elem;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_QUEUE_DEPTH / 2; i++) {
+        elems[i] = AF_QUEUE_ELEM_ALLOC(&s_bench_queue);
+        AF_QUEUE_PUT(&s_bench_queue, elems[i]);
+    }
+    for (i = 0; i < ops; i++) {
+        elem = AF_QUEUE_ELEM_ALLOC(&s_bench_queue);
+        AF_QUEUE_PUT(&s_bench_queue, elem);
+        elem = AF_QUEUE_GET(&s_bench_queue);
+        AF_QUEUE_ELEM_FREE(&s_bench_queue, elem);
+    }
+    while ((elem = AF_QUEUE_GET(&s_bench_queue)) != NULL) {
+        AF_QUEUE_ELEM_FREE(&s_bench_queue, elem);
+    }
+    return AF_SUCCESS;
+}
+
+/****************************************************************************
+ *                                 Codecs                                   *
+ ****************************************************************************/
+
+static uint8_t s_value[32];
+static uint8_t s_frame[AF_COMMAND_MAX_HEADER_LEN + sizeof(s_value)];
+static uint16_t s_frame_len;
+static volatile uint32_t s_sink;    // Keeps the compiler from dropping work whose result isn't otherwise used
+
+static int codec_setup(void) {
+    af_command_t command;
+
+    memset(s_value, 0xa5, sizeof(s_value));
+    af_command_initialize_with_status(&command, 1, MSG_TYPE_UPDATE, BENCH_ASR_ATTR_ID, 0, 0, sizeof(s_value), s_value, false);
+    s_frame_len = af_command_get_bytes(&command, s_frame);
+    af_command_cleanup(&command);
+    return AF_SUCCESS;
+}
+
+static int bench_command_encode(uint32_t ops) {
+    af_command_t command;
+    uint8_t bytes[sizeof(s_frame)];
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        af_command_initialize_with_value(&command, (uint8_t)i, MSG_TYPE_SET, BENCH_ASR_ATTR_ID, sizeof(s_value), s_value);
+        s_sink += af_command_get_bytes(&command, bytes);
+        af_command_cleanup(&command);
+    }
+    return AF_SUCCESS;
+}
+
+static int bench_command_decode(uint32_t ops) {
+    af_command_t command;
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        if (!af_command_initialize_from_buffer(&command, s_frame_len, s_frame, 2)) {
+            return AF_ERROR_INVALID_COMMAND;
+        }
+        s_sink += af_command_get_value_len(&command);
+        af_command_cleanup(&command);
+    }
+    return AF_SUCCESS;
+}
+
+// Build a status and check one the way afLib does on every exchange
+static int bench_status_checksum(uint32_t ops) {
+    af_status_command_t status;
+    uint8_t bytes[8];
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        af_status_command_initialize_with_bytes_to_send(&status, (uint16_t)i);
+        s_sink += af_status_command_get_bytes(&status, bytes);
+        af_status_command_set_checksum(&status, af_status_command_get_checksum(&status));
+        s_sink += af_status_command_is_valid(&status);
+    }
+    return AF_SUCCESS;
+}
+
+static uint8_t s_sha_data[1024];
+
+static int sha256(uint32_t ops, size_t len) {
+    isc_sha256_t context;
+    uint8_t digest[ISC_SHA256_DIGESTLENGTH];
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        isc_sha256_init(&context);
+        isc_sha256_update(&context, s_sha_data, len);
+        isc_sha256_final(digest, &context);
+        s_sink += digest[0];
+    }
+    return AF_SUCCESS;
+}
+
+static int bench_sha256_64(uint32_t ops) {
+    return sha256(ops, 64);
+}
+
+static int bench_sha256_1024(uint32_t ops) {
+    return sha256(ops, sizeof(s_sha_data));
+}
+
+/****************************************************************************
+ *                              Transactions                                *
+ ****************************************************************************/
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    if (event_type <= AF_LIB_EVENT_COMMUNICATION_BREAKDOWN) {
+        s_events[event_type]++;
+    }
+}
+
+/**
+ * run_until
+ *
+ * Loop afLib until event has happened count times in all.
+ */
+static int run_until(af_lib_event_type_t event, uint32_t count) {
+    long start = af_utils_millis();
+
+    while (s_events[event] < count) {
+        af_lib_loop(s_af_lib);
+        if (af_utils_millis() - start > BENCH_TXN_TIMEOUT_MS) {
+            return AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+static int txn_setup(void) {
+    long start = af_utils_millis();
+
+    if (s_af_lib != NULL) {
+        return AF_SUCCESS;
+    }
+    // Bring the ASR up once, later transaction benchmarks carry on with it
+    s_transport = asr_sim_transport_create(s_sim);
+    s_af_lib = NULL == s_transport ? NULL : af_lib_create_with_allocator(on_event, s_transport, &s_counting_allocator);
+    if (NULL == s_af_lib) {
+        return AF_ERROR_NOT_CREATED;
+    }
+    while (!asr_sim_is_up(s_sim) || af_lib_asr_has_capability(s_af_lib, AF_ASR_CAPABILITY_BATCHED_FRAMES) == AF_ERROR_BUSY ||
+           !af_lib_is_idle(s_af_lib)) {
+        af_lib_loop(s_af_lib);
+        if (af_utils_millis() - start > 5 * BENCH_TXN_TIMEOUT_MS) {
+            return AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+// Set an ASR attribute and wait for the ASR to report it set
+static int bench_txn_set(uint32_t ops) {
+    uint32_t i;
+    int result;
+
+    for (i = 0; i < ops; i++) {
+        while ((result = af_lib_set_attribute_32(s_af_lib, BENCH_ASR_ATTR_ID, i, AF_LIB_SET_REASON_LOCAL_CHANGE)) == AF_ERROR_QUEUE_OVERFLOW) {
+            af_lib_loop(s_af_lib);
+        }
+        if (result != AF_SUCCESS || run_until(AF_LIB_EVENT_ASR_SET_RESPONSE, s_events[AF_LIB_EVENT_ASR_SET_RESPONSE] + 1) != AF_SUCCESS) {
+            return result != AF_SUCCESS ? result : AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+static int bench_txn_get(uint32_t ops) {
+    uint32_t i;
+    int result;
+
+    for (i = 0; i < ops; i++) {
+        while ((result = af_lib_get_attribute(s_af_lib, BENCH_ASR_ATTR_ID)) == AF_ERROR_QUEUE_OVERFLOW) {
+            af_lib_loop(s_af_lib);
+        }
+        if (result != AF_SUCCESS || run_until(AF_LIB_EVENT_GET_RESPONSE, s_events[AF_LIB_EVENT_GET_RESPONSE] + 1) != AF_SUCCESS) {
+            return result != AF_SUCCESS ? result : AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+// The ASR pushes an update of one of its attributes and afLib passes it on
+static int bench_txn_notify(uint32_t ops) {
+    uint8_t value[4];
+    uint32_t i;
+
+    for (i = 0; i < ops; i++) {
+        af_utils_write_little_endian_32(i, value);
+        if (asr_sim_send_update(s_sim, BENCH_ASR_ATTR_ID, sizeof(value), value) != AF_SUCCESS ||
+            run_until(AF_LIB_EVENT_ASR_NOTIFICATION, s_events[AF_LIB_EVENT_ASR_NOTIFICATION] + 1) != AF_SUCCESS) {
+            return AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+// Update an MCU attribute, done once afLib has sent it
+static int bench_txn_mcu_update(uint32_t ops) {
+    uint32_t i;
+    int result;
+
+    for (i = 0; i < ops; i++) {
+        while ((result = af_lib_set_attribute_32(s_af_lib, BENCH_MCU_ATTR_ID, i, AF_LIB_SET_REASON_LOCAL_CHANGE)) == AF_ERROR_QUEUE_OVERFLOW) {
+            af_lib_loop(s_af_lib);
+        }
+        if (result != AF_SUCCESS || run_until(AF_LIB_EVENT_MCU_SET_REQ_SENT, s_events[AF_LIB_EVENT_MCU_SET_REQ_SENT] + 1) != AF_SUCCESS) {
+            return result != AF_SUCCESS ? result : AF_ERROR_TIMEOUT;
+        }
+    }
+    return AF_SUCCESS;
+}
+
+// A burst of MCU updates queued as fast as afLib takes them, which batches them where the ASR allows
+static int bench_txn_mcu_update_burst(uint32_t ops) {
+    uint32_t target = s_events[AF_LIB_EVENT_MCU_SET_REQ_SENT] + ops;
+    uint32_t i = 0;
+    int result;
+
+    while (i < ops) {
+        result = af_lib_set_attribute_32(s_af_lib, BENCH_MCU_ATTR_ID + (i % 8), i, AF_LIB_SET_REASON_LOCAL_CHANGE);
+        if (AF_SUCCESS == result) {
+            i++;
+        } else if (result != AF_ERROR_QUEUE_OVERFLOW && result != AF_ERROR_BUSY) {
+            return result;
+        } else {
+            af_lib_loop(s_af_lib);
+        }
+    }
+    return run_until(AF_LIB_EVENT_MCU_SET_REQ_SENT, target);
+}
+
+static const bench_t s_benches[] = {
+    { "queue_put_get",              2000000,    queue_setup,    bench_queue_put_get },
+    { "queue_put_get_half_full",    2000000,    queue_setup,    bench_queue_put_get_half_full },
+    { "command_encode",             2000000,    codec_setup,    bench_command_encode },
+    { "command_decode",             2000000,    codec_setup,    bench_command_decode },
+    { "status_checksum",            5000000,    NULL,           bench_status_checksum },
+    { "sha256_64",                  200000,     NULL,           bench_sha256_64 },
+    { "sha256_1024",                20000,      NULL,           bench_sha256_1024 },
+    { "txn_set",                    20000,      txn_setup,      bench_txn_set },
+    { "txn_get",                    20000,      txn_setup,      bench_txn_get },
+    { "txn_notify",                 20000,      txn_setup,      bench_txn_notify },
+    { "txn_mcu_update",             20000,      txn_setup,      bench_txn_mcu_update },
+    { "txn_mcu_update_burst",       20000,      txn_setup,      bench_txn_mcu_update_burst },
+};
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    double scale = 1.0;
+    bool json = false;
+    const bench_t *bench;
+    uint64_t start;
+    double ns;
+    uint32_t ops;
+    uint32_t allocs;
+    int failed = 0;
+    int result;
+    int opt;
+    uint8_t i;
+
+    s_sim = asr_sim_create();
+    if (NULL == s_sim) {
+        return 1;
+    }
+    // A clock so fast the bus never holds anything up
+    asr_sim_script(s_sim, "bus spi 4000000000 256");
+    asr_sim_script(s_sim, "latency 0");
+    asr_sim_script(s_sim, "reboot-time 0");
+    asr_sim_script(s_sim, "attr 1024 u32 0");
+
+    while ((opt = getopt(argc, argv, "je:s:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = true;
+                break;
+            case 'e':
+                if (asr_sim_script(s_sim, optarg) != AF_SUCCESS) {
+                    fprintf(stderr, "af_bench: bad line: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                scale = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-s scale] [-e line]... [filter]\n", argv[0]);
+                return 'h' == opt ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        filter = argv[optind];
+    }
+
+    af_allocator_set(&s_counting_allocator);
+    if (!json) {
+        printf("# %-26s %10s %12s %14s %12s\n", "name", "ops", "ns/op", "ops/s", "allocs/op");
+    }
+    for (i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+        bench = &s_benches[i];
+        if (filter != NULL && NULL == strstr(bench->name, filter)) {
+            continue;
+        }
+        ops = (uint32_t)(bench->ops * scale);
+        if (0 == ops) {
+            ops = 1;
+        }
+
+        result = NULL == bench->setup ? AF_SUCCESS : bench->setup();
+        s_allocs = 0;
+        start = now_ns();
+        if (AF_SUCCESS == result) {
+            result = bench->run(ops);
+        }
+        ns = (double)(now_ns() - start);
+        allocs = s_allocs;
+
+        if (result != AF_SUCCESS) {
+            fprintf(stderr, "af_bench: %s failed (%d)\n", bench->name, result);
+            failed = 1;
+            continue;
+        }
+        if (json) {
+            printf("{\"name\":\"%s\",\"ops\":%u,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"allocs_per_op\":%.3f}\n",
+                   bench->name, ops, ns / ops, ops * 1e9 / ns, (double)allocs / ops);
+        } else {
+            printf("  %-26s %10u %12.1f %14.0f %12.3f\n", bench->name, ops, ns / ops, ops * 1e9 / ns, (double)allocs / ops);
+        }
+        fflush(stdout);
+    }
+
+    if (s_af_lib != NULL) {
+        af_lib_destroy(s_af_lib);
+    }
+    if (s_transport != NULL) {
+        asr_sim_transport_destroy(s_transport);
+    }
+    asr_sim_destroy(s_sim);
+    return failed;
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "af_logger.h"
+
+// Log to stderr, which leaves stdout to the application
+
+static void print_formatted(int32_t val, af_logger_format_t format) {
+    int i;
+
+    switch (format) {
+        case AF_LOGGER_HEX:
+            fprintf(stderr, "%X", (unsigned)val);
+            break;
+        case AF_LOGGER_OCT:
+            fprintf(stderr, "%o", (unsigned)val);
+            break;
+        case AF_LOGGER_BIN:
+            for (i = 31; i > 0 && !((uint32_t)val & (1UL << i)); i--) {
+            }
+            for (; i >= 0; i--) {
+                fputc(((uint32_t)val & (1UL << i)) ? '1' : '0', stderr);
+            }
+            break;
+        default:
+            fprintf(stderr, "%ld", (long)val);
+            break;
+    }
+}
+
+void af_logger_print_value(int32_t val) {
+    fprintf(stderr, "%ld", (long)val);
+}
+
+void af_logger_print_buffer(const char* val) {
+    fputs(val, stderr);
+}
+
+void af_logger_print_formatted_value(int32_t val, af_logger_format_t format) {
+    print_formatted(val, format);
+}
+
+void af_logger_println_value(int32_t val) {
+    fprintf(stderr, "%ld\n", (long)val);
+}
+
+void af_logger_println_buffer(const char* val) {
+    fprintf(stderr, "%s\n", val);
+}
+
+void af_logger_println_formatted_value(int32_t val, af_logger_format_t format) {
+    print_formatted(val, format);
+    fputc('\n', stderr);
+}
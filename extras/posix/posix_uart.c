@@ -0,0 +1,500 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// cfmakeraw and CRTSCTS aren't POSIX proper
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "posix_uart.h"
+#include "af_lib.h"
+#include "af_logger.h"
+#include "af_msg_types.h"
+#include "af_utils.h"
+#include "af_allocator.h"
+
+#define INT_CHAR                            0x32
+#define MAX_WAIT_TIME                       1000
+
+/*
+ * Bytes held between af_lib_loop() calls. Unlike on an MCU these are cheap, so each read() and write() can move a
+ * whole frame or more at once.
+ */
+#ifndef POSIX_UART_RX_BUFFER_SIZE
+#define POSIX_UART_RX_BUFFER_SIZE           1024
+#endif
+
+#ifndef POSIX_UART_TX_BUFFER_SIZE
+#define POSIX_UART_TX_BUFFER_SIZE           1024
+#endif
+
+// Fastest baud rate afLib may negotiate
+#ifndef POSIX_UART_MAX_BAUD_RATE
+#define POSIX_UART_MAX_BAUD_RATE            115200
+#endif
+
+typedef struct {
+    af_transport_t base;    // Must be first
+    int fd;
+    bool owns_fd;
+    bool is_tty;            // Baud rates only mean something for a terminal
+    uint32_t baud_rate;
+
+    // Received bytes from rx_start up to rx_end, moved back to the front when the end fills up
+    uint8_t rx[POSIX_UART_RX_BUFFER_SIZE];
+    uint16_t rx_start;
+    uint16_t rx_end;
+
+    // Bytes waiting for the descriptor to take them, same scheme as rx
+    uint8_t tx[POSIX_UART_TX_BUFFER_SIZE];
+    uint16_t tx_start;
+    uint16_t tx_end;
+
+    bool status_sent;       // exchange_status has written its status and is waiting on the reply
+    bool waiting;           // A read is waiting on the ASR, since wait_start
+    long wait_start;
+} posix_uart_t;
+
+static const struct {
+    uint32_t baud_rate;
+    speed_t speed;
+} s_speeds[] = {
+    { 4800, B4800 },
+    { 9600, B9600 },
+    { 19200, B19200 },
+    { 38400, B38400 },
+    { 57600, B57600 },
+    { 115200, B115200 },
+};
+
+static bool posix_uart_speed(uint32_t baud_rate, speed_t *speed) {
+    uint8_t i;
+
+    for (i = 0; i < sizeof(s_speeds) / sizeof(s_speeds[0]); i++) {
+        if (s_speeds[i].baud_rate == baud_rate) {
+            *speed = s_speeds[i].speed;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * posix_uart_configure
+ *
+ * Raw 8N1 with no flow control, and reads that never wait since the descriptor is non-blocking anyway.
+ */
+static int posix_uart_configure(posix_uart_t *uart, uint32_t baud_rate) {
+    struct termios tio;
+    speed_t speed;
+
+    if (!uart->is_tty) {
+        uart->baud_rate = baud_rate;
+        return AF_SUCCESS;
+    }
+    if (!posix_uart_speed(baud_rate, &speed)) {
+        return AF_ERROR_INVALID_PARAM;
+    }
+    if (tcgetattr(uart->fd, &tio) < 0) {
+        return AF_ERROR_UNKNOWN;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    // TCSADRAIN lets anything already written go out at the old rate
+    if (tcsetattr(uart->fd, TCSADRAIN, &tio) < 0) {
+        return AF_ERROR_UNKNOWN;
+    }
+    uart->baud_rate = baud_rate;
+    return AF_SUCCESS;
+}
+
+static uint16_t rx_count(posix_uart_t *uart) {
+    return uart->rx_end - uart->rx_start;
+}
+
+static uint16_t tx_count(posix_uart_t *uart) {
+    return uart->tx_end - uart->tx_start;
+}
+
+/**
+ * fill_rx
+ *
+ * Read everything the descriptor has, as few read() calls as it takes.
+ */
+static void fill_rx(posix_uart_t *uart) {
+    ssize_t n;
+
+    for (;;) {
+        if (POSIX_UART_RX_BUFFER_SIZE == uart->rx_end) {
+            if (0 == uart->rx_start) {
+                return;
+            }
+            memmove(uart->rx, &uart->rx[uart->rx_start], rx_count(uart));
+            uart->rx_end -= uart->rx_start;
+            uart->rx_start = 0;
+        }
+        n = read(uart->fd, &uart->rx[uart->rx_end], POSIX_UART_RX_BUFFER_SIZE - uart->rx_end);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != EIO) {
+                af_logger_print_buffer("posix_uart read failed: ");
+                af_logger_println_value(errno);
+            }
+            return;
+        }
+        uart->rx_end += (uint16_t)n;
+    }
+}
+
+/**
+ * pump_tx
+ *
+ * Hand the descriptor as much of the transmit queue as it will take without blocking.
+ */
+static void pump_tx(posix_uart_t *uart) {
+    ssize_t n;
+
+    while (tx_count(uart) > 0) {
+        n = write(uart->fd, &uart->tx[uart->tx_start], tx_count(uart));
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                af_logger_print_buffer("posix_uart write failed: ");
+                af_logger_println_value(errno);
+            }
+            return;
+        }
+        uart->tx_start += (uint16_t)n;
+    }
+    uart->tx_start = 0;
+    uart->tx_end = 0;
+}
+
+/**
+ * queue_tx
+ *
+ * Queue up to len bytes for transmit, returning how many there was room for.
+ */
+static uint16_t queue_tx(posix_uart_t *uart, const uint8_t *bytes, uint16_t len) {
+    if (uart->tx_start > 0 && POSIX_UART_TX_BUFFER_SIZE - uart->tx_end < len) {
+        memmove(uart->tx, &uart->tx[uart->tx_start], tx_count(uart));
+        uart->tx_end -= uart->tx_start;
+        uart->tx_start = 0;
+    }
+    if (len > POSIX_UART_TX_BUFFER_SIZE - uart->tx_end) {
+        len = POSIX_UART_TX_BUFFER_SIZE - uart->tx_end;
+    }
+    memcpy(&uart->tx[uart->tx_end], bytes, len);
+    uart->tx_end += len;
+    return len;
+}
+
+/**
+ * keep_waiting
+ *
+ * Called when a read is still short of bytes. Returns AF_ERROR_BUSY while it's worth waiting for more and
+ * AF_ERROR_TIMEOUT once nothing has arrived for MAX_WAIT_TIME.
+ */
+static int keep_waiting(posix_uart_t *uart, bool progress) {
+    long now = af_utils_millis();
+
+    if (!uart->waiting || progress) {
+        uart->waiting = true;
+        uart->wait_start = now;
+    } else if (now - uart->wait_start > MAX_WAIT_TIME) {
+        uart->waiting = false;
+        return AF_ERROR_TIMEOUT;
+    }
+    return AF_ERROR_BUSY;
+}
+
+static void posix_uart_check_for_interrupt(af_transport_t *af_transport, int *interrupts_pending, bool idle) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+
+    pump_tx(uart);
+    fill_rx(uart);
+
+    while (rx_count(uart) > 0) {
+        if (INT_CHAR == uart->rx[uart->rx_start]) {
+            if (0 == *interrupts_pending) {
+                uart->rx_start++;
+                *interrupts_pending += 1;
+                // No longer idle, anything after this belongs to the transfer it starts
+                break;
+            } else if (idle) {
+                uart->rx_start++;
+            } else {
+                break;
+            }
+        } else {
+            if (*interrupts_pending != 0) {
+                break;
+            }
+            uart->rx_start++;
+        }
+    }
+}
+
+static int posix_uart_exchange_status(af_transport_t *af_transport, af_status_command_t *af_status_command_tx, af_status_command_t *af_status_command_rx) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+    int result = AF_SUCCESS;
+    uint16_t len = af_status_command_get_size(af_status_command_tx);
+    uint8_t bytes[len + 1];
+    uint8_t *rbytes;
+
+    af_status_command_get_bytes(af_status_command_tx, bytes);
+
+    if (!uart->status_sent) {
+        bytes[len] = af_status_command_get_checksum(af_status_command_tx);
+        queue_tx(uart, bytes, len + 1);
+        uart->status_sent = true;
+        uart->waiting = false;
+    }
+
+    pump_tx(uart);
+    fill_rx(uart);
+
+    // Skip any interrupts that may have come in.
+    while (rx_count(uart) > 0 && INT_CHAR == uart->rx[uart->rx_start]) {
+        uart->rx_start++;
+    }
+
+    // Wait for the whole reply to be in before taking any of it
+    if (rx_count(uart) < len + 1) {
+        result = keep_waiting(uart, false);
+        if (result != AF_ERROR_BUSY) {
+            uart->status_sent = false;
+        }
+        return result;
+    }
+    rbytes = &uart->rx[uart->rx_start];
+    uart->rx_start += len + 1;
+    uart->status_sent = false;
+    uart->waiting = false;
+
+    if (bytes[0] != SYNC_REQUEST && bytes[0] != SYNC_ACK) {
+        af_logger_print_buffer("exchangeStatus bad cmd: ");
+        af_logger_println_formatted_value(bytes[0], AF_LOGGER_HEX);
+        result = AF_ERROR_INVALID_COMMAND;
+    }
+
+    af_status_command_set_bytes_to_send(af_status_command_rx, af_utils_read_little_endian_16(&rbytes[1]));
+    af_status_command_set_bytes_to_recv(af_status_command_rx, af_utils_read_little_endian_16(&rbytes[3]));
+    af_status_command_set_checksum(af_status_command_rx, rbytes[5]);
+
+    return result;
+}
+
+static int posix_uart_write_status(af_transport_t *af_transport, af_status_command_t *af_status_command) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+    int result = AF_SUCCESS;
+    uint16_t len = af_status_command_get_size(af_status_command);
+    uint8_t bytes[len + 1];
+
+    af_status_command_get_bytes(af_status_command, bytes);
+    bytes[len] = af_status_command_get_checksum(af_status_command);
+    queue_tx(uart, bytes, len + 1);
+    pump_tx(uart);
+
+    if (bytes[0] != SYNC_REQUEST && bytes[0] != SYNC_ACK) {
+        af_logger_print_buffer("writeStatus bad cmd: ");
+        af_logger_println_formatted_value(bytes[0], AF_LOGGER_HEX);
+        result = AF_ERROR_INVALID_COMMAND;
+    }
+
+    return result;
+}
+
+static int posix_uart_send_bytes_offset(af_transport_t *af_transport, uint8_t *bytes, uint16_t *bytes_to_send, uint16_t *offset) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+    uint16_t len;
+
+    pump_tx(uart);
+
+    // Queue as much as there's room for, the rest waits for a later call
+    len = queue_tx(uart, &bytes[*offset], *bytes_to_send);
+    pump_tx(uart);
+
+    *offset += len;
+    *bytes_to_send -= len;
+
+    // The frame isn't sent until the last of it has been handed to the descriptor
+    return tx_count(uart) > 0 ? AF_ERROR_BUSY : AF_SUCCESS;
+}
+
+static int posix_uart_recv_bytes_offset(af_transport_t *af_transport, uint8_t **bytes, uint16_t *bytes_len, uint16_t *bytes_to_recv, uint16_t *offset) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+    uint16_t len = *bytes_to_recv;
+
+    if (0 == *offset) {
+        *bytes_len = *bytes_to_recv;
+        if (NULL == *bytes) {
+            *bytes = (uint8_t *)af_allocator_malloc(*bytes_len);
+            if (NULL == *bytes) {
+                return AF_ERROR_UNKNOWN;
+            }
+        }
+    }
+
+    // Take whatever has arrived, afLib calls again for the rest
+    pump_tx(uart);
+    fill_rx(uart);
+    if (len > rx_count(uart)) {
+        len = rx_count(uart);
+    }
+    memcpy(*bytes + *offset, &uart->rx[uart->rx_start], len);
+    uart->rx_start += len;
+
+    *offset += len;
+    *bytes_to_recv -= len;
+
+    if (*bytes_to_recv > 0) {
+        return keep_waiting(uart, len > 0);
+    }
+    uart->waiting = false;
+
+    return AF_SUCCESS;
+}
+
+static bool posix_uart_has_work(af_transport_t *af_transport) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+
+    return tx_count(uart) > 0 || rx_count(uart) > 0;
+}
+
+static int posix_uart_get_baud_rate(af_transport_t *af_transport, uint32_t *baud_rate, uint32_t *max_baud_rate) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+
+    *baud_rate = uart->baud_rate;
+    *max_baud_rate = POSIX_UART_MAX_BAUD_RATE;
+    return AF_SUCCESS;
+}
+
+static int posix_uart_set_baud_rate(af_transport_t *af_transport, uint32_t baud_rate) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+
+    // Whatever is still queued belongs to the old rate
+    while (tx_count(uart) > 0) {
+        struct pollfd pfd = { uart->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, MAX_WAIT_TIME) <= 0) {
+            break;
+        }
+        pump_tx(uart);
+    }
+    return posix_uart_configure(uart, baud_rate);
+}
+
+static const af_transport_ops_t s_posix_uart_ops = {
+    posix_uart_check_for_interrupt,
+    posix_uart_exchange_status,
+    posix_uart_write_status,
+    posix_uart_send_bytes_offset,
+    posix_uart_recv_bytes_offset,
+    posix_uart_has_work,
+    posix_uart_get_baud_rate,
+    posix_uart_set_baud_rate,
+    NULL,
+    NULL,
+    posix_uart_destroy,
+};
+
+static af_transport_t *posix_uart_open(int fd, bool owns_fd, uint32_t baud_rate) {
+    posix_uart_t *uart;
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return NULL;
+    }
+
+    uart = (posix_uart_t *)af_allocator_malloc(sizeof(posix_uart_t));
+    if (NULL == uart) {
+        return NULL;
+    }
+    memset(uart, 0, sizeof(posix_uart_t));
+    uart->base.ops = &s_posix_uart_ops;
+    uart->fd = fd;
+    uart->owns_fd = owns_fd;
+    uart->is_tty = isatty(fd);
+
+    if (posix_uart_configure(uart, baud_rate) != AF_SUCCESS) {
+        af_allocator_free(uart);
+        return NULL;
+    }
+    if (uart->is_tty) {
+        tcflush(fd, TCIOFLUSH);
+    }
+    return &uart->base;
+}
+
+af_transport_t *posix_uart_create(const char *device, uint32_t baud_rate) {
+    af_transport_t *result;
+    int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    result = posix_uart_open(fd, true, baud_rate);
+    if (NULL == result) {
+        close(fd);
+    }
+    return result;
+}
+
+af_transport_t *posix_uart_create_fd(int fd, uint32_t baud_rate) {
+    return posix_uart_open(fd, false, baud_rate);
+}
+
+int posix_uart_fd(af_transport_t *af_transport) {
+    return ((posix_uart_t *)af_transport)->fd;
+}
+
+int posix_uart_wait(af_transport_t *af_transport, int timeout_ms) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+    struct pollfd pfd;
+    int result;
+
+    if (rx_count(uart) > 0) {
+        return 1;
+    }
+
+    pfd.fd = uart->fd;
+    pfd.events = POLLIN | (tx_count(uart) > 0 ? POLLOUT : 0);
+    pfd.revents = 0;
+    do {
+        result = poll(&pfd, 1, timeout_ms);
+    } while (result < 0 && EINTR == errno);
+
+    return result;
+}
+
+void posix_uart_destroy(af_transport_t *af_transport) {
+    posix_uart_t *uart = (posix_uart_t *)af_transport;
+
+    if (uart->owns_fd) {
+        close(uart->fd);
+    }
+    af_allocator_free(uart);
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * UART transport for Linux and other POSIX hosts, talking to the ASR through a serial device.
+ *
+ * The descriptor is non-blocking and nothing in the transport ever waits on it. Instead of spinning on af_lib_loop a
+ * host waits in posix_uart_wait, which sleeps in poll() until the ASR sends something or the transmit queue can drain,
+ * or adds posix_uart_fd to its own poll/epoll set. Build it with the core afLib files plus posix_utils.c and
+ * posix_logger.c in place of the Arduino ones:
+ *
+ *     af_transport_t *transport = posix_uart_create("/dev/ttyUSB0", 9600);
+ *     af_lib_t *af_lib = af_lib_create_with_unified_callback(callback, transport);
+ *     for (;;) {
+ *         posix_uart_wait(transport, af_lib_is_idle(af_lib) ? 100 : 10);
+ *         af_lib_loop(af_lib);
+ *     }
+ *
+ * Any descriptor that reads and writes bytes will do, posix_uart_create_fd takes one end of a pseudo-terminal pair or
+ * a socketpair as readily as a real port.
+ */
+#ifndef AF_POSIX_UART_TRANSPORT_H
+#define AF_POSIX_UART_TRANSPORT_H
+
+#include "af_transport.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/**
+ * posix_uart_create
+ *
+ * Open a serial device and set it up for the ASR: raw, 8N1, non-blocking, at baud_rate.
+ *
+ * @return the transport, or NULL if the device couldn't be opened or doesn't support baud_rate
+ */
+af_transport_t *posix_uart_create(const char *device, uint32_t baud_rate);
+
+/**
+ * posix_uart_create_fd
+ *
+ * Use an already open descriptor, which the transport makes non-blocking but doesn't close. If it's a terminal it's
+ * set up the same way as posix_uart_create does, anything else is used as it is and ignores baud rate changes.
+ */
+af_transport_t *posix_uart_create_fd(int fd, uint32_t baud_rate);
+
+/**
+ * posix_uart_fd
+ *
+ * The descriptor the transport reads and writes, for hosts that poll it themselves. It wants POLLIN always and
+ * POLLOUT while af_transport_has_work says there's transmit left to drain.
+ */
+int posix_uart_fd(af_transport_t *af_transport);
+
+/**
+ * posix_uart_wait
+ *
+ * Sleep until the ASR has sent something, queued bytes can be written, or timeout_ms passes. Returns straight away if
+ * received bytes are already waiting to be looked at.
+ *
+ * @return > 0  - the transport has work for af_lib_loop
+ * @return 0    - timed out
+ * @return < 0  - poll failed, errno says why
+ */
+int posix_uart_wait(af_transport_t *af_transport, int timeout_ms);
+
+void posix_uart_destroy(af_transport_t *af_transport);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* AF_POSIX_UART_TRANSPORT_H */
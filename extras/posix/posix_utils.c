@@ -0,0 +1,44 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <time.h>
+
+#include "af_utils.h"
+
+static struct timespec s_start;
+
+static uint64_t elapsed_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (0 == s_start.tv_sec && 0 == s_start.tv_nsec) {
+        s_start = now;
+    }
+    return (uint64_t)(now.tv_sec - s_start.tv_sec) * 1000000 + (now.tv_nsec - s_start.tv_nsec) / 1000;
+}
+
+// Both count from the first call and wrap the same way millis() and micros() do on an Arduino
+long af_utils_millis() {
+    return (long)(elapsed_us() / 1000);
+}
+
+uint32_t af_utils_micros() {
+    return (uint32_t)elapsed_us();
+}
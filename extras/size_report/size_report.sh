@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Copyright 2018 Afero, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# What each AF_LOG_LEVEL costs in flash and RAM.
+#
+#     size_report.sh                      afLib's logging files built with $CC (cc by default) at every level
+#     size_report.sh -b arduino:avr:uno   every example sketch built with arduino-cli at every level
+#
+# Without -b the report is for af_lib.c, af_command.c and af_status_command.c, the files AF_LOG_LEVEL applies to.
+# "strings" is the part of text that is log messages, which an AVR also copies into RAM at startup. With -b the
+# numbers are the ones arduino-cli prints for the whole sketch, so they include the platform files and the core.
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+LEVELS="0:NONE 1:ERROR 2:WARN 3:INFO 4:DEBUG 5:TRACE"
+FQBN=
+
+while getopts b: opt; do
+    case $opt in
+        b) FQBN=$OPTARG ;;
+        *) echo "usage: $0 [-b fqbn]" >&2; exit 1 ;;
+    esac
+done
+
+if [ -z "$FQBN" ]; then
+    CC=${CC:-cc}
+    OUT=$(mktemp -d) || exit 1
+    trap 'rm -rf "$OUT"' EXIT
+
+    printf '%-8s %10s %10s %10s\n' level text strings data
+    for level in $LEVELS; do
+        n=${level%%:*}
+        for f in af_lib af_command af_status_command; do
+            $CC -std=gnu99 -Os -w -c -DAF_LOG_LEVEL=$n -I"$ROOT" -o "$OUT/$f.o" "$ROOT/$f.c" || exit 1
+        done
+        code=$(size -t "$OUT"/*.o | awk 'END { print $1 }')
+        data=$(size -t "$OUT"/*.o | awk 'END { print $2 }')
+        strings=$((0 $(objdump -h "$OUT"/*.o | awk '$2 ~ /^\.rodata\.str/ { printf " + 0x%s", $3 }')))
+        printf '%-8s %10s %10s %10s\n' "${level#*:}" "$code" "$strings" "$data"
+    done
+    exit 0
+fi
+
+printf '%-24s %-8s %10s %10s\n' sketch level flash ram
+for sketch in "$ROOT"/examples/*/; do
+    for level in $LEVELS; do
+        n=${level%%:*}
+        result=$(arduino-cli compile -b "$FQBN" --library "$ROOT" \
+            --build-property "compiler.c.extra_flags=-DAF_LOG_LEVEL=$n" \
+            --build-property "compiler.cpp.extra_flags=-DAF_LOG_LEVEL=$n" "$sketch" 2>&1)
+        flash=$(echo "$result" | sed -n 's/^Sketch uses \([0-9]*\) bytes.*/\1/p')
+        ram=$(echo "$result" | sed -n 's/^Global variables use \([0-9]*\) bytes.*/\1/p')
+        printf '%-24s %-8s %10s %10s\n' "$(basename "$sketch")" "${level#*:}" "${flash:-failed}" "${ram:-failed}"
+    done
+done
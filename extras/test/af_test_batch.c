@@ -0,0 +1,217 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_test_batch: MCU attribute updates, batched and not, against the simulated ASR in extras/asr_sim.
+ *
+ * A burst of updates is queued while afLib is idle and then run through to completion. Every update has to come back
+ * as one AF_LIB_EVENT_MCU_SET_REQ_SENT callback, reach the ASR as one command with its value intact, and go out in
+ * the expected number of transfers: as many as there are updates when either side can't batch, as few as the batch
+ * buffer allows when both can. afLib is built both ways by the Makefile, with AF_LIB_BATCH_BUFFER_SIZE set and
+ * without, and the batching build is also run against an ASR that doesn't advertise batched frames.
+ *
+ * Exits non-zero if anything doesn't match.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "af_lib.h"
+#include "af_utils.h"
+#include "asr_sim.h"
+#include "asr_sim_transport.h"
+
+#define TEST_UPDATE_COUNT                   6
+#define TEST_FIRST_MCU_ATTR_ID              1
+#define TEST_TIMEOUT_MS                     2000
+#define TEST_SETTLE_MS                      50
+
+// An update of a 32 bit value takes its length, the command header and the value
+#define TEST_UPDATE_FRAME_SIZE              (2 + 8 + 4)
+
+static uint32_t s_sent;
+static uint32_t s_sent_attrs[TEST_UPDATE_COUNT];
+static uint32_t s_unexpected;
+static int s_failures;
+
+#define CHECK(name, cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "af_test_batch: %s: %s failed\n", (name), #cond);           \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    uint16_t index = attribute_id - TEST_FIRST_MCU_ATTR_ID;
+
+    switch (event_type) {
+        case AF_LIB_EVENT_MCU_SET_REQ_SENT:
+            s_sent++;
+            if (index < TEST_UPDATE_COUNT && AF_SUCCESS == error) {
+                s_sent_attrs[index]++;
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_MCU_SET_REQ_REJECTION:
+        case AF_LIB_EVENT_COMMUNICATION_BREAKDOWN:
+            s_unexpected++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool run_until(af_lib_t *af_lib, bool (*done)(af_lib_t *af_lib)) {
+    long start = af_utils_millis();
+
+    while (!done(af_lib)) {
+        af_lib_loop(af_lib);
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool asr_ready(af_lib_t *af_lib) {
+    return af_lib_asr_has_capability(af_lib, AF_ASR_CAPABILITY_BATCHED_FRAMES) != AF_ERROR_BUSY && af_lib_is_idle(af_lib);
+}
+
+/**
+ * settle
+ *
+ * Wait out whatever afLib does on its own once the ASR is up, link negotiation for one, so none of it gets counted.
+ */
+static bool settle(af_lib_t *af_lib, asr_sim_t *sim) {
+    long start = af_utils_millis();
+    long quiet_since = start;
+    uint32_t syncs = asr_sim_get_stats(sim)->syncs;
+
+    while (af_utils_millis() - quiet_since < TEST_SETTLE_MS) {
+        af_lib_loop(af_lib);
+        if (syncs != asr_sim_get_stats(sim)->syncs || !af_lib_is_idle(af_lib)) {
+            syncs = asr_sim_get_stats(sim)->syncs;
+            quiet_since = af_utils_millis();
+        }
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool updates_sent(af_lib_t *af_lib) {
+    return s_sent >= TEST_UPDATE_COUNT && af_lib_is_idle(af_lib);
+}
+
+/**
+ * run_case
+ *
+ * Queue the burst of updates and check how it went out. asr_batches says whether the ASR advertises batched frames.
+ */
+static void run_case(const char *name, bool asr_batches) {
+    asr_sim_t *sim = asr_sim_create();
+    af_transport_t *transport;
+    af_lib_t *af_lib;
+    asr_sim_stats_t before;
+    const asr_sim_stats_t *after;
+    const uint8_t *value;
+    uint16_t value_len;
+    uint32_t transfers;
+    uint32_t expected;
+    uint16_t i;
+
+    CHECK(name, sim != NULL);
+    if (NULL == sim) {
+        return;
+    }
+    asr_sim_script(sim, "bus spi 4000000000 256");
+    asr_sim_script(sim, "latency 0");
+    asr_sim_script(sim, "reboot-time 0");
+    asr_sim_script(sim, asr_batches ? "capabilities 40" : "capabilities 00");
+
+    transport = asr_sim_transport_create(sim);
+    af_lib = NULL == transport ? NULL : af_lib_create_with_unified_callback(on_event, transport);
+    CHECK(name, af_lib != NULL);
+    if (NULL == af_lib) {
+        if (transport != NULL) {
+            asr_sim_transport_destroy(transport);
+        }
+        asr_sim_destroy(sim);
+        return;
+    }
+
+    CHECK(name, run_until(af_lib, asr_ready) && settle(af_lib, sim));
+    before = *asr_sim_get_stats(sim);
+    s_sent = 0;
+    s_unexpected = 0;
+    memset(s_sent_attrs, 0, sizeof(s_sent_attrs));
+
+    // All queued before the loop runs, so a batching afLib finds them waiting behind the first
+    for (i = 0; i < TEST_UPDATE_COUNT; i++) {
+        CHECK(name, af_lib_set_attribute_32(af_lib, TEST_FIRST_MCU_ATTR_ID + i, 0x1000 + i, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    }
+    CHECK(name, run_until(af_lib, updates_sent));
+
+    after = asr_sim_get_stats(sim);
+    transfers = after->syncs - before.syncs;
+    expected = TEST_UPDATE_COUNT;
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+    if (asr_batches) {
+        uint32_t per_transfer = AF_LIB_BATCH_BUFFER_SIZE / TEST_UPDATE_FRAME_SIZE;
+
+        if (per_transfer > AF_LIB_MAX_BATCH) {
+            per_transfer = AF_LIB_MAX_BATCH;
+        }
+        expected = (TEST_UPDATE_COUNT + per_transfer - 1) / per_transfer;
+    }
+#endif
+
+    CHECK(name, TEST_UPDATE_COUNT == s_sent);
+    CHECK(name, 0 == s_unexpected);
+    CHECK(name, TEST_UPDATE_COUNT == after->frames_in - before.frames_in);
+    CHECK(name, TEST_UPDATE_COUNT == after->updates - before.updates);
+    CHECK(name, 0 == after->bad_status - before.bad_status);
+    CHECK(name, expected == transfers);
+    for (i = 0; i < TEST_UPDATE_COUNT; i++) {
+        CHECK(name, 1 == s_sent_attrs[i]);
+        value = asr_sim_get_attribute(sim, TEST_FIRST_MCU_ATTR_ID + i, &value_len);
+        CHECK(name, value != NULL && 4 == value_len && af_utils_read_little_endian_32(value) == 0x1000U + i);
+    }
+    printf("%-24s %u updates in %u transfers, expected %u\n", name, TEST_UPDATE_COUNT, transfers, expected);
+
+    af_lib_destroy(af_lib);
+    asr_sim_transport_destroy(transport);
+    asr_sim_destroy(sim);
+}
+
+int main(int argc, char **argv) {
+#if AF_LIB_BATCH_BUFFER_SIZE > 0
+    run_case("batched", true);
+    run_case("asr_without_batching", false);
+#else
+    run_case("unbatched", true);
+#endif
+
+    if (s_failures > 0) {
+        fprintf(stderr, "af_test_batch: %d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_test_coalesce: repeated sets of the same attribute, coalesced and not, against the simulated ASR in extras/asr_sim.
+ *
+ * Several values for an MCU attribute and an ASR attribute are queued while afLib is idle, along with a get. With
+ * coalescing on, only the last value of each may reach the ASR, as one command with one callback, the others counted
+ * by af_lib_get_coalesced_count(), and the get goes out as usual. A value too big for the queued request's storage
+ * goes out as a request of its own. With coalescing off every value goes out.
+ *
+ * Exits non-zero if anything doesn't match.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "af_lib.h"
+#include "af_utils.h"
+#include "asr_sim.h"
+#include "asr_sim_transport.h"
+
+#define TEST_MCU_ATTR_ID                    1
+#define TEST_LONG_MCU_ATTR_ID               2
+#define TEST_ASR_ATTR_ID                    1024
+#define TEST_SET_ASR_ATTR_ID                1100
+#define TEST_MCU_UPDATES                    4
+#define TEST_ASR_SETS                       3
+#define TEST_TIMEOUT_MS                     2000
+#define TEST_SETTLE_MS                      50
+
+// Longer than AF_LIB_REQUEST_INLINE_VALUE_SIZE, so it can't replace a value stored inline
+#define TEST_LONG_VALUE_LEN                 16
+
+static uint32_t s_mcu_sent;
+static uint32_t s_long_sent;
+static uint32_t s_asr_set_responses;
+static uint32_t s_last_asr_set_value;
+static uint32_t s_get_responses;
+static uint32_t s_unexpected;
+static int s_failures;
+
+#define CHECK(name, cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "af_test_coalesce: %s: %s failed\n", (name), #cond);        \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    switch (event_type) {
+        case AF_LIB_EVENT_MCU_SET_REQ_SENT:
+            if (TEST_MCU_ATTR_ID == attribute_id) {
+                s_mcu_sent++;
+            } else if (TEST_LONG_MCU_ATTR_ID == attribute_id) {
+                s_long_sent++;
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_ASR_SET_RESPONSE:
+            if (TEST_SET_ASR_ATTR_ID == attribute_id && 4 == value_len) {
+                s_asr_set_responses++;
+                s_last_asr_set_value = af_utils_read_little_endian_32(value);
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_GET_RESPONSE:
+            if (TEST_ASR_ATTR_ID == attribute_id && 4 == value_len && 7 == af_utils_read_little_endian_32(value)) {
+                s_get_responses++;
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_MCU_SET_REQ_REJECTION:
+        case AF_LIB_EVENT_COMMUNICATION_BREAKDOWN:
+            s_unexpected++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool run_until(af_lib_t *af_lib, bool (*done)(af_lib_t *af_lib)) {
+    long start = af_utils_millis();
+
+    while (!done(af_lib)) {
+        af_lib_loop(af_lib);
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * settle
+ *
+ * Run until the ASR is up and afLib has been idle a while, so its own start up traffic is over.
+ */
+static bool settle(af_lib_t *af_lib, asr_sim_t *sim) {
+    long start = af_utils_millis();
+    long quiet_since = start;
+    uint32_t syncs = asr_sim_get_stats(sim)->syncs;
+
+    while (!asr_sim_is_up(sim) || af_utils_millis() - quiet_since < TEST_SETTLE_MS) {
+        af_lib_loop(af_lib);
+        if (syncs != asr_sim_get_stats(sim)->syncs || !af_lib_is_idle(af_lib)) {
+            syncs = asr_sim_get_stats(sim)->syncs;
+            quiet_since = af_utils_millis();
+        }
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool get_answered(af_lib_t *af_lib) {
+    return s_get_responses > 0 && af_lib_is_idle(af_lib);
+}
+
+/**
+ * run_case
+ *
+ * Queue the values and the get, let them all go out, and check what reached the ASR.
+ */
+static void run_case(const char *name, bool coalesce) {
+    asr_sim_t *sim = asr_sim_create();
+    af_transport_t *transport;
+    af_lib_t *af_lib;
+    asr_sim_stats_t before;
+    const asr_sim_stats_t *after;
+    uint8_t long_value[TEST_LONG_VALUE_LEN];
+    const uint8_t *value;
+    uint16_t value_len;
+    uint32_t expected_updates = coalesce ? 1 : TEST_MCU_UPDATES;
+    uint32_t expected_sets = coalesce ? 1 : TEST_ASR_SETS;
+    uint32_t i;
+
+    CHECK(name, sim != NULL);
+    if (NULL == sim) {
+        return;
+    }
+    asr_sim_script(sim, "bus spi 4000000000 256");
+    asr_sim_script(sim, "latency 0");
+    asr_sim_script(sim, "reboot-time 0");
+    asr_sim_script(sim, "attr 1024 u32 7");
+
+    transport = asr_sim_transport_create(sim);
+    af_lib = NULL == transport ? NULL : af_lib_create_with_unified_callback(on_event, transport);
+    CHECK(name, af_lib != NULL);
+    if (NULL == af_lib) {
+        if (transport != NULL) {
+            asr_sim_transport_destroy(transport);
+        }
+        asr_sim_destroy(sim);
+        return;
+    }
+
+    CHECK(name, settle(af_lib, sim));
+    af_lib_set_coalescing(af_lib, coalesce);
+    before = *asr_sim_get_stats(sim);
+    s_mcu_sent = s_long_sent = s_asr_set_responses = s_last_asr_set_value = s_get_responses = s_unexpected = 0;
+
+    // All queued before the loop runs, so the later values find the earlier ones still waiting
+    for (i = 0; i < TEST_MCU_UPDATES; i++) {
+        CHECK(name, af_lib_set_attribute_32(af_lib, TEST_MCU_ATTR_ID, 0x1000 + i, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    }
+    for (i = 0; i < TEST_ASR_SETS; i++) {
+        CHECK(name, af_lib_set_attribute_32(af_lib, TEST_SET_ASR_ATTR_ID, 0x2000 + i, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    }
+    memset(long_value, 0x5a, sizeof(long_value));
+    CHECK(name, af_lib_set_attribute_32(af_lib, TEST_LONG_MCU_ATTR_ID, 0x3000, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, af_lib_set_attribute_bytes(af_lib, TEST_LONG_MCU_ATTR_ID, sizeof(long_value), long_value, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_ASR_ATTR_ID) == AF_SUCCESS);
+    CHECK(name, run_until(af_lib, get_answered) && settle(af_lib, sim));
+
+    after = asr_sim_get_stats(sim);
+    CHECK(name, 0 == s_unexpected);
+    CHECK(name, 1 == s_get_responses);
+    CHECK(name, expected_updates == s_mcu_sent);
+    CHECK(name, expected_sets == s_asr_set_responses && 0x2000 + TEST_ASR_SETS - 1 == s_last_asr_set_value);
+    CHECK(name, 2 == s_long_sent);
+    CHECK(name, expected_updates + 2 == after->updates - before.updates);
+    CHECK(name, expected_sets == after->sets - before.sets);
+    CHECK(name, 1 == after->gets - before.gets);
+
+    // Whatever was coalesced, the ASR ends up with the last value of each
+    value = asr_sim_get_attribute(sim, TEST_MCU_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && 4 == value_len && 0x1000 + TEST_MCU_UPDATES - 1 == af_utils_read_little_endian_32(value));
+    value = asr_sim_get_attribute(sim, TEST_SET_ASR_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && 4 == value_len && 0x2000 + TEST_ASR_SETS - 1 == af_utils_read_little_endian_32(value));
+    value = asr_sim_get_attribute(sim, TEST_LONG_MCU_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && sizeof(long_value) == value_len && 0 == memcmp(value, long_value, sizeof(long_value)));
+
+    CHECK(name, af_lib_get_coalesced_count(af_lib, TEST_MCU_ATTR_ID) == (coalesce ? TEST_MCU_UPDATES - 1 : 0));
+    CHECK(name, af_lib_get_coalesced_count(af_lib, TEST_SET_ASR_ATTR_ID) == (coalesce ? TEST_ASR_SETS - 1 : 0));
+    CHECK(name, 0 == af_lib_get_coalesced_count(af_lib, TEST_LONG_MCU_ATTR_ID));
+    CHECK(name, 0 == af_lib_get_coalesced_count(af_lib, TEST_ASR_ATTR_ID));
+    printf("%-24s %u updates and %u sets reached the ASR\n", name, after->updates - before.updates, after->sets - before.sets);
+
+    af_lib_destroy(af_lib);
+    asr_sim_transport_destroy(transport);
+    asr_sim_destroy(sim);
+}
+
+int main(int argc, char **argv) {
+    run_case("coalesced", true);
+    run_case("not_coalesced", false);
+
+    if (s_failures > 0) {
+        fprintf(stderr, "af_test_coalesce: %d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_test_lanes: the request lanes under a full queue, against the simulated ASR in extras/asr_sim.
+ *
+ * The ASR sets an MCU attribute and afLib holds off answering while the MCU fills every slot the bulk lane can reach
+ * with updates. A get and the set response must still find room in their own lanes, one get more must not, and once
+ * afLib runs the set response has to go out first, then the get, then the updates in the order they were made, which
+ * the trace shows.
+ *
+ * Built by the Makefile with a trace. Exits non-zero if anything doesn't match.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "af_lib.h"
+#include "af_trace.h"
+#include "af_utils.h"
+#include "asr_sim.h"
+#include "asr_sim_transport.h"
+
+#define TEST_SET_MCU_ATTR_ID                3
+#define TEST_FIRST_MCU_ATTR_ID              10
+#define TEST_ASR_ATTR_ID                    1024
+#define TEST_TIMEOUT_MS                     2000
+#define TEST_SETTLE_MS                      50
+
+// Every slot a bulk request can take: the shared ones and the one more the bulk lane's queue has
+#define TEST_BULK_SLOTS                     (AF_LIB_REQUEST_QUEUE_SIZE - AF_LIB_CONTROL_QUEUE_SIZE - AF_LIB_SET_RESPONSE_QUEUE_SIZE - AF_LIB_INTERACTIVE_QUEUE_SIZE + 1)
+
+#if AF_LIB_TRACE_SIZE < 64
+#error "af_test_lanes needs a trace of at least 64 records"
+#endif
+
+static uint32_t s_set_requests;
+static uint32_t s_set_responses_sent;
+static uint32_t s_updates_sent;
+static uint32_t s_get_responses;
+static uint32_t s_unexpected;
+static uint8_t s_trace[AF_LIB_TRACE_SIZE * AF_TRACE_RECORD_SIZE];
+static int s_failures;
+
+#define CHECK(name, cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "af_test_lanes: %s: %s failed\n", (name), #cond);           \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    switch (event_type) {
+        case AF_LIB_EVENT_MCU_SET_REQUEST:
+            // Answered later by the test, once the queue is full
+            if (TEST_SET_MCU_ATTR_ID == attribute_id) {
+                s_set_requests++;
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_MCU_SET_REQ_SENT:
+            if (TEST_SET_MCU_ATTR_ID == attribute_id) {
+                s_set_responses_sent++;
+            } else if (attribute_id >= TEST_FIRST_MCU_ATTR_ID && attribute_id < TEST_FIRST_MCU_ATTR_ID + TEST_BULK_SLOTS) {
+                s_updates_sent++;
+            } else {
+                s_unexpected++;
+            }
+            break;
+
+        case AF_LIB_EVENT_GET_RESPONSE:
+            // afLib's own gets while it starts up come back here too
+            if (TEST_ASR_ATTR_ID == attribute_id) {
+                if (4 == value_len && 7 == af_utils_read_little_endian_32(value)) {
+                    s_get_responses++;
+                } else {
+                    s_unexpected++;
+                }
+            }
+            break;
+
+        case AF_LIB_EVENT_MCU_SET_REQ_REJECTION:
+        case AF_LIB_EVENT_MCU_SET_REQUEST_RESPONSE_TIMEOUT:
+        case AF_LIB_EVENT_COMMUNICATION_BREAKDOWN:
+            s_unexpected++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool run_until(af_lib_t *af_lib, bool (*done)(af_lib_t *af_lib)) {
+    long start = af_utils_millis();
+
+    while (!done(af_lib)) {
+        af_lib_loop(af_lib);
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * settle
+ *
+ * Run until the ASR is up and afLib has been idle a while, so its own start up traffic is over.
+ */
+static bool settle(af_lib_t *af_lib, asr_sim_t *sim) {
+    long start = af_utils_millis();
+    long quiet_since = start;
+    uint32_t syncs = asr_sim_get_stats(sim)->syncs;
+
+    while (!asr_sim_is_up(sim) || af_utils_millis() - quiet_since < TEST_SETTLE_MS) {
+        af_lib_loop(af_lib);
+        if (syncs != asr_sim_get_stats(sim)->syncs || !af_lib_is_idle(af_lib)) {
+            syncs = asr_sim_get_stats(sim)->syncs;
+            quiet_since = af_utils_millis();
+        }
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool set_requested(af_lib_t *af_lib) {
+    return s_set_requests > 0;
+}
+
+static bool all_sent(af_lib_t *af_lib) {
+    return s_get_responses > 0 && TEST_BULK_SLOTS == s_updates_sent && af_lib_is_idle(af_lib);
+}
+
+/**
+ * trace_sent
+ *
+ * Copy the attributes of the commands afLib sent, in the order it sent them, skipping the first skip records.
+ * Returns how many there were.
+ */
+static int trace_sent(af_lib_t *af_lib, size_t skip, uint16_t *attr_ids, int max) {
+    size_t len = af_lib_get_trace(af_lib, s_trace, sizeof(s_trace));
+    const uint8_t *record;
+    int count = 0;
+    size_t i;
+
+    for (i = skip; i < len / AF_TRACE_RECORD_SIZE; i++) {
+        record = &s_trace[i * AF_TRACE_RECORD_SIZE];
+        if (AF_TRACE_EVENT_SENT == record[9]) {
+            if (count < max) {
+                attr_ids[count] = af_utils_read_little_endian_16(&record[4]);
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+static void test_full_queue(af_lib_t *af_lib, asr_sim_t *sim) {
+    const char *name = "full_queue";
+    uint16_t attr_ids[TEST_BULK_SLOTS + 2];
+    const uint8_t *value;
+    uint16_t value_len;
+    uint8_t set_value = 42;
+    size_t skip;
+    int sent;
+    int i;
+
+    CHECK(name, asr_sim_send_set(sim, TEST_SET_MCU_ATTR_ID, sizeof(set_value), &set_value) == AF_SUCCESS);
+    CHECK(name, run_until(af_lib, set_requested));
+    skip = af_lib_get_trace(af_lib, s_trace, sizeof(s_trace)) / AF_TRACE_RECORD_SIZE;
+
+    // afLib doesn't send anything while it waits for the set response, so nothing leaves the queue until it's made
+    for (i = 0; i < TEST_BULK_SLOTS; i++) {
+        CHECK(name, af_lib_set_attribute_32(af_lib, TEST_FIRST_MCU_ATTR_ID + i, 0x1000 + i, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    }
+    CHECK(name, af_lib_set_attribute_32(af_lib, TEST_FIRST_MCU_ATTR_ID, 0x2000, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_ERROR_QUEUE_OVERFLOW);
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_ASR_ATTR_ID) == AF_SUCCESS);
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_ASR_ATTR_ID) == AF_ERROR_QUEUE_OVERFLOW);
+    CHECK(name, af_lib_send_set_response(af_lib, TEST_SET_MCU_ATTR_ID, true, sizeof(set_value), &set_value) == AF_SUCCESS);
+    CHECK(name, run_until(af_lib, all_sent) && settle(af_lib, sim));
+
+    CHECK(name, 1 == s_set_requests);
+    CHECK(name, 1 == s_set_responses_sent);
+    CHECK(name, 1 == s_get_responses);
+    CHECK(name, TEST_BULK_SLOTS == s_updates_sent);
+
+    sent = trace_sent(af_lib, skip, attr_ids, TEST_BULK_SLOTS + 2);
+    CHECK(name, TEST_BULK_SLOTS + 2 == sent);
+    if (TEST_BULK_SLOTS + 2 == sent) {
+        CHECK(name, TEST_SET_MCU_ATTR_ID == attr_ids[0]);
+        CHECK(name, TEST_ASR_ATTR_ID == attr_ids[1]);
+        for (i = 0; i < TEST_BULK_SLOTS; i++) {
+            CHECK(name, TEST_FIRST_MCU_ATTR_ID + i == attr_ids[i + 2]);
+        }
+    }
+
+    value = asr_sim_get_attribute(sim, TEST_SET_MCU_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && 1 == value_len && set_value == value[0]);
+    for (i = 0; i < TEST_BULK_SLOTS; i++) {
+        value = asr_sim_get_attribute(sim, TEST_FIRST_MCU_ATTR_ID + i, &value_len);
+        CHECK(name, value != NULL && 4 == value_len && 0x1000 + i == af_utils_read_little_endian_32(value));
+    }
+    printf("%-24s set response, get and %d updates sent in lane order\n", name, TEST_BULK_SLOTS);
+}
+
+int main(int argc, char **argv) {
+    asr_sim_t *sim = asr_sim_create();
+    af_transport_t *transport = NULL;
+    af_lib_t *af_lib = NULL;
+
+    if (sim != NULL) {
+        asr_sim_script(sim, "bus spi 4000000000 256");
+        asr_sim_script(sim, "latency 0");
+        asr_sim_script(sim, "reboot-time 0");
+        asr_sim_script(sim, "attr 1024 u32 7");
+        transport = asr_sim_transport_create(sim);
+    }
+    af_lib = NULL == transport ? NULL : af_lib_create_with_unified_callback(on_event, transport);
+
+    CHECK("setup", af_lib != NULL);
+    if (af_lib != NULL) {
+        CHECK("setup", settle(af_lib, sim));
+        test_full_queue(af_lib, sim);
+        CHECK("setup", 0 == s_unexpected);
+        CHECK("setup", 0 == asr_sim_get_stats(sim)->bad_status);
+        // The trace has to have held everything for the order to be right
+        CHECK("setup", af_lib_get_trace(af_lib, s_trace, sizeof(s_trace)) < sizeof(s_trace));
+        af_lib_destroy(af_lib);
+    }
+    if (transport != NULL) {
+        asr_sim_transport_destroy(transport);
+    }
+    asr_sim_destroy(sim);
+
+    if (s_failures > 0) {
+        fprintf(stderr, "af_test_lanes: %d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
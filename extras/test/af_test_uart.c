@@ -0,0 +1,240 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_test_uart: afLib on the POSIX UART transport, talking to the simulated ASR over a real byte stream.
+ *
+ * The ASR sits behind asr_sim_uart, first on a pseudo-terminal pair that posix_uart_create opens like a serial port,
+ * then on a socketpair handed to posix_uart_create_fd. Both run in this process, the ASR getting its turn between
+ * af_lib_loop calls. Over each one afLib has to see the ASR come up, then get and set an ASR attribute, update an MCU
+ * one and take a notification from the ASR, with the right callbacks and values and no garbled statuses.
+ *
+ * Exits non-zero if anything doesn't match.
+ */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "af_lib.h"
+#include "af_utils.h"
+#include "asr_sim.h"
+#include "asr_sim_uart.h"
+#include "posix_uart.h"
+
+#define TEST_BAUD_RATE                      115200
+#define TEST_ASR_ATTR_ID                    1024
+#define TEST_MCU_ATTR_ID                    1
+#define TEST_TIMEOUT_MS                     5000
+#define TEST_SETTLE_MS                      50
+
+typedef struct {
+    asr_sim_t *sim;
+    asr_sim_uart_t *uart;
+    af_transport_t *transport;
+    af_lib_t *af_lib;
+} test_link_t;
+
+static uint32_t s_events[AF_LIB_EVENT_COMMUNICATION_BREAKDOWN + 1];
+static uint16_t s_last_attr_id[AF_LIB_EVENT_COMMUNICATION_BREAKDOWN + 1];
+static uint32_t s_last_value[AF_LIB_EVENT_COMMUNICATION_BREAKDOWN + 1];
+static int s_failures;
+
+#define CHECK(name, cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "af_test_uart: %s: %s failed\n", (name), #cond);            \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    if (event_type > AF_LIB_EVENT_COMMUNICATION_BREAKDOWN) {
+        return;
+    }
+    s_events[event_type]++;
+    s_last_attr_id[event_type] = attribute_id;
+    s_last_value[event_type] = 4 == value_len && value != NULL ? af_utils_read_little_endian_32(value) : 0;
+}
+
+/**
+ * step
+ *
+ * One turn each for the ASR and afLib, sleeping briefly in between when neither has anything to do.
+ */
+static void step(test_link_t *link) {
+    asr_sim_uart_run(link->uart, 0);
+    posix_uart_wait(link->transport, 1);
+    af_lib_loop(link->af_lib);
+}
+
+// Run until event comes round once more and afLib is idle again
+static bool run_until_event(test_link_t *link, af_lib_event_type_t event) {
+    long start = af_utils_millis();
+    uint32_t count = s_events[event] + 1;
+
+    while (s_events[event] < count || !af_lib_is_idle(link->af_lib)) {
+        step(link);
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * wait_for_asr
+ *
+ * Run until the ASR is up and afLib has been idle a while, so its own start up traffic is over.
+ */
+static bool wait_for_asr(test_link_t *link) {
+    long start = af_utils_millis();
+    long quiet_since = start;
+    uint32_t syncs = asr_sim_get_stats(link->sim)->syncs;
+
+    while (!asr_sim_is_up(link->sim) || af_utils_millis() - quiet_since < TEST_SETTLE_MS) {
+        step(link);
+        if (syncs != asr_sim_get_stats(link->sim)->syncs || !af_lib_is_idle(link->af_lib)) {
+            syncs = asr_sim_get_stats(link->sim)->syncs;
+            quiet_since = af_utils_millis();
+        }
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * run_transactions
+ *
+ * A get, a set, an MCU update and a notification over a link that's already been set up.
+ */
+static void run_transactions(const char *name, test_link_t *link) {
+    asr_sim_stats_t before;
+    const asr_sim_stats_t *after;
+    const uint8_t *value;
+    uint16_t value_len;
+    uint8_t notify[4];
+
+    link->af_lib = af_lib_create_with_unified_callback(on_event, link->transport);
+    CHECK(name, link->af_lib != NULL);
+    if (NULL == link->af_lib) {
+        return;
+    }
+    memset(s_events, 0, sizeof(s_events));
+
+    CHECK(name, wait_for_asr(link));
+    before = *asr_sim_get_stats(link->sim);
+
+    CHECK(name, af_lib_get_attribute(link->af_lib, TEST_ASR_ATTR_ID) == AF_SUCCESS);
+    CHECK(name, run_until_event(link, AF_LIB_EVENT_GET_RESPONSE));
+    CHECK(name, TEST_ASR_ATTR_ID == s_last_attr_id[AF_LIB_EVENT_GET_RESPONSE] && 7 == s_last_value[AF_LIB_EVENT_GET_RESPONSE]);
+
+    CHECK(name, af_lib_set_attribute_32(link->af_lib, TEST_ASR_ATTR_ID, 9, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, run_until_event(link, AF_LIB_EVENT_ASR_SET_RESPONSE));
+    CHECK(name, TEST_ASR_ATTR_ID == s_last_attr_id[AF_LIB_EVENT_ASR_SET_RESPONSE] && 9 == s_last_value[AF_LIB_EVENT_ASR_SET_RESPONSE]);
+    value = asr_sim_get_attribute(link->sim, TEST_ASR_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && 4 == value_len && 9 == af_utils_read_little_endian_32(value));
+
+    CHECK(name, af_lib_set_attribute_32(link->af_lib, TEST_MCU_ATTR_ID, 0x12345678, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, run_until_event(link, AF_LIB_EVENT_MCU_SET_REQ_SENT));
+    value = asr_sim_get_attribute(link->sim, TEST_MCU_ATTR_ID, &value_len);
+    CHECK(name, value != NULL && 4 == value_len && 0x12345678 == af_utils_read_little_endian_32(value));
+
+    af_utils_write_little_endian_32(11, notify);
+    CHECK(name, asr_sim_send_update(link->sim, TEST_ASR_ATTR_ID, sizeof(notify), notify) == AF_SUCCESS);
+    CHECK(name, run_until_event(link, AF_LIB_EVENT_ASR_NOTIFICATION));
+    CHECK(name, TEST_ASR_ATTR_ID == s_last_attr_id[AF_LIB_EVENT_ASR_NOTIFICATION] && 11 == s_last_value[AF_LIB_EVENT_ASR_NOTIFICATION]);
+
+    after = asr_sim_get_stats(link->sim);
+    CHECK(name, 0 == after->bad_status - before.bad_status);
+    CHECK(name, 0 == after->dropped - before.dropped);
+    CHECK(name, 0 == s_events[AF_LIB_EVENT_COMMUNICATION_BREAKDOWN]);
+    CHECK(name, 0 == s_events[AF_LIB_EVENT_MCU_SET_REQ_REJECTION]);
+    printf("%-24s %u syncs, %u bytes in, %u bytes out\n", name, after->syncs - before.syncs, after->bytes_in - before.bytes_in,
+           after->bytes_out - before.bytes_out);
+
+    af_lib_destroy(link->af_lib);
+    link->af_lib = NULL;
+}
+
+static asr_sim_t *create_sim(void) {
+    asr_sim_t *sim = asr_sim_create();
+
+    if (sim != NULL) {
+        asr_sim_script(sim, "bus uart 115200");
+        asr_sim_script(sim, "latency 0");
+        asr_sim_script(sim, "reboot-time 0");
+        asr_sim_script(sim, "attr 1024 u32 7");
+    }
+    return sim;
+}
+
+static void test_pty(void) {
+    test_link_t link;
+
+    memset(&link, 0, sizeof(link));
+    link.sim = create_sim();
+    link.uart = NULL == link.sim ? NULL : asr_sim_uart_create_pty(link.sim);
+    link.transport = NULL == link.uart ? NULL : posix_uart_create(asr_sim_uart_pty_name(link.uart), TEST_BAUD_RATE);
+    CHECK("pty", link.transport != NULL);
+    if (link.transport != NULL) {
+        run_transactions("pty", &link);
+        posix_uart_destroy(link.transport);
+    }
+    if (link.uart != NULL) {
+        asr_sim_uart_destroy(link.uart);
+    }
+    asr_sim_destroy(link.sim);
+}
+
+static void test_socketpair(void) {
+    test_link_t link;
+    int fds[2];
+
+    CHECK("socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    memset(&link, 0, sizeof(link));
+    link.sim = create_sim();
+    link.uart = NULL == link.sim ? NULL : asr_sim_uart_create(link.sim, fds[0]);
+    link.transport = NULL == link.uart ? NULL : posix_uart_create_fd(fds[1], TEST_BAUD_RATE);
+    CHECK("socketpair", link.transport != NULL);
+    if (link.transport != NULL) {
+        run_transactions("socketpair", &link);
+        posix_uart_destroy(link.transport);
+    }
+    if (link.uart != NULL) {
+        asr_sim_uart_destroy(link.uart);
+    }
+    asr_sim_destroy(link.sim);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char **argv) {
+    test_pty();
+    test_socketpair();
+
+    if (s_failures > 0) {
+        fprintf(stderr, "af_test_uart: %d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
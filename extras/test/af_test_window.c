@@ -0,0 +1,291 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_test_window: gets and sets pipelined through the in flight window, against the simulated ASR in extras/asr_sim.
+ *
+ * The ASR holds back its answers until a whole window's worth of requests has reached it and then sends them newest
+ * first, which it can only see if afLib really has them all out at once. Every answer has to come back as a callback
+ * with the right attribute and value, and be matched to its own request by request id even when two requests are for
+ * the same attribute, which the trace shows. Once they're in, the window has to be free again straight away. Then one
+ * request more than the window is held back, so afLib has to give up on the first ones after
+ * MAX_COMMAND_RESULT_TIME_MILLIS before the last can go.
+ *
+ * Built by the Makefile with AF_LIB_IN_FLIGHT_WINDOW set to 4, a trace and a short MAX_COMMAND_RESULT_TIME_MILLIS.
+ * Exits non-zero if anything doesn't match.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "af_lib.h"
+#include "af_trace.h"
+#include "af_utils.h"
+#include "asr_sim.h"
+#include "asr_sim_transport.h"
+
+#define TEST_FIRST_ASR_ATTR_ID              1024
+#define TEST_SET_ASR_ATTR_ID                1100
+#define TEST_TIMEOUT_MS                     2000
+#define TEST_SETTLE_MS                      50
+#define TEST_MAX_EVENTS                     16
+
+#if AF_LIB_IN_FLIGHT_WINDOW < 4
+#error "af_test_window needs AF_LIB_IN_FLIGHT_WINDOW of at least 4"
+#endif
+
+typedef struct {
+    af_lib_event_type_t type;
+    af_lib_error_t error;
+    uint16_t attr_id;
+    uint32_t value;
+} test_event_t;
+
+static test_event_t s_events[TEST_MAX_EVENTS];
+static int s_event_count;
+static uint32_t s_unexpected;
+static uint8_t s_trace[AF_LIB_TRACE_SIZE * AF_TRACE_RECORD_SIZE];
+static int s_failures;
+
+#define CHECK(name, cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "af_test_window: %s: %s failed\n", (name), #cond);          \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static void on_event(const af_lib_event_type_t event_type, const af_lib_error_t error, const uint16_t attribute_id, const uint16_t value_len, const uint8_t *value) {
+    switch (event_type) {
+        case AF_LIB_EVENT_GET_RESPONSE:
+        case AF_LIB_EVENT_ASR_SET_RESPONSE:
+            if (s_event_count < TEST_MAX_EVENTS) {
+                s_events[s_event_count].type = event_type;
+                s_events[s_event_count].error = error;
+                s_events[s_event_count].attr_id = attribute_id;
+                s_events[s_event_count].value = 4 == value_len && value != NULL ? af_utils_read_little_endian_32(value) : 0;
+            }
+            s_event_count++;
+            break;
+
+        case AF_LIB_EVENT_MCU_SET_REQ_REJECTION:
+        case AF_LIB_EVENT_COMMUNICATION_BREAKDOWN:
+            s_unexpected++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool run_until_events(af_lib_t *af_lib, int count) {
+    long start = af_utils_millis();
+
+    while (s_event_count < count || !af_lib_is_idle(af_lib)) {
+        af_lib_loop(af_lib);
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * settle
+ *
+ * Run until the ASR is up and afLib has been idle a while, so its own start up traffic is over.
+ */
+static bool settle(af_lib_t *af_lib, asr_sim_t *sim) {
+    long start = af_utils_millis();
+    long quiet_since = start;
+    uint32_t syncs = asr_sim_get_stats(sim)->syncs;
+
+    while (!asr_sim_is_up(sim) || af_utils_millis() - quiet_since < TEST_SETTLE_MS) {
+        af_lib_loop(af_lib);
+        if (syncs != asr_sim_get_stats(sim)->syncs || !af_lib_is_idle(af_lib)) {
+            syncs = asr_sim_get_stats(sim)->syncs;
+            quiet_since = af_utils_millis();
+        }
+        if (af_utils_millis() - start > TEST_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * trace_responses
+ *
+ * Copy the request ids of the responses afLib matched, in the order it matched them, skipping the first skip
+ * records. Returns how many there were.
+ */
+static int trace_responses(af_lib_t *af_lib, size_t skip, uint8_t *request_ids, int max) {
+    size_t len = af_lib_get_trace(af_lib, s_trace, sizeof(s_trace));
+    const uint8_t *record;
+    int count = 0;
+    size_t i;
+
+    for (i = skip; i < len / AF_TRACE_RECORD_SIZE; i++) {
+        record = &s_trace[i * AF_TRACE_RECORD_SIZE];
+        if (AF_TRACE_EVENT_RESPONSE == record[9]) {
+            if (count < max) {
+                request_ids[count] = record[6];
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * check_event
+ *
+ * The callback at index has to be for the given request, with its value.
+ */
+static void check_event(const char *name, int index, af_lib_event_type_t type, uint16_t attr_id, uint32_t value) {
+    const test_event_t *event = &s_events[index];
+
+    CHECK(name, index < s_event_count);
+    CHECK(name, type == event->type && AF_SUCCESS == event->error);
+    CHECK(name, attr_id == event->attr_id && value == event->value);
+}
+
+static asr_sim_t *create_sim(void) {
+    asr_sim_t *sim = asr_sim_create();
+    char line[32];
+    uint16_t i;
+
+    if (sim != NULL) {
+        asr_sim_script(sim, "bus spi 4000000000 256");
+        asr_sim_script(sim, "latency 0");
+        asr_sim_script(sim, "reboot-time 0");
+        for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW + 1; i++) {
+            snprintf(line, sizeof(line), "attr %u u32 %u", TEST_FIRST_ASR_ATTR_ID + i, 100 + i);
+            asr_sim_script(sim, line);
+        }
+    }
+    return sim;
+}
+
+/**
+ * test_out_of_order
+ *
+ * Two gets and two sets of the same attribute, answered in reverse once all four are out.
+ */
+static void test_out_of_order(af_lib_t *af_lib, asr_sim_t *sim) {
+    const char *name = "out_of_order";
+    size_t skip = af_lib_get_trace(af_lib, s_trace, sizeof(s_trace)) / AF_TRACE_RECORD_SIZE;
+    uint8_t request_ids[TEST_MAX_EVENTS];
+    long start;
+    int matched;
+    int i;
+
+    s_event_count = 0;
+    asr_sim_script(sim, "reorder 4");
+    start = af_utils_millis();
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_FIRST_ASR_ATTR_ID) == AF_SUCCESS);
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_FIRST_ASR_ATTR_ID + 1) == AF_SUCCESS);
+    CHECK(name, af_lib_set_attribute_32(af_lib, TEST_SET_ASR_ATTR_ID, 200, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, af_lib_set_attribute_32(af_lib, TEST_SET_ASR_ATTR_ID, 201, AF_LIB_SET_REASON_LOCAL_CHANGE) == AF_SUCCESS);
+    CHECK(name, run_until_events(af_lib, 4));
+
+    // All four had to be out before the first answer, and none of them waited out a timeout
+    CHECK(name, 4 == s_event_count);
+    CHECK(name, af_utils_millis() - start < MAX_COMMAND_RESULT_TIME_MILLIS);
+    check_event(name, 0, AF_LIB_EVENT_ASR_SET_RESPONSE, TEST_SET_ASR_ATTR_ID, 201);
+    check_event(name, 1, AF_LIB_EVENT_ASR_SET_RESPONSE, TEST_SET_ASR_ATTR_ID, 200);
+    check_event(name, 2, AF_LIB_EVENT_GET_RESPONSE, TEST_FIRST_ASR_ATTR_ID + 1, 101);
+    check_event(name, 3, AF_LIB_EVENT_GET_RESPONSE, TEST_FIRST_ASR_ATTR_ID, 100);
+
+    // Matched newest first by request id, the two sets of the same attribute included
+    matched = trace_responses(af_lib, skip, request_ids, TEST_MAX_EVENTS);
+    CHECK(name, 4 == matched);
+    for (i = 1; i < matched && i < TEST_MAX_EVENTS; i++) {
+        CHECK(name, 1 == (uint8_t)(request_ids[i - 1] - request_ids[i]));
+    }
+
+    // Every answer freed its slot, so the window is open again without waiting out a timeout
+    s_event_count = 0;
+    asr_sim_script(sim, "reorder 0");
+    start = af_utils_millis();
+    CHECK(name, af_lib_get_attribute(af_lib, TEST_FIRST_ASR_ATTR_ID + 3) == AF_SUCCESS);
+    CHECK(name, run_until_events(af_lib, 1));
+    CHECK(name, af_utils_millis() - start < MAX_COMMAND_RESULT_TIME_MILLIS);
+    check_event(name, 0, AF_LIB_EVENT_GET_RESPONSE, TEST_FIRST_ASR_ATTR_ID + 3, 103);
+    printf("%-24s %d answers matched newest first\n", name, matched);
+}
+
+/**
+ * test_timeout
+ *
+ * One get more than the window, all held back until the last one reaches the ASR. afLib only sends it once the
+ * requests filling the window have timed out, and their late answers still reach the application.
+ */
+static void test_timeout(af_lib_t *af_lib, asr_sim_t *sim) {
+    const char *name = "timeout";
+    size_t skip = af_lib_get_trace(af_lib, s_trace, sizeof(s_trace)) / AF_TRACE_RECORD_SIZE;
+    uint8_t request_ids[TEST_MAX_EVENTS];
+    char line[16];
+    long start;
+    long elapsed;
+    int i;
+
+    s_event_count = 0;
+    snprintf(line, sizeof(line), "reorder %d", AF_LIB_IN_FLIGHT_WINDOW + 1);
+    asr_sim_script(sim, line);
+    start = af_utils_millis();
+    for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW + 1; i++) {
+        CHECK(name, af_lib_get_attribute(af_lib, TEST_FIRST_ASR_ATTR_ID + i) == AF_SUCCESS);
+    }
+    CHECK(name, run_until_events(af_lib, AF_LIB_IN_FLIGHT_WINDOW + 1));
+    elapsed = af_utils_millis() - start;
+
+    CHECK(name, AF_LIB_IN_FLIGHT_WINDOW + 1 == s_event_count);
+    CHECK(name, elapsed >= MAX_COMMAND_RESULT_TIME_MILLIS);
+    for (i = 0; i < AF_LIB_IN_FLIGHT_WINDOW + 1 && i < s_event_count; i++) {
+        check_event(name, i, AF_LIB_EVENT_GET_RESPONSE, TEST_FIRST_ASR_ATTR_ID + AF_LIB_IN_FLIGHT_WINDOW - i, 100 + AF_LIB_IN_FLIGHT_WINDOW - i);
+    }
+    // The ones that timed out were no longer in flight to match
+    CHECK(name, 1 == trace_responses(af_lib, skip, request_ids, TEST_MAX_EVENTS));
+    printf("%-24s last get went out after %ldms\n", name, elapsed);
+}
+
+int main(int argc, char **argv) {
+    asr_sim_t *sim = create_sim();
+    af_transport_t *transport = NULL == sim ? NULL : asr_sim_transport_create(sim);
+    af_lib_t *af_lib = NULL == transport ? NULL : af_lib_create_with_unified_callback(on_event, transport);
+
+    CHECK("setup", af_lib != NULL);
+    if (af_lib != NULL) {
+        CHECK("setup", settle(af_lib, sim));
+        test_out_of_order(af_lib, sim);
+        test_timeout(af_lib, sim);
+        CHECK("setup", 0 == s_unexpected);
+        CHECK("setup", 0 == asr_sim_get_stats(sim)->bad_status);
+        // The trace has to have held everything for the response counts to be right
+        CHECK("setup", af_lib_get_trace(af_lib, s_trace, sizeof(s_trace)) < sizeof(s_trace));
+        af_lib_destroy(af_lib);
+    }
+    if (transport != NULL) {
+        asr_sim_transport_destroy(transport);
+    }
+    asr_sim_destroy(sim);
+
+    if (s_failures > 0) {
+        fprintf(stderr, "af_test_window: %d checks failed\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,355 @@
+/**
+ * Copyright 2018 Afero, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * af_trace_to_chrome: turn an afLib trace into a timeline for chrome://tracing or ui.perfetto.dev.
+ *
+ *     af_trace_to_chrome [file] > trace.json
+ *
+ * The input is either a log with af_lib_dump_trace() lines in it, anything else on the lines is skipped, or the raw
+ * bytes af_lib_get_trace() copied out. It reads standard input without a file. The timeline has a track for the
+ * state machine's states, one for whole transfers named after the commands that went over, and one with a slice
+ * from each get or set going out to the ASR answering it. Built from the repository root with:
+ *
+ *     cc -std=gnu99 -I. -o af_trace_to_chrome extras/trace/af_trace_to_chrome.c
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "af_trace.h"
+
+// The state machine's states, as af_lib.c numbers them
+static const char * const s_state_names[] = {
+    "IDLE",
+    "STATUS_SYNC",
+    "2",
+    "STATUS_ACK",
+    "SEND_BYTES",
+    "RECV_BYTES",
+    "CMD_COMPLETE",
+    "WAITING_FOR_SET_RESPONSE",
+};
+#define STATE_IDLE                          0
+#define STATE_WAITING_FOR_SET_RESPONSE      7
+#define STATE_COUNT                         (sizeof(s_state_names) / sizeof(s_state_names[0]))
+
+#define TID_STATES                          1
+#define TID_TRANSFERS                       2
+#define TID_REQUESTS                        3
+
+typedef struct {
+    uint64_t time;      // Microseconds since the first record, unwrapped
+    uint16_t attr_id;
+    uint16_t len;
+    uint8_t state;
+    uint8_t event;
+} record_t;
+
+static bool s_first_event = true;
+
+// When the last command for each attribute went out, plus one so 0 means never
+static uint64_t s_sent[65536];
+
+static const char *state_name(uint8_t state) {
+    static char unknown[8];
+
+    if (state < STATE_COUNT) {
+        return s_state_names[state];
+    }
+    snprintf(unknown, sizeof(unknown), "%u", state);
+    return unknown;
+}
+
+static void begin_event(const char *ph, int tid, uint64_t time, const char *name) {
+    printf("%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"name\":\"%s\"", s_first_event ? "" : ",", ph, tid, (unsigned long long)time, name);
+    s_first_event = false;
+}
+
+static void thread_name(int tid, const char *name) {
+    begin_event("M", tid, 0, "thread_name");
+    printf(",\"args\":{\"name\":\"%s\"}}", name);
+}
+
+static void complete_event(int tid, uint64_t start, uint64_t end, const char *name, uint16_t attr_id, uint16_t len) {
+    begin_event("X", tid, start, name);
+    printf(",\"dur\":%llu,\"args\":{\"attr\":%u,\"len\":%u}}", (unsigned long long)(end - start), attr_id, len);
+}
+
+static void instant_event(int tid, uint64_t time, const char *name, uint16_t attr_id, uint16_t len) {
+    begin_event("i", tid, time, name);
+    printf(",\"s\":\"t\",\"args\":{\"attr\":%u,\"len\":%u}}", attr_id, len);
+}
+
+static void async_event(const char *ph, uint64_t time, uint16_t attr_id, uint16_t request_id) {
+    char name[32];
+
+    snprintf(name, sizeof(name), "attr %u", attr_id);
+    begin_event(ph, TID_REQUESTS, time, name);
+    printf(",\"cat\":\"request\",\"id\":%u,\"args\":{\"request\":%u}}", attr_id, request_id);
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * read_input
+ *
+ * Read everything, then if it has af_lib_dump_trace() lines in it pull the records out of them in place.
+ */
+static uint8_t *read_input(FILE *f, size_t *len) {
+    uint8_t *data = NULL;
+    size_t size = 0;
+    size_t n;
+    char *line;
+    char *next;
+    char *end;
+    size_t out = 0;
+    int hi;
+    int lo;
+    uint8_t i;
+
+    *len = 0;
+    do {
+        if (*len + 4096 > size) {
+            size = size * 2 + 4096;
+            data = (uint8_t *)realloc(data, size + 1);
+            if (NULL == data) {
+                return NULL;
+            }
+        }
+        n = fread(&data[*len], 1, size - *len, f);
+        *len += n;
+    } while (n > 0);
+    data[*len] = 0;
+
+    if (memchr(data, 0, *len) != NULL || NULL == strstr((char *)data, AF_TRACE_LOG_PREFIX)) {
+        return data;
+    }
+    // Each record comes out at most as long as its hex, so they can be written over the text already read
+    end = (char *)&data[*len];
+    for (line = (char *)data; line < end; line = next + 1) {
+        next = strchr(line, '\n');
+        if (NULL == next) {
+            next = end;
+        }
+        *next = 0;
+        line = strstr(line, AF_TRACE_LOG_PREFIX);
+        if (NULL == line || next - line < (ptrdiff_t)(sizeof(AF_TRACE_LOG_PREFIX) - 1 + 2 * AF_TRACE_RECORD_SIZE)) {
+            continue;
+        }
+        line += sizeof(AF_TRACE_LOG_PREFIX) - 1;
+        for (i = 0; i < AF_TRACE_RECORD_SIZE; i++) {
+            hi = hex_digit(line[2 * i]);
+            lo = hex_digit(line[2 * i + 1]);
+            if (hi < 0 || lo < 0) {
+                break;
+            }
+            data[out + i] = (uint8_t)(hi << 4 | lo);
+        }
+        if (AF_TRACE_RECORD_SIZE == i) {
+            out += AF_TRACE_RECORD_SIZE;
+        }
+    }
+    *len = out;
+    return data;
+}
+
+static uint32_t read_32(const uint8_t *d) {
+    return (uint32_t)d[0] | (uint32_t)d[1] << 8 | (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24;
+}
+
+static uint16_t read_16(const uint8_t *d) {
+    return (uint16_t)(d[0] | d[1] << 8);
+}
+
+/**
+ * parse_records
+ *
+ * Times are 32 bit microseconds that wrap every 71 minutes, so carry the wraps along and start the timeline at 0.
+ */
+static size_t parse_records(const uint8_t *data, size_t len, record_t *records) {
+    size_t count = len / AF_TRACE_RECORD_SIZE;
+    uint64_t base = 0;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t time;
+    size_t i;
+
+    for (i = 0; i < count; i++, data += AF_TRACE_RECORD_SIZE) {
+        time = read_32(data);
+        if (0 == i) {
+            first = last = time;
+        }
+        if (time < last) {
+            base += 1ULL << 32;
+        }
+        last = time;
+        records[i].time = base + time - first;
+        records[i].attr_id = read_16(&data[4]);
+        records[i].len = read_16(&data[6]);
+        records[i].state = data[8];
+        records[i].event = data[9];
+    }
+    return count;
+}
+
+static bool is_resting(uint8_t state) {
+    return STATE_IDLE == state || STATE_WAITING_FOR_SET_RESPONSE == state;
+}
+
+static void convert(const record_t *records, size_t count) {
+    char name[48];
+    const record_t *r;
+    const record_t *state = NULL;   // The STATE record for the slice open on the states track
+    bool in_transfer = false;
+    uint64_t transfer_start = 0;
+    uint16_t transfer_attr = 0;
+    uint8_t transfer_commands = 0;
+    bool transfer_received = false;
+    size_t i;
+
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    thread_name(TID_STATES, "state machine");
+    thread_name(TID_TRANSFERS, "transfers");
+    thread_name(TID_REQUESTS, "requests");
+
+    for (i = 0; i < count; i++) {
+        r = &records[i];
+        switch (r->event) {
+            case AF_TRACE_EVENT_STATE:
+                if (state != NULL) {
+                    complete_event(TID_STATES, state->time, r->time, state_name(state->state), state->attr_id, state->len);
+                }
+                state = r;
+
+                if (!in_transfer && !is_resting(r->state)) {
+                    in_transfer = true;
+                    transfer_start = r->time;
+                    transfer_attr = 0;
+                    transfer_commands = 0;
+                    transfer_received = false;
+                } else if (in_transfer && is_resting(r->state)) {
+                    in_transfer = false;
+                    if (0 == transfer_commands) {
+                        snprintf(name, sizeof(name), "sync");
+                    } else if (1 == transfer_commands) {
+                        snprintf(name, sizeof(name), "%s attr %u", transfer_received ? "receive" : "send", transfer_attr);
+                    } else {
+                        snprintf(name, sizeof(name), "send attr %u + %u more", transfer_attr, transfer_commands - 1);
+                    }
+                    complete_event(TID_TRANSFERS, transfer_start, r->time, name, transfer_attr, transfer_commands);
+                }
+                break;
+
+            case AF_TRACE_EVENT_SENT:
+            case AF_TRACE_EVENT_RECEIVED:
+                if (AF_TRACE_EVENT_SENT == r->event) {
+                    s_sent[r->attr_id] = r->time + 1;
+                }
+                if (0 == transfer_commands++) {
+                    transfer_attr = r->attr_id;
+                }
+                transfer_received = AF_TRACE_EVENT_RECEIVED == r->event;
+                instant_event(TID_TRANSFERS, r->time, AF_TRACE_EVENT_SENT == r->event ? "sent" : "received", r->attr_id, r->len);
+                break;
+
+            case AF_TRACE_EVENT_INTERRUPT:
+                instant_event(TID_STATES, r->time, "interrupt", r->attr_id, r->len);
+                break;
+
+            case AF_TRACE_EVENT_SYNC_RETRY:
+                instant_event(TID_STATES, r->time, "sync retry", r->attr_id, r->len);
+                break;
+
+            case AF_TRACE_EVENT_QUEUED:
+                instant_event(TID_REQUESTS, r->time, "queued", r->attr_id, r->len);
+                break;
+
+            case AF_TRACE_EVENT_RESPONSE:
+                // The request went out with the last command for the attribute, unless that was before the trace starts
+                if (s_sent[r->attr_id] != 0) {
+                    async_event("b", s_sent[r->attr_id] - 1, r->attr_id, r->len);
+                    async_event("e", r->time, r->attr_id, r->len);
+                    s_sent[r->attr_id] = 0;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+    // Whatever the state machine was last doing runs to the end of the trace
+    if (state != NULL && count > 0) {
+        complete_event(TID_STATES, state->time, records[count - 1].time, state_name(state->state), state->attr_id, state->len);
+    }
+    printf("\n]}\n");
+}
+
+int main(int argc, char **argv) {
+    FILE *f = stdin;
+    uint8_t *data;
+    record_t *records;
+    size_t len;
+    size_t count;
+
+    if (argc > 2 || (2 == argc && '-' == argv[1][0])) {
+        fprintf(stderr, "usage: %s [file] > trace.json\n", argv[0]);
+        return 1;
+    }
+    if (2 == argc) {
+        f = fopen(argv[1], "rb");
+        if (NULL == f) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    data = read_input(f, &len);
+    if (f != stdin) {
+        fclose(f);
+    }
+    if (NULL == data) {
+        fprintf(stderr, "af_trace_to_chrome: out of memory\n");
+        return 1;
+    }
+
+    records = (record_t *)malloc((len / AF_TRACE_RECORD_SIZE + 1) * sizeof(record_t));
+    if (NULL == records) {
+        fprintf(stderr, "af_trace_to_chrome: out of memory\n");
+        return 1;
+    }
+    count = parse_records(data, len, records);
+    if (0 == count) {
+        fprintf(stderr, "af_trace_to_chrome: no trace records found\n");
+    }
+    convert(records, count);
+
+    free(records);
+    free(data);
+    return 0;
+}